@@ -22,12 +22,15 @@
 #include "args.h"
 #include "paper.h"
 #include "usage.h"
+#include "cache.h"
+#include "shcache.h"
+#include "raster.h"
+#include "pdfopt.h"
 
 #define USAGE(args...) { char buf[S_LEN]; snprintf(buf, S_LEN, args); usage(buf);}
-typedef void (*usage_func_t)(char *);
-
-time_t mtime_store;
-args_t args_store = {
+static time_t mtime_store;
+// defaults, before the config file and the command line
+const args_t args_default = {
     // option flags
     .twocols=-1, .numbering=0, .header=1, .punchmark=1, .duplex=1,
     .portrait=1, .longedge=0, .tab=TAB, .notebook=0, .fold_arrow=1,
@@ -37,20 +40,27 @@ args_t args_store = {
     .side_slant=-1, .side_weight=-1,
     .wmark_slant=PANGO_STYLE_NORMAL, .wmark_weight=PANGO_WEIGHT_BOLD,
     .rotate_right=0, .upside_down_page=0, .force_duplex=0,
+    .stats=0, .deterministic=-1, .incremental=0, .follow=0, .stream=0, .native=0,
+    .optimize=0, .compress_level=PDFOPT_LEVEL, .linearize=0,
     // option strings
     .fontname=NULL, .headerfont=NULL, .in_fname=NULL, .date_format=DATE_FORMAT,
     .headertext=NULL, .outfile=NULL, .binded_edge=NULL, .paper=NULL,
     .wmark_text=NULL, .wmark_font=WATERMARK_FONT,
+    .cache_dir=NULL, .tee=NULL, .png=NULL,
     // font size
     .fontsize=0, .header_height=0, .head_size=0, .side_size=0,
     .wmark_r=WMARK_R, .wmark_g=WMARK_G, .wmark_b=WMARK_B,
     // paper size and margins
     /* pwidth, pheight, */ .binding=-1, .pleft=-1, .pright=-1, .ptop=-1, .pbottom=-1,
     .divide=-1, .betweenline=BETWEEN_L,
+    .cache_size=CACHE_SIZE, .follow_timeout=0, .shape_cache=SHCACHE_SIZE,
+    .dpi=RASTER_DPI,
     // file modified time
-    .mtime=&mtime_store,
+    .mtime=NULL,
 };
-args_t *args = &args_store;
+// of the command line (getargs())
+static args_t args_store;
+static args_t *args = &args_store;
 
 typedef enum i_option
 { i_help, i_version, i_inch, i_mm, i_binding, i_left, i_right, i_top, i_bottom, 
@@ -59,7 +69,9 @@ typedef enum i_option
   i_unit, i_orient, i_hslant, i_hweigbt, i_bfont, i_bsize, i_bweight,
   i_bslant, i_bspace, i_tab, i_side_size, i_side_slant, i_side_weight,
   i_wm_text, i_wm_font, i_wm_slant, i_wm_weight, i_wm_color, i_paper,
-  i_force_dup, i_END } i_option_t;
+  i_force_dup, i_cache_dir, i_cache_size, i_stats, i_determ,
+  i_incr, i_follow, i_follow_to, i_stream, i_backend, i_shape_cache,
+  i_tee, i_png, i_dpi, i_optimize, i_comp_level, i_linearize, i_END } i_option_t;
 
 #define NOARG no_argument 
 #define REQARG required_argument
@@ -111,7 +123,23 @@ struct option long_options[]={
     /* 40 i_wm_color    */ { "watermark-color",    REQARG,  0,  0 },
     /* 41 i_paper       */ { "paper",              REQARG,  0, 'P'},
     /* 42 i_force_dup.  */ { "force-duplex",       OPTARG,  0,  0 },
-    /* 43 i_END         */ { 0, 0, 0, 0 }
+    /* 43 i_cache_dir   */ { "cache-dir",          REQARG,  0,  0 },
+    /* 44 i_cache_size  */ { "cache-size",         REQARG,  0,  0 },
+    /* 45 i_stats       */ { "stats",              OPTARG,  0,  0 },
+    /* 46 i_determ      */ { "deterministic",      OPTARG,  0,  0 },
+    /* 47 i_incr        */ { "incremental",        OPTARG,  0,  0 },
+    /* 48 i_follow      */ { "follow",             OPTARG,  0,  0 },
+    /* 49 i_follow_to   */ { "follow-timeout",     REQARG,  0,  0 },
+    /* 50 i_stream      */ { "stream",             OPTARG,  0,  0 },
+    /* 51 i_backend     */ { "backend",            REQARG,  0,  0 },
+    /* 52 i_shape_cache */ { "shape-cache",        REQARG,  0,  0 },
+    /* 53 i_tee         */ { "tee",                REQARG,  0,  0 },
+    /* 54 i_png         */ { "png",                REQARG,  0,  0 },
+    /* 55 i_dpi         */ { "dpi",                REQARG,  0,  0 },
+    /* 56 i_optimize    */ { "optimize",           OPTARG,  0,  0 },
+    /* 57 i_comp_level  */ { "compress-level",     REQARG,  0,  0 },
+    /* 58 i_linearize   */ { "linearize",          OPTARG,  0,  0 },
+    /* 59 i_END         */ { 0, 0, 0, 0 }
 };
 
 #define LONGOP_NAMELEN 32
@@ -127,7 +155,7 @@ void conf_usage(char *message);
 int  do_shortop(struct option *loption, char *value);
 void read_config(char *path);
 char *cmd2opt(const char *cmd, int is_conf_file);
-void parser(int short_index, int long_index, char *argstr, usage_func_t usage, int is_conf_file);
+void parser(args_t *args, int short_index, int long_index, char *argstr, usage_func_t usage, int is_conf_file);
 void chk_slant(int *value, char *str, char *opt, usage_func_t usage);
 void chk_weight(int *value, char *str, char *opt, usage_func_t usage);
 void chk_sw(int *r, char *str, char *positive, char *negative, char *opt, usage_func_t usage);
@@ -147,7 +175,7 @@ void conf_usage(char *message){
 int do_shortop(struct option *loption, char *value){
     if ((loption->flag == NULL) && (loption->val != 0)){
         // parse as short option 
-        parser(loption->val, 0, value, conf_usage, 1);
+        parser(args, loption->val, 0, value, conf_usage, 1);
 
         return 1;
     }
@@ -208,12 +236,12 @@ void read_config(char *path){
             switch (long_options[index].has_arg){
             case no_argument:
                 if (do_shortop(&long_options[index], NULL)) break;
-                parser(0, index, NULL, conf_usage, 1);
+                parser(args, 0, index, NULL, conf_usage, 1);
                 break;
             case required_argument:
                 if (do_shortop(&long_options[index], NULL)) break;
                 if (count==2){
-                    parser(0, index, value, conf_usage, 1);
+                    parser(args, 0, index, value, conf_usage, 1);
                 } else {
                     USAGE("%s require an argument\n", key);
                 }
@@ -221,9 +249,9 @@ void read_config(char *path){
             case optional_argument:
                 if (do_shortop(&long_options[index], NULL)) break;
                 if (count==1) {
-                    parser(0, index, NULL, conf_usage, 1); 
+                    parser(args, 0, index, NULL, conf_usage, 1); 
                 } else {
-                    parser(0, index, value, conf_usage, 1);
+                    parser(args, 0, index, value, conf_usage, 1);
                 }
                 break;
             } // switch()
@@ -245,7 +273,7 @@ char *cmd2opt(const char *cmd, int is_conf_file){
     return opt;
 }
 
-void parser(int short_index, int long_index, char *argstr, usage_func_t usage, int is_conf_file){
+void parser(args_t *args, int short_index, int long_index, char *argstr, usage_func_t usage, int is_conf_file){
     if (short_index == 0) {
         // long option
         char *opt=cmd2opt(long_options[long_index].name, is_conf_file);
@@ -359,6 +387,54 @@ void parser(int short_index, int long_index, char *argstr, usage_func_t usage, i
             chk_color(&args->wmark_r, &args->wmark_g, &args->wmark_b, argstr, opt, usage); break;
         case i_force_dup:
             chk_onoff(&args->force_duplex, argstr, opt, usage); break;
+        case i_cache_dir:
+            args->cache_dir=argstr; break;
+        case i_cache_size:
+            if (!get_double(argstr, &args->cache_size) || (args->cache_size <= 0)) {
+                USAGE("%s%s was wrong.\nExample: %s256\n", opt, argstr, opt);
+            }
+            break;
+        case i_stats:
+            chk_onoff(&args->stats, argstr, opt, usage); break;
+        case i_determ:
+            chk_onoff(&args->deterministic, argstr, opt, usage); break;
+        case i_incr:
+            chk_onoff(&args->incremental, argstr, opt, usage); break;
+        case i_follow:
+            chk_onoff(&args->follow, argstr, opt, usage); break;
+        case i_stream:
+            chk_onoff(&args->stream, argstr, opt, usage); break;
+        case i_backend:
+            chk_sw(&args->native, argstr, "native", "cairo", opt, usage); break;
+        case i_tee:
+            args->tee=argstr; break;
+        case i_png:
+            args->png=argstr; break;
+        case i_dpi:
+            if (!get_double(argstr, &args->dpi) || (args->dpi <= 0)) {
+                USAGE("%s%s was wrong.\nExample: %s150\n", opt, argstr, opt);
+            }
+            break;
+        case i_optimize:
+            chk_onoff(&args->optimize, argstr, opt, usage); break;
+        case i_linearize:
+            chk_onoff(&args->linearize, argstr, opt, usage); break;
+        case i_comp_level:
+            if ((sscanf(argstr, "%d", &args->compress_level) < 1)
+                || (args->compress_level < 0) || (args->compress_level > 9)) {
+                USAGE("%s%s was wrong: 0-9.\nExample: %s9\n", opt, argstr, opt);
+            }
+            break;
+        case i_shape_cache:
+            if (!get_double(argstr, &args->shape_cache) || (args->shape_cache < 0)) {
+                USAGE("%s%s was wrong.\nExample: %s64\n", opt, argstr, opt);
+            }
+            break;
+        case i_follow_to:
+            if (!get_double(argstr, &args->follow_timeout) || (args->follow_timeout < 0)) {
+                USAGE("%s%s was wrong.\nExample: %s60\n", opt, argstr, opt);
+            }
+            break;
         } // switch (lindex)
     } else {
         // short option
@@ -463,7 +539,7 @@ void chk_color(double *r, double *g, double *b, char *argstr, char *opt, usage_f
 // get full path of "~/.utpdfrc" 
 char *getconfpath(){
     static char path[S_LEN];
-    if (makepdf){
+    if (utpdf_makepdf){
         snprintf(path, S_LEN, "%s/%s", getenv("HOME"), PDF_CONF_FILE);
     } else {
         snprintf(path, S_LEN, "%s/%s", getenv("HOME"), PS_CONF_FILE);
@@ -514,12 +590,14 @@ int parse_conf(char *str, char *key, char *value){
     return 2;
 }
 
-void getargs(int argc, char **argv){
+args_t *getargs(int argc, char **argv){
     // for getopt_long()
     int opt, long_index;
 
     // initialization
-    args->one_output=!makepdf;
+    args_store = args_default;
+    args->mtime = &mtime_store;
+    args->one_output=!utpdf_makepdf;
     
     // fetch from config file
     read_config(getconfpath());
@@ -527,13 +605,114 @@ void getargs(int argc, char **argv){
     // fetch from command line
     while ((opt = getopt_long
             (argc, argv, "12bc:df:F:hlmno:pP:sS:t:V", long_options, &long_index)) != -1){
-        parser(opt, long_index, optarg, (usage_func_t )usage, 0);
+        parser(args, opt, long_index, optarg, (usage_func_t )usage, 0);
     }
 
     // input files are exist?
     if (optind >= argc) {
 	usage("No file specified\n");
     }
+    args_settle(args, utpdf_makepdf, (usage_func_t )usage);
+    return args;
+}
+
+// sets an option of the config file to another args_t (libutpdf).
+// value may be NULL for options of an optional argument.
+// returns 0, or -1 after usage() at an unknown option or a missing argument.
+int args_set(args_t *to, const char *name, char *value, usage_func_t usage){
+    struct option *o;
+    int index = i_inch;
+
+    // compare name and long_options[index].name from i_inch to i_END-1.
+    while ((index < i_END) && (strncmp(name, long_options[index].name, LONGOP_NAMELEN) != 0)){
+        index++;
+    }
+    if (index == i_END){
+        USAGE("%s: No such option.\n", name);
+        return -1;
+    }
+    o = &long_options[index];
+    if (o->flag != NULL){
+        // the same member of to as the flag in args_store
+        *(int *)((char *)to + ((char *)o->flag - (char *)&args_store)) = o->val;
+        return 0;
+    }
+    if ((o->has_arg == required_argument) && (value == NULL)){
+        USAGE("%s require an argument\n", name);
+        return -1;
+    }
+    if (o->val != 0){
+        parser(to, o->val, 0, value, usage, 1);
+    } else {
+        parser(to, 0, index, value, usage, 1);
+    }
+    return 0;
+}
+
+// paper size and orientation of the output format.
+// pdf: PDF or PostScript. usage() is called at an unknown paper.
+void args_paper(args_t *args, int pdf, usage_func_t usage){
+    int p, result=-1;
+    if (args->paper != NULL){
+        for (p=0; p<PAPERS_END; p++){
+            if (strncmp(args->paper, paper_sizes[p].pname, PNAME_SIZE)==0){
+                result = p;
+                break;
+            }
+        }
+        if (p>=PAPERS_END) {
+            USAGE("Unknown paper:%s\n", args->paper);
+            result = PNAME_DEFAULT;
+        }
+    } else {
+        result = PNAME_DEFAULT;
+    }
+    if (pdf){
+        // PDF
+        args->rotate_right=0;
+        args->upside_down_page=0;
+        if (args->portrait){
+            args->pwidth  = paper_sizes[result].w;
+            args->pheight = paper_sizes[result].h;
+        } else {
+            args->pwidth  = paper_sizes[result].h;
+            args->pheight = paper_sizes[result].w;
+        }
+        args->phys_width = args->pwidth;
+        args->phys_height = args->pheight;
+    } else {
+        // PostScript
+        args->phys_width = paper_sizes[result].w;
+        args->phys_height = paper_sizes[result].h;
+        if (args->portrait){
+            // portrait
+            args->pwidth  = paper_sizes[result].w;
+            args->pheight = paper_sizes[result].h;
+            if (args->longedge){
+                args->rotate_right=0;
+                args->upside_down_page=0;
+            } else {
+                args->rotate_right=0;
+                args->upside_down_page=1;
+            }
+        } else {
+            // landscape
+            args->pwidth  = paper_sizes[result].h;
+            args->pheight = paper_sizes[result].w;
+            if (args->longedge){
+                args->rotate_right=1;
+                args->upside_down_page=0;
+            } else {
+                args->rotate_right=1;
+                args->upside_down_page=1;
+            }
+        } // if (args->portrait) ... else
+    } // if (pdf) else
+}
+
+// options which depend on others, paper size and margins in point.
+// pdf: PDF or PostScript. usage() is called at a wrong option.
+void args_settle(args_t *args, int pdf, usage_func_t usage){
     // twoside default setting
     if (args->twocols == -1) {
 	args->twocols = (!args->portrait);
@@ -568,6 +747,40 @@ void getargs(int argc, char **argv){
         args->side_weight = args->hfont_weight;
     }
     
+    // follow mode writes every page as soon as it is filled.
+    if (args->follow) {
+        if (pdf) {
+            usage("--follow is available only for utps\n");
+        }
+        args->stream = 1;
+    }
+    if (args->stream && pdf) {
+        usage("--stream is available only for utps\n");
+    }
+    if (args->optimize && !pdf) {
+        usage("--optimize is available only for utpdf\n");
+    }
+    if (args->linearize && !pdf) {
+        usage("--linearize is available only for utpdf\n");
+    }
+    // the other format and PNG of the same layout, by cairo only
+    if ((args->tee != NULL) || (args->png != NULL)) {
+        if (args->native) {
+            usage("--tee and --png are available only with --backend=cairo\n");
+        }
+        if (!args->one_output) {
+            usage("--tee and --png need one output: -o <file>\n");
+        }
+        // neither the cache nor incremental mode knows the other outputs
+        args->cache_dir = NULL;
+        args->incremental = 0;
+    }
+
+    // cached output must not depend on when it was made
+    if (args->deterministic < 0) {
+        args->deterministic = (args->cache_dir != NULL);
+    }
+
     // font name
     if (args->fontname == NULL) {
 	args->fontname=DEFAULT_FONT;
@@ -597,65 +810,7 @@ void getargs(int argc, char **argv){
         }
     }
 
-    // paper
-    {
-	int p, result=-1;
-	if (args->paper != NULL){
-	    for (p=0; p<PAPERS_END; p++){
-		if (strncmp(args->paper, paper_sizes[p].pname, PNAME_SIZE)==0){
-                    result = p;
-                    break;
-                }
-            }
-	    if (p>=PAPERS_END) {
-                USAGE("Unknown paper:%s\n", args->paper);
-                result = PNAME_DEFAULT;
-            }
-        } else {
-            result = PNAME_DEFAULT;
-        }
-        if (makepdf){
-            // PDF
-            args->rotate_right=0;
-            args->upside_down_page=0;
-            if (args->portrait){
-                args->pwidth  = paper_sizes[result].w;
-                args->pheight = paper_sizes[result].h;
-            } else {
-                args->pwidth  = paper_sizes[result].h;
-                args->pheight = paper_sizes[result].w;
-            }
-            args->phys_width = args->pwidth;
-            args->phys_height = args->pheight;
-        } else {
-            // PostScript
-            args->phys_width = paper_sizes[result].w;
-            args->phys_height = paper_sizes[result].h;
-            if (args->portrait){
-                // portrait
-                args->pwidth  = paper_sizes[result].w;
-                args->pheight = paper_sizes[result].h;
-                if (args->longedge){
-                    args->rotate_right=0;
-                    args->upside_down_page=0;
-                } else {
-                    args->rotate_right=0;
-                    args->upside_down_page=1;
-                }
-            } else {
-                // landscape
-                args->pwidth  = paper_sizes[result].h;
-                args->pheight = paper_sizes[result].w;
-                if (args->longedge){
-                    args->rotate_right=1;
-                    args->upside_down_page=0;
-                } else {
-                    args->rotate_right=1;
-                    args->upside_down_page=1;
-                }
-            } // if (args->portrait) ... else
-        } // if (makepdf) else
-    } // end of paper
+    args_paper(args, pdf, usage);
 
     // margins
     if (args->inch) {
@@ -32,23 +32,38 @@ typedef struct arguments {
     int hfont_slant, hfont_weight, bfont_slant, bfont_weight;
     int side_slant, side_weight, wmark_slant, wmark_weight;
     int rotate_right, upside_down_page, force_duplex;
+    int stats, deterministic, incremental, follow, stream, native;
+    int optimize, compress_level, linearize;
     // option strings
     char *fontname, *headerfont, *in_fname, *date_format, *headertext, *outfile;
     char *binded_edge, *paper, *wmark_text, *wmark_font;    
+    char *cache_dir, *tee, *png;
     // option length
     double fontsize, header_height, head_size, side_size;
     double wmark_r, wmark_g, wmark_b;
     // paper size and margins
     double pwidth, pheight, phys_width, phys_height;
     double binding, pleft, pright, ptop, pbottom, divide, betweenline;
+    // output cache size (MB)
+    double cache_size;
+    // memory budget of shaped lines (MB)
+    double shape_cache;
+    // resolution of --png
+    double dpi;
+    // idle seconds to stop --follow
+    double follow_timeout;
     // file modified time
     time_t *mtime;
 } args_t;
 
-extern args_t *args;
-extern args_t args_store;
+typedef void (*usage_func_t)(char *);
 
-extern void getargs(int argc, char **argv);
+extern const args_t args_default;
+
+extern args_t *getargs(int argc, char **argv);
+extern void args_settle(args_t *args, int pdf, usage_func_t usage);
+extern void args_paper(args_t *args, int pdf, usage_func_t usage);
+extern int  args_set(args_t *to, const char *name, char *value, usage_func_t usage);
 
 #endif
 // end of args.h
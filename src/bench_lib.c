@@ -0,0 +1,240 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "libutpdf.h"
+
+/*
+  per-job latency of a small document (a page): jobs of libutpdf in
+  memory, against spawning ./utpdf for every document.
+
+  Then jobs of different options are rendered in two threads at the
+  same time, and each output must be same as the one rendered alone:
+  the render path must not share any state between jobs.
+
+  At last, the native PostScript writer must send every glyph once,
+  even if it is used on more pages.
+*/
+
+#define JOBS  50
+#define LINES 40
+#define SMALL_DOC "bench-small.txt"
+#define THREAD_JOBS 20
+
+extern char **environ;
+
+typedef struct render_check {
+    utpdf_options *opt;
+    const char *text;
+    size_t len;
+    utpdf_buffer alone;
+    int mismatch;
+} render_check;
+
+//
+// forward declaration
+double now();
+void render(render_check *c, utpdf_buffer *out);
+void *render_thread(void *arg);
+int render_threads(const char *text, size_t len);
+int glyphs_sent_twice(const char *text, size_t len);
+//
+//
+
+double now(){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+void render(render_check *c, utpdf_buffer *out){
+    utpdf_job *job=utpdf_job_new_buffer(c->opt, 1, out);
+
+    utpdf_add_memory(job, SMALL_DOC, c->text, c->len);
+    utpdf_finish(job);
+}
+
+void *render_thread(void *arg){
+    render_check *c=arg;
+    int i;
+
+    for (i=0; i<THREAD_JOBS; i++){
+        utpdf_buffer out={NULL, 0, 0};
+
+        render(c, &out);
+        if ((out.len != c->alone.len) || (memcmp(out.data, c->alone.data, out.len) != 0)){
+            c->mismatch++;
+        }
+        utpdf_buffer_free(&out);
+    }
+    return NULL;
+}
+
+// returns the jobs whose output differs from the one rendered alone
+int render_threads(const char *text, size_t len){
+    render_check c[2];
+    pthread_t th[2];
+    int i, mismatch=0;
+
+    // every date of deterministic output, set before the threads
+    setenv("SOURCE_DATE_EPOCH", "0", 0);
+    for (i=0; i<2; i++){
+        c[i].opt = utpdf_options_new();
+        utpdf_options_set(c[i].opt, "deterministic", NULL);
+        c[i].text = text;
+        c[i].len = len;
+        c[i].mismatch = 0;
+        c[i].alone = (utpdf_buffer){NULL, 0, 0};
+    }
+    // different layouts, fonts and line numbers
+    utpdf_options_set(c[0].opt, "orientation", "portrait");
+    utpdf_options_set(c[0].opt, "number", NULL);
+    utpdf_options_set(c[1].opt, "orientation", "landscape");
+    utpdf_options_set(c[1].opt, "body-size", "12");
+    for (i=0; i<2; i++){
+        render(&c[i], &c[i].alone);
+    }
+    for (i=0; i<2; i++){
+        pthread_create(&th[i], NULL, render_thread, &c[i]);
+    }
+    for (i=0; i<2; i++){
+        pthread_join(th[i], NULL);
+        mismatch += c[i].mismatch;
+        utpdf_buffer_free(&c[i].alone);
+        utpdf_options_free(c[i].opt);
+    }
+    return mismatch;
+}
+
+// "dup <gid> ..." of a glyph under "/F<id>-CID ... /GlyphDirectory get"
+// (Type 42) or "globaldict /F<id>.G get" (Type 3). returns the glyphs
+// sent more than once in two pages of the same text.
+int glyphs_sent_twice(const char *text, size_t len){
+    utpdf_options *opt=utpdf_options_new();
+    utpdf_buffer out={NULL, 0, 0};
+    utpdf_job *job;
+    unsigned char *seen=NULL;
+    size_t nseen=0;
+    char *p, *line;
+    unsigned int font=0, gid;
+    int twice=0;
+
+    utpdf_options_set(opt, "backend", "native");
+    job = utpdf_job_new_buffer(opt, 0, &out);
+    // every file starts on a new page
+    utpdf_add_memory(job, SMALL_DOC, text, len);
+    utpdf_add_memory(job, SMALL_DOC, text, len);
+    utpdf_finish(job);
+    utpdf_options_free(opt);
+    // a terminated copy for sscanf()
+    p = malloc(out.len+1);
+    memcpy(p, out.data, out.len);
+    p[out.len] = '\0';
+    for (line=p; line != NULL; line=strchr(line, '\n')){
+        if (*line == '\n') line++;
+        if ((sscanf(line, "/F%u-CID /CIDFont findresource /GlyphDirectory %*s", &font) == 1)
+            || (sscanf(line, "globaldict /F%u.G get", &font) == 1)){
+            continue;
+        }
+        if (sscanf(line, "dup %u ", &gid) != 1) continue;
+        if ((size_t)font*65536+gid >= nseen){
+            size_t n=((size_t)font+1)*65536;
+
+            seen = realloc(seen, n);
+            memset(seen+nseen, 0, n-nseen);
+            nseen = n;
+        }
+        twice += (seen[(size_t)font*65536+gid]++ == 1);
+    }
+    free(seen);
+    free(p);
+    utpdf_buffer_free(&out);
+    return twice;
+}
+
+int main(){
+    char text[LINES*64];
+    char *argv[]={"utpdf", "-o", "/dev/null", SMALL_DOC, NULL};
+    utpdf_options *opt;
+    double t;
+    size_t len=0;
+    FILE *f;
+    int i, status;
+
+    for (i=1; i<=LINES; i++){
+        len += snprintf(text+len, sizeof(text)-len,
+                        "%d\tThe quick brown fox jumps over the lazy dog.\n", i);
+    }
+    opt = utpdf_options_new();
+
+    t = now();
+    for (i=0; i<JOBS; i++){
+        utpdf_buffer out={NULL, 0, 0};
+        utpdf_job *job=utpdf_job_new_buffer(opt, 1, &out);
+
+        utpdf_add_memory(job, SMALL_DOC, text, len);
+        utpdf_finish(job);
+        utpdf_buffer_free(&out);
+    }
+    printf("libutpdf: %.2f msec/job\n", (now()-t)*1000/JOBS);
+    utpdf_options_free(opt);
+
+    if ((f = fopen(SMALL_DOC, "w")) == NULL){
+        perror("Could not create: " SMALL_DOC);
+        exit(1);
+    }
+    fwrite(text, 1, len, f);
+    fclose(f);
+    t = now();
+    for (i=0; i<JOBS; i++){
+        pid_t pid;
+
+        if (posix_spawn(&pid, "./utpdf", NULL, NULL, argv, environ) != 0){
+            perror("Could not spawn ./utpdf");
+            exit(1);
+        }
+        waitpid(pid, &status, 0);
+    }
+    printf("utpdf:    %.2f msec/job\n", (now()-t)*1000/JOBS);
+    remove(SMALL_DOC);
+
+    if ((status = render_threads(text, len)) > 0){
+        printf("threads:  %d of %d job(s) differ from rendered alone\n",
+               status, 2*THREAD_JOBS);
+        return 1;
+    }
+    printf("threads:  %d jobs in 2 threads, same as rendered alone\n", 2*THREAD_JOBS);
+
+    if ((status = glyphs_sent_twice(text, len)) > 0){
+        printf("fonts:    %d glyph(s) sent again on the second page\n", status);
+        return 1;
+    }
+    printf("fonts:    every glyph sent once in 2 pages\n");
+    return 0;
+}
+
+// end of bench_lib.c
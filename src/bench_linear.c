@@ -0,0 +1,255 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE // memmem()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+  time to the first page of a PDF read by byte ranges over a network,
+  e.g. a viewer in a browser: RTT_MS per round trip and BANDWIDTH,
+  CHUNK bytes per range. Linearized PDF is read from the head up to
+  /E. The others are read from the tail: the xref, then the objects
+  of the first page, a round trip for every level of references.
+*/
+
+#define RTT_MS    50.0
+#define BANDWIDTH (1024.0*1024) // bytes per second
+#define CHUNK     65536
+
+typedef struct bench_fetch {
+    const char *buf;
+    long len;
+    char *have, *want;  // chunks
+    int trips;
+    long bytes;
+} fetch_t;
+
+//
+// forward declaration
+void want(fetch_t *f, long off, long end);
+void round_trip(fetch_t *f);
+long obj_end(fetch_t *f, long off);
+int follow(fetch_t *f, long off, long end, int *refs, int nrefs);
+void first_linearized(fetch_t *f, const char *lin);
+int first_plain(fetch_t *f);
+//
+//
+
+void want(fetch_t *f, long off, long end){
+    long c;
+
+    if (off < 0) off = 0;
+    if (end > f->len) end = f->len;
+    for (c=off/CHUNK; c*CHUNK<end; c++) f->want[c] = 1;
+}
+
+// the wanted chunks in a request of ranges
+void round_trip(fetch_t *f){
+    long c, n=(f->len+CHUNK-1)/CHUNK;
+    int any=0;
+
+    for (c=0; c<n; c++){
+        if (f->want[c] && !f->have[c]){
+            f->have[c] = 1;
+            f->bytes += ((c+1)*CHUNK < f->len) ? CHUNK : f->len-c*CHUNK;
+            any = 1;
+        }
+        f->want[c] = 0;
+    }
+    f->trips += any;
+}
+
+long obj_end(fetch_t *f, long off){
+    const char *p=memmem(f->buf+off, f->len-off, "endobj", 6);
+
+    return (p != NULL) ? p-f->buf+6 : f->len;
+}
+
+// references in the object at off, but /Parent and /Kids after the first
+int follow(fetch_t *f, long off, long end, int *refs, int nrefs){
+    const char *p=f->buf+off, *e=f->buf+end, *s;
+    int n=0, skip=0, kids=0;
+
+    if ((s = memmem(p, e-p, "obj", 3)) != NULL) p = s+3;
+    if ((s = memmem(p, e-p, "stream", 6)) != NULL) e = s;
+    while ((p < e) && (n < nrefs)){
+        if (*p == '(') {
+            int depth=0;
+
+            for (; p < e; p++){
+                if (*p == '\\') p++;
+                else if (*p == '(') depth++;
+                else if ((*p == ')') && (--depth == 0)) break;
+            }
+            p++;
+        } else if (*p == '/') {
+            skip = (strncmp(p, "/Parent", 7) == 0);
+            kids = (strncmp(p, "/Kids", 5) == 0) ? 1 : 0;
+            for (p++; (p < e) && (isalnum((unsigned char)*p) || (*p == '.')); p++);
+        } else if (isdigit((unsigned char)*p)) {
+            char *q;
+            long num=strtol(p, &q, 10), gen;
+
+            while ((q < e) && isspace((unsigned char)*q)) q++;
+            gen = isdigit((unsigned char)*q) ? strtol(q, &q, 10) : -1;
+            while ((q < e) && isspace((unsigned char)*q)) q++;
+            if ((gen >= 0) && (q < e) && (*q == 'R')){
+                if (!skip && (kids < 2)) refs[n++] = num;
+                skip = 0;
+                if (kids) kids = 2;
+                q++;
+            }
+            p = q;
+        } else {
+            if (*p == ']') kids = 0;
+            p++;
+        }
+    }
+    return n;
+}
+
+void first_linearized(fetch_t *f, const char *lin){
+    const char *e=strstr(lin, "/E ");
+
+    want(f, 0, CHUNK);
+    round_trip(f);
+    if (e != NULL){
+        want(f, 0, atol(e+3));
+        round_trip(f);
+    }
+}
+
+// 0: not a classic xref table
+int first_plain(fetch_t *f){
+    const char *p, *t;
+    long xref, *offsets=NULL;
+    int *level, *next, *refs, nlevel=1, size=0, i, k;
+    char *seen;
+
+    want(f, f->len-CHUNK, f->len);
+    round_trip(f);
+    for (p=f->buf+f->len-9; (p > f->buf) && strncmp(p, "startxref", 9); p--);
+    xref = atol(p+9);
+    if ((xref <= 0) || (xref >= f->len) || strncmp(f->buf+xref, "xref", 4)
+        || ((t = strstr(f->buf+xref, "trailer")) == NULL)){
+        return 0;
+    }
+    want(f, xref, strstr(t, ">>")-f->buf+2);
+    round_trip(f);
+    // entries of "first count" sections
+    for (p=f->buf+xref+4; p < t; ){
+        char *q;
+        long first=strtol(p, &q, 10), count=strtol(q, &q, 10);
+
+        while (isspace((unsigned char)*q)) q++;
+        if (first+count > size){
+            offsets = realloc(offsets, (first+count)*sizeof(long));
+            memset(offsets+size, 0, (first+count-size)*sizeof(long));
+            size = first+count;
+        }
+        for (i=0; i<count; i++, q+=20){
+            if (q[17] == 'n') offsets[first+i] = atol(q);
+        }
+        p = q;
+    }
+    if ((p = strstr(t, "/Root")) == NULL) return 0;
+    seen = calloc(size, 1);
+    level = calloc(size, sizeof(int));
+    next = calloc(size, sizeof(int));
+    refs = calloc(size, sizeof(int));
+    level[0] = atoi(p+5);
+    while (nlevel > 0){
+        int nnext=0;
+
+        for (i=0; i<nlevel; i++){
+            want(f, offsets[level[i]], obj_end(f, offsets[level[i]]));
+        }
+        round_trip(f);
+        for (i=0; i<nlevel; i++){
+            long off=offsets[level[i]];
+            int n=follow(f, off, obj_end(f, off), refs, size);
+
+            for (k=0; k<n; k++){
+                if ((refs[k] <= 0) || (refs[k] >= size) || seen[refs[k]]
+                    || (offsets[refs[k]] == 0)) continue;
+                seen[refs[k]] = 1;
+                next[nnext++] = refs[k];
+            }
+        }
+        memcpy(level, next, nnext*sizeof(int));
+        nlevel = nnext;
+    }
+    free(offsets);
+    free(seen);
+    free(level);
+    free(next);
+    free(refs);
+    return 1;
+}
+
+int main(int argc, char **argv){
+    int i;
+
+    printf("%-24s %12s %6s %12s %10s\n", "", "size", "trips", "bytes", "msec");
+    for (i=1; i<argc; i++){
+        fetch_t f;
+        FILE *in=fopen(argv[i], "rb");
+        char *buf, head[1025];
+        const char *lin;
+
+        if (in == NULL){
+            perror(argv[i]);
+            exit(1);
+        }
+        memset(&f, 0, sizeof(f));
+        fseek(in, 0, SEEK_END);
+        f.len = ftell(in);
+        rewind(in);
+        buf = malloc(f.len+1);
+        if (fread(buf, 1, f.len, in) != (size_t)f.len){
+            perror(argv[i]);
+            exit(1);
+        }
+        fclose(in);
+        buf[f.len] = '\0';
+        f.buf = buf;
+        f.have = calloc(f.len/CHUNK+1, 1);
+        f.want = calloc(f.len/CHUNK+1, 1);
+        memcpy(head, buf, (f.len < 1024) ? f.len : 1024);
+        head[(f.len < 1024) ? f.len : 1024] = '\0';
+        if ((lin = strstr(head, "/Linearized")) != NULL){
+            first_linearized(&f, lin);
+        }
+        if ((lin == NULL) && !first_plain(&f)){
+            printf("%-24s not a classic xref table\n", argv[i]);
+        } else {
+            printf("%-24s %12ld %6d %12ld %10.1f\n", argv[i], f.len, f.trips, f.bytes,
+                   f.trips*RTT_MS + f.bytes*1000/BANDWIDTH);
+        }
+        free(buf);
+        free(f.have);
+        free(f.want);
+    }
+    return 0;
+}
+
+// end of bench_linear.c
@@ -0,0 +1,383 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "utpdf.h"
+#include "args.h"
+#include "cache.h"
+
+/*
+  content-addressed output cache
+
+  <cache_dir>/<key>.pdf, <cache_dir>/<key>.ps : cache entries
+  <cache_dir>/stats                           : hit/miss counters
+  <cache_dir>/tmp-XXXXXX                      : entry under construction
+
+  key = FNV-1a(every output-affecting field of args_t,
+               for each input: name, header date, contents)
+
+  The mtime of an entry is its last use. When the directory grows
+  over the limit, entries are removed from the least recently used one.
+*/
+
+#define FNV_PRIME  0x00000100000001b3ULL
+
+typedef struct cache_entry {
+    char name[CACHE_KEYLEN+4];
+    time_t used;
+    off_t size;
+} cache_ent_t;
+
+// hits and misses in this run
+int cache_hits=0, cache_misses=0;
+
+//
+// forward declaration
+int  cache_hash_file(args_t *args, char *path, hash_t *h);
+int  cache_copy_fd(int from, int to);
+void cache_account(char *dir, int hit, long *hits, long *misses);
+int  cache_scan(char *dir, cache_ent_t **ents, double *total);
+void cache_evict(cache_t *c);
+//
+//
+
+hash_t hash_bytes(hash_t h, const void *p, size_t len){
+    const unsigned char *b=p;
+
+    while (len-- > 0){
+        h ^= *b++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+hash_t hash_str(hash_t h, const char *s){
+    if (s == NULL){
+        return hash_bytes(h, "\377", 1); // differs from ""
+    }
+    return hash_bytes(h, s, strlen(s)+1);
+}
+
+#define H_VAL(v) h=hash_bytes(h, &(v), sizeof(v))
+#define H_STR(s) h=hash_str(h, (s))
+
+// every field of args_t which changes output
+hash_t hash_args(hash_t h, args_t *args){
+    H_STR(VERSION); H_VAL(utpdf_makepdf);
+    // option flags
+    H_VAL(args->twocols);     H_VAL(args->numbering);  H_VAL(args->header);
+    H_VAL(args->punchmark);   H_VAL(args->duplex);     H_VAL(args->portrait);
+    H_VAL(args->longedge);    H_VAL(args->tab);        H_VAL(args->notebook);
+    H_VAL(args->fold_arrow);  H_VAL(args->border);     H_VAL(args->one_output);
+    H_VAL(args->hfont_slant); H_VAL(args->hfont_weight);
+    H_VAL(args->bfont_slant); H_VAL(args->bfont_weight);
+    H_VAL(args->side_slant);  H_VAL(args->side_weight);
+    H_VAL(args->wmark_slant); H_VAL(args->wmark_weight);
+    H_VAL(args->rotate_right); H_VAL(args->upside_down_page);
+    H_VAL(args->force_duplex); H_VAL(args->deterministic);
+    H_VAL(args->stream);      H_VAL(args->native);
+    H_VAL(args->optimize);    H_VAL(args->compress_level);
+    H_VAL(args->linearize);
+    // option strings
+    H_STR(args->fontname);    H_STR(args->headerfont); H_STR(args->date_format);
+    H_STR(args->headertext);  H_STR(args->wmark_text); H_STR(args->wmark_font);
+    // option length
+    H_VAL(args->fontsize);    H_VAL(args->header_height);
+    H_VAL(args->head_size);   H_VAL(args->side_size);
+    H_VAL(args->wmark_r);     H_VAL(args->wmark_g);    H_VAL(args->wmark_b);
+    // paper size and margins
+    H_VAL(args->pwidth);      H_VAL(args->pheight);
+    H_VAL(args->phys_width);  H_VAL(args->phys_height);
+    H_VAL(args->binding);     H_VAL(args->pleft);      H_VAL(args->pright);
+    H_VAL(args->ptop);        H_VAL(args->pbottom);    H_VAL(args->divide);
+    H_VAL(args->betweenline);
+    return h;
+}
+
+// name, header date and contents of one input
+int cache_hash_file(args_t *args, char *path, hash_t *h){
+    char buf[CACHE_BUFLEN];
+    struct stat stat_b;
+    time_t t;
+    int fd, rlen;
+
+    if ((fd=open(path, O_RDONLY)) < 0){
+        return 0;
+    }
+    if (fstat(fd, &stat_b) < 0){
+        close(fd);
+        return 0;
+    }
+    // same as the date on the header
+    if (args->current_t){
+        time(&t);
+    } else {
+        t = stat_b.st_mtime;
+    }
+    strftime(buf, S_LEN, args->date_format, localtime(&t));
+
+    *h = hash_str(*h, path);
+    *h = hash_str(*h, buf);
+    while ((rlen=read(fd, buf, CACHE_BUFLEN)) > 0){
+        *h = hash_bytes(*h, buf, rlen);
+    }
+    close(fd);
+    return (rlen == 0);
+}
+
+cache_t *cache_open(args_t *args, char **files, int nfiles){
+    hash_t h=HASH_INIT;
+    cache_t *c;
+    long hits, misses;
+    int i;
+
+    if (args->cache_dir == NULL) return NULL;
+    // followed input has no fixed contents.
+    if (args->follow) return NULL;
+
+    for (i=0; i<nfiles; i++){
+        // standard input could not be read twice.
+        if (strncmp("-", files[i], 3)==0) return NULL;
+    }
+    h = hash_args(h, args);
+    H_VAL(nfiles);
+    for (i=0; i<nfiles; i++){
+        if (!cache_hash_file(args, files[i], &h)){
+            // leave the error message to renderer
+            return NULL;
+        }
+    }
+    if ((mkdir(args->cache_dir, 0777) < 0) && (errno != EEXIST)){
+        perror(args->cache_dir);
+        return NULL;
+    }
+
+    c = malloc(sizeof(cache_t));
+    c->dir = args->cache_dir;
+    c->limit = args->cache_size*1024*1024;
+    snprintf(c->key, CACHE_KEYLEN, "%016llx", h);
+    snprintf(c->entry, S_LEN, "%s/%s.%s", c->dir, c->key, utpdf_makepdf ? "pdf" : "ps");
+    c->tmp[0] = '\0';
+    c->tmp_fd = -1;
+
+    // kept open: an eviction by another run does not remove it under us.
+    if ((c->entry_fd=open(c->entry, O_RDONLY)) >= 0){
+        // hit
+        c->hit = 1;
+    } else {
+        // miss: render into temporary file
+        c->hit = 0;
+        snprintf(c->tmp, S_LEN, "%s/%sXXXXXX", c->dir, CACHE_TMP);
+        if ((c->tmp_fd=mkstemp(c->tmp)) < 0){
+            perror(c->tmp);
+            free(c);
+            return NULL;
+        }
+    }
+    cache_account(c->dir, c->hit, &hits, &misses);
+    return c;
+}
+
+int cache_copy_fd(int from, int to){
+    char buf[CACHE_BUFLEN];
+    int rlen;
+
+    while ((rlen=read(from, buf, CACHE_BUFLEN)) > 0){
+        if (write_func((void *)&to, (unsigned char *)buf, rlen) != CAIRO_STATUS_SUCCESS){
+            return 0;
+        }
+    }
+    return (rlen == 0);
+}
+
+// hit: entry -> output. 0: failed, with the message
+int cache_copy(cache_t *c, int out_fd){
+    if (!cache_copy_fd(c->entry_fd, out_fd)){
+        char ebuf[S_LEN];
+        snprintf(ebuf, S_LEN, "Could not copy: %s\n", c->entry);
+        perror(ebuf);
+        return 0;
+    }
+    futimens(c->entry_fd, NULL); // mark as recently used
+    return 1;
+}
+
+// miss: rendered temporary file -> output & entry. 0: failed
+int cache_store(cache_t *c, int out_fd){
+    if ((lseek(c->tmp_fd, 0, SEEK_SET) < 0) || !cache_copy_fd(c->tmp_fd, out_fd)){
+        char ebuf[S_LEN];
+        snprintf(ebuf, S_LEN, "Could not copy: %s\n", c->tmp);
+        perror(ebuf);
+        return 0;
+    }
+    close(c->tmp_fd);
+    c->tmp_fd = -1;
+    if (rename(c->tmp, c->entry) < 0){
+        perror(c->entry);
+        unlink(c->tmp);
+    }
+    c->tmp[0] = '\0';
+    cache_evict(c);
+    return 1;
+}
+
+void cache_close(cache_t *c){
+    if (c == NULL) return;
+    if (c->tmp_fd >= 0){
+        close(c->tmp_fd);
+    }
+    if (c->entry_fd >= 0){
+        close(c->entry_fd);
+    }
+    if (c->tmp[0] != '\0'){
+        unlink(c->tmp);
+    }
+    free(c);
+}
+
+// count up <cache_dir>/stats, and return the totals
+void cache_account(char *dir, int hit, long *hits, long *misses){
+    char path[S_LEN], buf[S_LEN];
+    int fd, len;
+
+    *hits = *misses = 0;
+    if (hit > 0) {
+        cache_hits++;
+    } else if (hit == 0) {
+        cache_misses++;
+    }
+
+    snprintf(path, S_LEN, "%s/%s", dir, CACHE_STATS);
+    if ((fd=open(path, O_RDWR|O_CREAT, 0666)) < 0) return; // not fatal
+    flock(fd, LOCK_EX);
+    if ((len=read(fd, buf, S_LEN-1)) > 0){
+        buf[len] = '\0';
+        sscanf(buf, "hit %ld miss %ld", hits, misses);
+    }
+    if (hit > 0) {
+        (*hits)++;
+    } else if (hit == 0) {
+        (*misses)++;
+    }
+    if (hit >= 0) {
+        len = snprintf(buf, S_LEN, "hit %ld\nmiss %ld\n", *hits, *misses);
+        if ((ftruncate(fd, 0) < 0) || (pwrite(fd, buf, len, 0) != len)){
+            perror(path);
+        }
+    }
+    close(fd); // unlock
+}
+
+// list entries, and remove stale temporary files
+int cache_scan(char *dir, cache_ent_t **ents, double *total){
+    DIR *d;
+    struct dirent *de;
+    struct stat stat_b;
+    char path[S_LEN];
+    int n=0, size=16;
+    time_t now=time(NULL);
+
+    *total = 0;
+    *ents = malloc(sizeof(cache_ent_t)*size);
+    if ((d=opendir(dir)) == NULL) return 0;
+
+    while ((de=readdir(d)) != NULL){
+        size_t len=strlen(de->d_name);
+
+        snprintf(path, S_LEN, "%s/%s", dir, de->d_name);
+        if (strncmp(de->d_name, CACHE_TMP, strlen(CACHE_TMP))==0){
+            if ((stat(path, &stat_b)==0) && (now - stat_b.st_mtime > CACHE_TMP_AGE)){
+                unlink(path);
+            }
+            continue;
+        }
+        if (((len != CACHE_KEYLEN-1+4) || (strcmp(&de->d_name[len-4], ".pdf") != 0))
+            && ((len != CACHE_KEYLEN-1+3) || (strcmp(&de->d_name[len-3], ".ps") != 0))){
+            continue; // not an entry
+        }
+        if (stat(path, &stat_b) < 0) continue;
+
+        if (n >= size){
+            size *= 2;
+            *ents = realloc(*ents, sizeof(cache_ent_t)*size);
+        }
+        snprintf((*ents)[n].name, sizeof((*ents)[n].name), "%s", de->d_name);
+        (*ents)[n].used = stat_b.st_mtime;
+        (*ents)[n].size = stat_b.st_size;
+        *total += stat_b.st_size;
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+int cmp_used(const void *a, const void *b){
+    time_t ua=((cache_ent_t *)a)->used, ub=((cache_ent_t *)b)->used;
+    return (ua > ub) - (ua < ub);
+}
+
+// LRU eviction
+void cache_evict(cache_t *c){
+    cache_ent_t *ents;
+    double total;
+    char path[S_LEN];
+    int i, n=cache_scan(c->dir, &ents, &total);
+
+    if (total > c->limit){
+        qsort(ents, n, sizeof(cache_ent_t), cmp_used);
+        for (i=0; (i<n) && (total > c->limit); i++){
+            if (strncmp(ents[i].name, c->key, CACHE_KEYLEN-1)==0){
+                continue; // keep the newest one
+            }
+            snprintf(path, S_LEN, "%s/%s", c->dir, ents[i].name);
+            if (unlink(path)==0){
+                total -= ents[i].size;
+            }
+        }
+    }
+    free(ents);
+}
+
+void cache_report(args_t *args){
+    cache_ent_t *ents;
+    double total;
+    long hits, misses;
+    int n;
+
+    if (args->cache_dir == NULL) return;
+
+    cache_account(args->cache_dir, -1, &hits, &misses); // only read
+    n=cache_scan(args->cache_dir, &ents, &total);
+    free(ents);
+    fprintf(stderr, "%s: cache: %d hit, %d miss (total: %ld hit, %ld miss)\n",
+            utpdf_prog_name, cache_hits, cache_misses, hits, misses);
+    fprintf(stderr, "%s: cache: %d entries, %.1fMB / %.1fMB\n",
+            utpdf_prog_name, n, total/(1024*1024), args->cache_size);
+}
+
+// end of cache.c
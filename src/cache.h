@@ -0,0 +1,59 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "utpdf.h"
+#include "args.h"
+
+#define CACHE_SIZE    256   // default size limit of cache directory (MB)
+#define CACHE_KEYLEN  17    // 64bit hash in hex + '\0'
+#define CACHE_STATS   "stats"
+#define CACHE_TMP     "tmp-"
+#define CACHE_TMP_AGE (24*60*60) // left by crashed runs, if older than this
+#define CACHE_BUFLEN  65536
+
+typedef unsigned long long hash_t;
+#define HASH_INIT 0xcbf29ce484222325ULL // FNV-1a offset basis
+
+typedef struct output_cache {
+    char key[CACHE_KEYLEN];
+    char entry[S_LEN]; // path of cache entry
+    char tmp[S_LEN];   // path of entry under construction
+    char *dir;         // cache directory
+    double limit;      // size limit of cache directory (byte)
+    int tmp_fd;        // rendering target on miss
+    int entry_fd;      // the entry on hit, opened once against eviction
+    int hit;
+} cache_t;
+
+extern hash_t hash_bytes(hash_t h, const void *p, size_t len);
+extern hash_t hash_str(hash_t h, const char *s);
+extern hash_t hash_args(hash_t h, args_t *args);
+
+extern cache_t *cache_open(args_t *args, char **files, int nfiles);
+extern int cache_copy(cache_t *c, int out_fd);
+extern int cache_store(cache_t *c, int out_fd);
+extern void cache_close(cache_t *c);
+extern void cache_report(args_t *args);
+
+#endif
+
+// end of cache.h
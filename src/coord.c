@@ -367,36 +367,48 @@ void onecol_evenpage(args_t *args, mcoord_t *mcoord){
     mcoord->bwidth = mcoord->body_right - mcoord->body_left;
 }
 
+// geometry variant of the page: calc_page_coordinates() gives
+// the same result for the pages with the same variant.
+int page_variant(args_t *args, int page){
+    if (args->duplex && args->twocols){
+        return page%4;
+    } else if (args->duplex || args->twocols){
+        return page%2;
+    } else {
+        return 0;
+    }
+}
+
 // calcurate coordinates depend on each page
-void calc_page_coordinates(args_t *arg, int page, mcoord_t *mcoord){
+void calc_page_coordinates(args_t *args, int page, mcoord_t *mcoord){
     if (args->duplex){
         if (args->twocols){
             switch (page%4){
             case 1:
                 // odd page, left side
-                twocols_oddpage_leftside(arg, mcoord);
+                twocols_oddpage_leftside(args, mcoord);
                 break;
             case 2:
                 // odd page, right side
-                twocols_oddpage_rightside(arg, mcoord);
+                twocols_oddpage_rightside(args, mcoord);
                 break;
             case 3:
                 // even page left side
-                twocols_evenpage_leftside(arg, mcoord);
+                twocols_evenpage_leftside(args, mcoord);
                 break;
             case 0:
                 // even page right side
-                twocols_evenpage_rightside(arg, mcoord);
+                twocols_evenpage_rightside(args, mcoord);
                 break;
             } // switch (page%4)
         } else {
             // one side per page
             if (page%2){
                 // odd page
-                onecol_oddpage(arg, mcoord);
+                onecol_oddpage(args, mcoord);
             } else {
                 // even page
-                onecol_evenpage(arg, mcoord);
+                onecol_evenpage(args, mcoord);
             } // if (page %2)
             // mcoord->bwidth = mcoord->body_right - mcoord->body_left;
         } // if (args->twocols) else
@@ -404,20 +416,20 @@ void calc_page_coordinates(args_t *arg, int page, mcoord_t *mcoord){
         if (args->twocols){
 	    if (page%2){
 	        // odd page only, left side
-                twocols_oddpage_leftside(arg, mcoord);
+                twocols_oddpage_leftside(args, mcoord);
   	    } else {
                 // odd page only, right side
-                twocols_oddpage_rightside(arg, mcoord);
+                twocols_oddpage_rightside(args, mcoord);
  	    }
 	} else {
 	    // odd page only
-            onecol_oddpage(arg, mcoord);
+            onecol_oddpage(args, mcoord);
 	}
     }   
 }
 
 
-void calc_page_subcoordinates(pcobj *obj, args_t *args, mcoord_t *mcoord, scoord_t *scoord){
+void calc_page_subcoordinates(plan_t *plan, args_t *args, mcoord_t *mcoord, scoord_t *scoord){
     double bodyheight;
     
     scoord->body_inset = args->fontsize;
@@ -436,16 +448,50 @@ void calc_page_subcoordinates(pcobj *obj, args_t *args, mcoord_t *mcoord, scoord
     scoord->bottombase = scoord->body_top + scoord->oneline_h*scoord->lineperpage;
 	    
     // x-axis
-    pcobj_setfont(obj, args->fontname, args->fontsize);
-    pcobj_font_face(obj, args->bfont_slant, args->bfont_weight);
-
     if (args->numbering) {
         scoord->num_right = mcoord->body_left + scoord->body_inset
-            + pcobj_text_width(obj, "000000"); // vertical line
-        scoord->text_left = scoord->num_right + pcobj_text_width(obj, "0");
+            + plan->gutter_w; // vertical line
+        scoord->text_left = scoord->num_right + plan->digit_w;
     } else {
         scoord->text_left = mcoord->body_left + scoord->body_inset;
     }
+    scoord->limitw = mcoord->body_right - scoord->text_left - scoord->body_inset;
+
+    // fold arrows: the continue arrow is at the left of text.
+    scoord->arrow_edge = scoord->oneline_h - plan->ascent/2 + plan->descent;
+    if (args->numbering) {
+        scoord->cont_x = scoord->num_right - scoord->arrow_edge/2;
+    } else {
+        scoord->cont_x = mcoord->body_left;
+    }
+    scoord->return_x = mcoord->body_right - scoord->body_inset;
+}
+
+// measure the body font, and calcurate every page variant once.
+void plan_build(plan_t *plan, pcobj *obj, args_t *args){
+    int v;
+
+    pcobj_setfont(obj, args->fontname, args->fontsize);
+    pcobj_font_face(obj, args->bfont_slant, args->bfont_weight);
+    plan->em = pcobj_text_width(obj, "M");
+    plan->digit_w = pcobj_text_width(obj, "0");
+    plan->gutter_w = pcobj_text_width(obj, "000000");
+    plan->ascent = pcobj_font_ascent(obj);
+    plan->descent = pcobj_font_descent(obj);
+    plan->kernel = (args->fold_arrow ? LINES_ARROW : 0) | (args->numbering ? LINES_NUMBER : 0);
+
+    if (args->duplex && args->twocols){
+        plan->variants = 4;
+    } else if (args->duplex || args->twocols){
+        plan->variants = 2;
+    } else {
+        plan->variants = 1;
+    }
+    // page v has the same page%4 (page%2) as the pages of variant v.
+    for (v=0; v<plan->variants; v++){
+        calc_page_coordinates(args, v, &plan->mcoord[v]);
+        calc_page_subcoordinates(plan, args, &plan->mcoord[v], &plan->scoord[v]);
+    }
 }
 
 
@@ -25,8 +25,10 @@
 #include "pangoprint.h"
 #include "drawing.h"
 
+extern int page_variant(args_t *args, int page);
 extern void calc_page_coordinates(args_t *args, int page, mcoord_t *mcoord);
-extern void calc_page_subcoordinates(pcobj *obj, args_t *args, mcoord_t *mcoord, scoord_t *scoord);
+extern void calc_page_subcoordinates(plan_t *plan, args_t *args, mcoord_t *mcoord, scoord_t *scoord);
+extern void plan_build(plan_t *plan, pcobj *obj, args_t *args);
 
 #endif
 
@@ -24,14 +24,16 @@
 #include "utpdf.h"
 #include "args.h"
 #include "pangoprint.h"
+#include "incr.h"
+#include "shcache.h"
 
 void show_text_at_center(pcobj *obj, const char *str){
-    cairo_rel_move_to(obj->cr, -pcobj_text_width(obj, str)/2, 0);
+    pcobj_path_rel_move_to(obj, -pcobj_text_width(obj, str)/2, 0);
     pcobj_print(obj, str);
 }
 
 void show_text_at_right(pcobj *obj, const char *str){
-    cairo_rel_move_to(obj->cr, -pcobj_text_width(obj, str), 0);
+    pcobj_path_rel_move_to(obj, -pcobj_text_width(obj, str), 0);
     pcobj_print(obj, str);
 }
 
@@ -39,55 +41,55 @@ void show_text_at_left(pcobj *obj, const char *str){
     pcobj_print(obj, str);
 }
 
-void draw_rel_line(cairo_t *cr, double x, double y, double dx, double dy,
+void draw_rel_line(pcobj *obj, double x, double y, double dx, double dy,
 		   double line_w, double r, double g, double b){
-    cairo_set_source_rgb(cr, r, g, b);
-    cairo_set_line_width(cr, line_w);
-    cairo_move_to(cr, x, y);
-    cairo_rel_line_to(cr, dx, dy);
-    cairo_stroke(cr);
-    cairo_set_source_rgb(cr, C_BLACK);
+    pcobj_set_rgb(obj, r, g, b);
+    pcobj_line_width(obj, line_w);
+    pcobj_path_move_to(obj, x, y);
+    pcobj_path_rel_line_to(obj, dx, dy);
+    pcobj_stroke(obj);
+    pcobj_set_rgb(obj, C_BLACK);
 }
 
-void draw_rectangle(cairo_t *cr, double x, double y, double dx, double dy,
+void draw_rectangle(pcobj *obj, double x, double y, double dx, double dy,
                     double line_w, double r, double g, double b){
-    cairo_set_source_rgb(cr, r, g, b);
-    cairo_set_line_width(cr, line_w);
-    cairo_rectangle(cr, x, y, dx, dy);
-    cairo_stroke(cr);
-    cairo_set_source_rgb(cr, C_BLACK);
+    pcobj_set_rgb(obj, r, g, b);
+    pcobj_line_width(obj, line_w);
+    pcobj_path_rectangle(obj, x, y, dx, dy);
+    pcobj_stroke(obj);
+    pcobj_set_rgb(obj, C_BLACK);
 }
 
-void draw_mark(cairo_t *cr, enum direction d, double x, double y){
-    cairo_move_to(cr, x, y);
+void draw_mark(pcobj *obj, enum direction d, double x, double y){
+    pcobj_path_move_to(obj, x, y);
     switch(d){
     case d_up:
-	cairo_rel_move_to(cr, 0, -MARK_H/2);
-	cairo_rel_line_to(cr, -MARK_W/2, MARK_H);
-	cairo_rel_line_to(cr, MARK_W, 0);
-	cairo_close_path(cr);
-	cairo_fill(cr);
+	pcobj_path_rel_move_to(obj, 0, -MARK_H/2);
+	pcobj_path_rel_line_to(obj, -MARK_W/2, MARK_H);
+	pcobj_path_rel_line_to(obj, MARK_W, 0);
+	pcobj_path_close(obj);
+	pcobj_fill(obj);
 	break;
     case d_down:
-	cairo_rel_move_to(cr, 0, MARK_H/2);
-	cairo_rel_line_to(cr, -MARK_W/2, -MARK_H);
-	cairo_rel_line_to(cr, MARK_W, 0);
-	cairo_close_path(cr);
-	cairo_fill(cr);
+	pcobj_path_rel_move_to(obj, 0, MARK_H/2);
+	pcobj_path_rel_line_to(obj, -MARK_W/2, -MARK_H);
+	pcobj_path_rel_line_to(obj, MARK_W, 0);
+	pcobj_path_close(obj);
+	pcobj_fill(obj);
 	break;
     case d_right:
-	cairo_rel_move_to(cr, MARK_H/2, 0);
-	cairo_rel_line_to(cr, -MARK_H, -MARK_W/2);
-	cairo_rel_line_to(cr, 0, MARK_W);
-	cairo_close_path(cr);
-	cairo_fill(cr);
+	pcobj_path_rel_move_to(obj, MARK_H/2, 0);
+	pcobj_path_rel_line_to(obj, -MARK_H, -MARK_W/2);
+	pcobj_path_rel_line_to(obj, 0, MARK_W);
+	pcobj_path_close(obj);
+	pcobj_fill(obj);
 	break;
     case d_left:
-	cairo_rel_move_to(cr, -MARK_H/2, 0);
-	cairo_rel_line_to(cr, MARK_H, -MARK_W/2);
-	cairo_rel_line_to(cr, 0, MARK_W);
-	cairo_close_path(cr);
-	cairo_fill(cr);
+	pcobj_path_rel_move_to(obj, -MARK_H/2, 0);
+	pcobj_path_rel_line_to(obj, MARK_H, -MARK_W/2);
+	pcobj_path_rel_line_to(obj, 0, MARK_W);
+	pcobj_path_close(obj);
+	pcobj_fill(obj);
 	break;
     default:
 	break;
@@ -96,270 +98,416 @@ void draw_mark(cairo_t *cr, enum direction d, double x, double y){
 }
 
 
-void draw_return_arrow(cairo_t *cr, double x, double y, double edge, double width,
+void draw_return_arrow(pcobj *obj, double x, double y, double edge, double width,
 		       double r, double g, double b){
     double radius=edge/2;
 
-    cairo_save(cr);
-    cairo_translate(cr, x+radius, y+radius);
+    pcobj_save(obj);
+    pcobj_translate(obj, x+radius, y+radius);
     {
-	cairo_set_source_rgb(cr, r, g, b);
-	cairo_set_line_width(cr, width);
+	pcobj_set_rgb(obj, r, g, b);
+	pcobj_line_width(obj, width);
 
-	cairo_move_to(cr, 0, 0);
-	cairo_line_to(cr, 0, radius);
-	cairo_stroke(cr);
+	pcobj_path_move_to(obj, 0, 0);
+	pcobj_path_line_to(obj, 0, radius);
+	pcobj_stroke(obj);
 
-	cairo_move_to(cr, radius, radius-width/2);
-	cairo_line_to(cr, 0,      radius-width/2);
-	cairo_stroke(cr);
+	pcobj_path_move_to(obj, radius, radius-width/2);
+	pcobj_path_line_to(obj, 0,      radius-width/2);
+	pcobj_stroke(obj);
 	
-	cairo_arc(cr, 0, 0, radius-width/2, PI*3/2, PI/2);
-	cairo_stroke(cr);
+	pcobj_path_arc(obj, 0, 0, radius-width/2, PI*3/2, PI/2);
+	pcobj_stroke(obj);
     }
-    cairo_restore(cr);
+    pcobj_restore(obj);
 }
 
 
-void draw_cont_arrow(cairo_t *cr, double x, double y, double edge, double width,
+void draw_cont_arrow(pcobj *obj, double x, double y, double edge, double width,
 		     double r, double g, double b){
     double radius=edge/2;
 
-    cairo_save(cr);
-    cairo_translate(cr, x+radius, y+radius);
+    pcobj_save(obj);
+    pcobj_translate(obj, x+radius, y+radius);
     {
-	cairo_move_to(cr, 0, 0);
-	cairo_set_source_rgb(cr, r, g, b);
-	cairo_set_line_width(cr, width);
+	pcobj_path_move_to(obj, 0, 0);
+	pcobj_set_rgb(obj, r, g, b);
+	pcobj_line_width(obj, width);
 
-	cairo_move_to(cr, 0, 0);
-	cairo_line_to(cr, 0, radius);
-	cairo_stroke(cr);
+	pcobj_path_move_to(obj, 0, 0);
+	pcobj_path_line_to(obj, 0, radius);
+	pcobj_stroke(obj);
 
-	cairo_move_to(cr, -radius, radius-width/2);
-	cairo_line_to(cr, 0, radius-width/2);
-	cairo_stroke(cr);
+	pcobj_path_move_to(obj, -radius, radius-width/2);
+	pcobj_path_line_to(obj, 0, radius-width/2);
+	pcobj_stroke(obj);
 
-	cairo_arc(cr, 0, 0, radius-width/2, PI/2, PI*3/2); // PI/2, PI*7/4); 
-	cairo_stroke(cr);
+	pcobj_path_arc(obj, 0, 0, radius-width/2, PI/2, PI*3/2); // PI/2, PI*7/4); 
+	pcobj_stroke(obj);
     }
-    cairo_restore(cr);
+    pcobj_restore(obj);
 }
 
-#define PAGEBUFLEN 64
+// the header of a file is shaped once. Only the page number is
+// composed of the glyphs of digits on every page.
+hcache_t *header_new(pcobj *obj, args_t *args, char *datebuf){
+    hcache_t *hc=calloc(1, sizeof(hcache_t));
+    char digit[2]={'\0', '\0'};
+    int i;
 
-void draw_header(pcobj *obj, args_t *args, int page, mcoord_t *mcoord,
-                 scoord_t *scoord, char *datebuf){
-    double hbaseline, hinset, descent;
-    char pagebuf[PAGEBUFLEN];
-    cairo_t *cr=obj->cr;
-    
-    // hbaseline: the baseline of header font
+    // center part: filename
     pcobj_setfont(obj, args->headerfont, args->head_size);
     pcobj_font_face(obj, args->hfont_slant, args->hfont_weight);
-    descent=pcobj_font_descent(obj);
-    hbaseline = scoord->body_top - descent;
-
+    // hbaseline: the baseline of header font
+    hc->descent = pcobj_font_descent(obj);
     // hinset: header inset
-    cairo_set_font_size (cr, args->side_size);
-    hinset = pcobj_text_width(obj, "0");
-		
-    // draw left side: modified date
-    pcobj_setfont(obj, args->headerfont, args->side_size);
-    pcobj_weight(obj, args->side_weight);
-    pcobj_style(obj, args->side_slant);
-    pcobj_move_to(obj, mcoord->body_left+hinset, hbaseline);
-    show_text_at_left(obj, datebuf);
-  
-    // center part: filename
-    pcobj_setsize(obj, args->head_size);
-    pcobj_weight(obj, args->hfont_weight);
-    pcobj_style(obj, args->hfont_slant);
-    pcobj_move_to(obj, mcoord->body_left+mcoord->bwidth/2, hbaseline);
-
+    hc->hinset = pcobj_text_width(obj, "0");
+    hc->head_ascent = pcobj_font_ascent(obj);
     if (args->headertext == NULL) {
-	show_text_at_center(obj, args->in_fname);
+        hc->title = pcobj_shape(obj, args->in_fname, -1);
     } else {
-	show_text_at_center(obj, args->headertext);
+        hc->title = pcobj_shape(obj, args->headertext, -1);
     }
-    // right side: page
-    snprintf(pagebuf, PAGEBUFLEN, "page: %d  ", page);
-    pcobj_setsize(obj, args->side_size);
+
+    // left side: modified date, right side: page
+    pcobj_setfont(obj, args->headerfont, args->side_size);
     pcobj_weight(obj, args->side_weight);
     pcobj_style(obj, args->side_slant);
-    pcobj_move_to(obj, mcoord->body_left + mcoord->bwidth - hinset, hbaseline);
-    show_text_at_right(obj, pagebuf);
+    hc->side_ascent = pcobj_font_ascent(obj);
+    hc->date = pcobj_shape(obj, datebuf, -1);
+    hc->label = pcobj_shape(obj, "page: ", -1);
+    hc->tail = pcobj_text_width(obj, "  ");
+    for (i=0; i<10; i++){
+        digit[0] = '0'+i;
+        hc->digit[i] = pcobj_shape(obj, digit, -1);
+    }
 
     // settle font face default
     pcobj_font_face(obj, PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL);
+    return hc;
 }
 
+void header_free(hcache_t *hc){
+    int i;
+
+    pcglyphs_free(hc->title);
+    pcglyphs_free(hc->date);
+    pcglyphs_free(hc->label);
+    for (i=0; i<10; i++){
+        pcglyphs_free(hc->digit[i]);
+    }
+    free(hc);
+}
 
-void draw_limited_text(pcobj *obj, UFILE *in_f, int tab, const double limit,
-                       int *cont, double orig_left, double baseline){
-    int clen, olen;
-    double em, tabw; // width of "M", tab
+#define PAGEBUFLEN 64
+
+// glyphs are placed by the top of line, as pcobj_move_to().
+void draw_header(pcobj *obj, hcache_t *hc, int page, mcoord_t *mcoord,
+                 scoord_t *scoord){
+    double hbaseline=scoord->body_top - hc->descent;
+    double x, width;
+    char pagebuf[PAGEBUFLEN];
+    int i, len;
+
+    // draw left side: modified date
+    pcobj_path_move_to(obj, mcoord->body_left+hc->hinset, hbaseline-hc->side_ascent);
+    pcobj_show_glyphs(obj, hc->date);
+
+    // center part: filename
+    pcobj_path_move_to(obj, mcoord->body_left+(mcoord->bwidth-hc->title->width)/2,
+                       hbaseline-hc->head_ascent);
+    pcobj_show_glyphs(obj, hc->title);
+
+    // right side: "page: %d  "
+    len = snprintf(pagebuf, PAGEBUFLEN, "%d", page);
+    width = hc->label->width + hc->tail;
+    for (i=0; i<len; i++){
+        width += hc->digit[pagebuf[i]-'0']->width;
+    }
+    x = mcoord->body_left + mcoord->bwidth - hc->hinset - width;
+    pcobj_path_move_to(obj, x, hbaseline-hc->side_ascent);
+    pcobj_show_glyphs(obj, hc->label);
+    x += hc->label->width;
+    for (i=0; i<len; i++){
+        pcobj_path_move_to(obj, x, hbaseline-hc->side_ascent);
+        pcobj_show_glyphs(obj, hc->digit[pagebuf[i]-'0']);
+        x += hc->digit[pagebuf[i]-'0']->width;
+    }
+}
+
+
+// a segment is shown at once, and kept in the shape cache.
+// a long line (e.g. minified JSON) is shaped in windows of about two
+// rows, so that the cost of a row does not depend on the line length.
+#define SEGLEN (BUFLEN-UC_LEN)
+
+
+void draw_limited_text(job_t *job, pcobj *obj, UFILE *in_f, const double limit,
+                       double orig_left, double baseline){
+    plan_t *plan=&job->plan;
+    double em=plan->em, top=baseline-plan->ascent;
+    double tabw; // width of tab
     double cur_left=orig_left, limit_x;
-    static char outbuf[BUFLEN], rbuf[UC_LEN];
-    static int over_sp=0;
-    
-    // outbuf=""
-    outbuf[0] = '\0';
-    olen = 0;
+    int done=0; // bytes shown in this row
 
-    // cairo_get_current_point (cr, &cur_left, &cur_base);
     limit_x = limit + orig_left;
 
-    em=pcobj_text_width(obj, "M");
-    tabw=em*tab;
-    cur_left+=em*over_sp;
-    over_sp=0;
-    pcobj_move_to(obj, cur_left, baseline);
-    
-    while((cur_left+pcobj_text_width(obj, outbuf)<limit_x)
-          && (get_one_uchar(in_f, rbuf)>0)
-          && (rbuf[0] != 0x0D) && (rbuf[0] != 0x0A)){
-	if (rbuf[0] == '\t') {
-            // tab
-	    double cur_right = cur_left+pcobj_text_width(obj, outbuf);
-	    double new_right = tabw*(floor((cur_right-orig_left)/tabw)+1)+orig_left;
-            // double new_right = tabw*ceil((cur_right+em-orig_left)/tabw)+orig_left;
-	    if (new_right < limit_x) {
-		// tab jump
-		pcobj_print(obj, outbuf);
-		cur_left = new_right;
-		pcobj_move_to(obj, cur_left, baseline);
-		outbuf[0] = '\0';
-		olen = 0;
-	    } else {
-		// tab jump -> overflow
-		over_sp = ceil((new_right-limit_x)/em); // over_sp is static.
-		*cont=1;
-		pcobj_print(obj, outbuf);
-		return;
-	    }
-	} else if (rbuf[0] == 0x0D){
-	    // Is end of line is "CR" or "CRLF"?
-	    char nextbuf[UC_LEN];
-            int clen = get_one_uchar(in_f, nextbuf);
-            *cont = 0;
-            if ((clen == 0)||(nextbuf[0]==0x0A)) {
-                break;
-            } else {
-                // rewind_u(in_f, clen);
-                push_u(in_f, nextbuf);
+    tabw=em*job->args->tab;
+    cur_left+=em*job->over_sp;
+    job->over_sp=0;
+
+    while (1) {
+        int avail, full, cut, i, windowed=0;
+        char *seg, term=0;
+        shent_t *e;
+
+        avail = fill_u(in_f, SEGLEN);
+        seg = in_f->queue + in_f->qindex;
+        // segment: until end of line. tabs are in the glyph run.
+        cut = (avail < SEGLEN) ? avail : SEGLEN;
+        for (full=0; full<cut; full++){
+            if ((seg[full] == 0x0D) || (seg[full] == 0x0A)){
+                term = seg[full];
                 break;
             }
-        } else if (rbuf[0] == 0x0A){
-            *cont = 0;
-            break;
-	} else {	
-	    // outbuf += cur.firstchar();
-	    // cur.step_one_char();
-	    // Remark: On UTF-8, 1char is 1-6bytes(variable length)
-	    int i;
-	    clen = nbytechar(rbuf[0]);
-	    for (i=0; i<clen; i++) {
-	    	outbuf[olen++] = rbuf[i];
-	    }
-	    outbuf[olen]='\0';
-	}
-    } // while
-    
-    if (cur_left+pcobj_text_width(obj, outbuf)>limit_x){
-	// overflow
-	*cont = 1;
-	// push back 1char.
-	// rewind_u(in_f, clen);
-        push_u(in_f, &outbuf[olen-clen]);
-	// remove 1char from outbuf, and print it
-	outbuf[olen-clen] = '\0';
-	pcobj_print(obj, outbuf);
-	return; 
-    } else {
-	// finish this line
-	pcobj_print(obj, outbuf);
-	*cont = 0;
-	return;
-    }    
+        }
+        if (term == 0){
+            if ((job->row_bytes > 0) && (full > 2*job->row_bytes+UC_LEN)){
+                full = 2*job->row_bytes+UC_LEN;
+                windowed = 1;
+            }
+            // cut off the incomplete character
+            for (i=full-1; (i > 0) && (i >= full-UC_LEN) && ((seg[i] & 0xC0) == 0x80); i--);
+            if ((i >= 0) && (full > 0) && (i+nbytechar(seg[i]) > full)) full = i;
+        }
+
+        if (full > 0){
+            pcobj_set_shaping(obj, in_f->cls); // of the last read
+            e = shcache_fold(job->shape_cache, obj, seg, full, cur_left-orig_left,
+                             limit_x-cur_left);
+            pcobj_path_move_to(obj, cur_left, top);
+            if ((e->fold == 0) && (done == 0) && (seg[0] != '\t')){
+                // a character wider than the column is shown anyway.
+                pcglyphs_t *g=pcobj_shape_at(obj, seg, nbytechar(seg[0]),
+                                             cur_left-orig_left);
+
+                pcobj_show_glyphs(obj, g);
+                skip_u(in_f, g->len);
+                done += g->len;
+                cur_left += g->width;
+                pcglyphs_free(g);
+                continue;
+            }
+            pcobj_show_glyphs(obj, e->glyphs);
+            skip_u(in_f, e->fold);
+            done += e->fold;
+            if (e->fold < full){
+                if (term == 0) job->row_bytes = done;
+                // overflow
+                if (seg[e->fold] == '\t'){
+                    // tab jump -> overflow
+                    double cur_right = cur_left + e->glyphs->width;
+                    double new_right = tabw*(floor((cur_right-orig_left)/tabw)+1)+orig_left;
+                    job->over_sp = ceil((new_right-limit_x)/em);
+                    skip_u(in_f, 1);
+                }
+                job->cont = 1;
+                return;
+            }
+            cur_left += e->glyphs->width;
+        }
+
+        if (term == 0){
+            if (!windowed && in_f->eof && (avail < SEGLEN)){
+                // end of file, and skip the incomplete character
+                skip_u(in_f, avail-full);
+                job->cont = 0;
+                return;
+            }
+            continue; // long line
+        }
+
+        skip_u(in_f, 1);
+        if (term == 0x0D){
+            // Is end of line is "CR" or "CRLF"?
+            if ((fill_u(in_f, 1) > 0) && (in_f->queue[in_f->qindex] == 0x0A)){
+                skip_u(in_f, 1);
+            }
+        }
+        job->cont = 0;
+        return;
+    }
 }
 
 
-void draw_lines(pcobj *obj, UFILE *in_f, args_t *args, int lineperpage,
-		int *fline, mcoord_t *mcoord, scoord_t *scoord){
-    int pline=1; 	// line number of this page
-    double limitw, baseline;
-    cairo_t *cr=obj->cr;
-    // read buffer stuff
-    static int cont=0;
-    
-    // cairo_select_font_face (cr, args->fontname, CAIRO_FONT_SLANT_NORMAL,
-    // 			    CAIRO_FONT_WEIGHT_NORMAL);
-    // cairo_set_font_size (cr, args->fontsize);
+// glyphs of line numbers in the body font, shaped once per file.
+gutter_t *gutter_new(pcobj *obj, args_t *args){
+    gutter_t *gt=calloc(1, sizeof(gutter_t));
+    pcglyphs_t *parts[GUTTER_WIDTH];
+    char digit[2]={' ', '\0'};
+    int i;
+
     pcobj_setfont(obj, args->fontname, args->fontsize);
     pcobj_font_face(obj, args->bfont_slant, args->bfont_weight);
+    gt->digit[GUTTER_SPACE] = pcobj_shape(obj, digit, -1);
+    for (i=0; i<10; i++){
+        digit[0] = '0'+i;
+        gt->digit[i] = pcobj_shape(obj, digit, -1);
+    }
+    // a glyph of the same font for every digit: the glyphs of a number
+    // are rewritten in place, without a new run for every line.
+    for (i=0; i<=GUTTER_SPACE; i++){
+        pcglyphs_t *d=gt->digit[i];
+
+        if ((d->nruns != 1) || (d->runs[0].glyphs->num_glyphs != 1)
+            || (d->runs[0].item->analysis.font != gt->digit[0]->runs[0].item->analysis.font)){
+            return gt;
+        }
+    }
+    for (i=0; i<GUTTER_WIDTH; i++){
+        parts[i] = gt->digit[GUTTER_SPACE];
+    }
+    gt->line = pcglyphs_concat(parts, GUTTER_WIDTH);
+    if (gt->line->nruns != 1){
+        pcglyphs_free(gt->line);
+        gt->line = NULL;
+    }
+    return gt;
+}
+
+void gutter_free(gutter_t *gt){
+    int i;
+
+    for (i=0; i<=GUTTER_SPACE; i++){
+        pcglyphs_free(gt->digit[i]);
+    }
+    if (gt->line != NULL) pcglyphs_free(gt->line);
+    free(gt);
+}
+
+// "%5d" at (x, top of line) as one run of the cached digits
+void draw_line_number(pcobj *obj, gutter_t *gt, int num, double x, double top){
+    pcglyphs_t *g=gt->line;
+    int i;
+
+    if ((g != NULL) && (num >= 0) && (num < GUTTER_MAX)){
+        // the digits of this number in place of the last one
+        PangoGlyphString *gs=g->runs[0].glyphs;
+
+        g->width = 0;
+        for (i=GUTTER_WIDTH-1; i>=0; i--){
+            pcglyphs_t *d=gt->digit[((num == 0) && (i < GUTTER_WIDTH-1)) ? GUTTER_SPACE : num%10];
+
+            g->text[i] = d->text[0];
+            gs->glyphs[i] = d->runs[0].glyphs->glyphs[0];
+            g->width += d->width;
+            num /= 10;
+        }
+    } else {
+        char nbuf[S_LEN];
+        pcglyphs_t *parts[S_LEN];
+        int len=snprintf(nbuf, S_LEN, "%5d", num);
+
+        for (i=0; i<len; i++){
+            parts[i] = gt->digit[(nbuf[i] == ' ') ? GUTTER_SPACE : nbuf[i]-'0'];
+        }
+        g = pcglyphs_concat(parts, len);
+    }
+    pcobj_path_move_to(obj, x, top);
+    pcobj_show_glyphs(obj, g);
+    if (g != gt->line) pcglyphs_free(g);
+}
 
-    while ((!eof_u(in_f)) && (pline <= lineperpage)) {
+
+/*
+  the loop of body lines, specialized by the options once per job
+  (plan->kernel). arrow and number are constants in every variant,
+  so the compiler removes the branches from the loop.
+  returns the number of line numbers to be drawn.
+*/
+static inline __attribute__((always_inline))
+int lines_kernel(job_t *job, pcobj *obj, UFILE *in_f, int lineperpage,
+                 int *fline, scoord_t *scoord,
+                 int *nums, double *numbase, const int arrow, const int number){
+    plan_t *plan=&job->plan;
+    int pline, nnums=0;
+    double baseline;
+
+    for (pline=1; (pline <= lineperpage) && !eof_u(in_f); pline++){
 	baseline = scoord->body_top+scoord->oneline_h*pline;
-	if ((args->notebook)&&(pline<lineperpage)) {
-	    // draw thin baseline
-	    draw_rel_line(cr, mcoord->body_left, baseline, 
-			  mcoord->bwidth, 0, 0.1, C_BASEL);
-	}
-
-        cairo_move_to(cr, mcoord->body_left, baseline);
-        if (cont && args->fold_arrow) {
-            // draw continue arrow
-            double r = scoord->oneline_h - pcobj_font_ascent(obj)/2
-                       + pcobj_font_descent(obj);
-            if (args->numbering) {
-                draw_cont_arrow
-                    (cr, scoord->num_right-r/2, baseline-scoord->oneline_h, r,
-                     ARROW_WIDTH, C_ARROW);
-            } else {
-                draw_cont_arrow
-                    (cr, mcoord->body_left, baseline-scoord->oneline_h, r,
-                     ARROW_WIDTH, C_ARROW);
-            }
-        } else {				
-            if (args->numbering) {
-                char nbuf[S_LEN];
-                // draw line number
-                snprintf(nbuf, S_LEN, "%5d", *fline);
-                cairo_set_source_rgb(cr, C_NUMBER);                
-                pcobj_move_to(obj, mcoord->body_left+scoord->body_inset, baseline);
-                pcobj_print(obj, nbuf);
-                *fline=*fline+1;
-            }
+
+        if (arrow && job->cont) {
+            draw_cont_arrow(obj, scoord->cont_x, baseline-scoord->oneline_h,
+                            scoord->arrow_edge, ARROW_WIDTH, C_ARROW);
+        } else if (number) {
+            // line number: drawn after the lines
+            nums[nnums] = *fline;
+            numbase[nnums++] = baseline;
+            *fline=*fline+1;
         }
-        limitw = mcoord->body_right - scoord->text_left - scoord->body_inset;
-        cairo_set_source_rgb(cr, C_BLACK);
-        // pcobj_move_to(obj, scoord->text_left, baseline);
 
         // folding & draw text
-        draw_limited_text(obj, in_f, args->tab, limitw, &cont, scoord->text_left, baseline);
-        //
-			    
-        if (cont && args->fold_arrow) {
-            draw_return_arrow
-                (cr, mcoord->body_right-scoord->body_inset, baseline-pcobj_font_ascent(obj)/2,
-                 scoord->oneline_h-pcobj_font_ascent(obj)/2+pcobj_font_descent(obj),
-                 ARROW_WIDTH, C_ARROW);
+        draw_limited_text(job, obj, in_f, scoord->limitw, scoord->text_left, baseline);
+
+        if (arrow && job->cont) {
+            draw_return_arrow(obj, scoord->return_x, baseline-plan->ascent/2,
+                              scoord->arrow_edge, ARROW_WIDTH, C_ARROW);
         }
+    }
+    return nnums;
+}
 
-	pline++;
-    } // while ((!feof(in_f)) && (pline <= lineperpage))
+#define LINES_KERNEL(name, arrow, number)                                       \
+    static int name(job_t *job, pcobj *obj, UFILE *in_f, int lpp,               \
+                    int *fline, scoord_t *scoord,                               \
+                    int *nums, double *numbase){                                \
+        return lines_kernel(job, obj, in_f, lpp, fline, scoord,                 \
+                            nums, numbase, arrow, number);                      \
+    }
+
+LINES_KERNEL(lines_plain, 0, 0)
+LINES_KERNEL(lines_arrow, 1, 0)
+LINES_KERNEL(lines_number, 0, 1)
+LINES_KERNEL(lines_arrow_number, 1, 1)
+
+// indexed by LINES_ARROW | LINES_NUMBER
+static int (*const lines_kernels[4])(job_t *, pcobj *, UFILE *, int, int *,
+                                     scoord_t *, int *, double *)={
+    lines_plain, lines_arrow, lines_number, lines_arrow_number
+};
+
+void draw_lines(job_t *job, pcobj *obj, UFILE *in_f, gutter_t *gutter,
+                int lineperpage, int *fline, mcoord_t *mcoord, scoord_t *scoord){
+    args_t *args=job->args;
+    plan_t *plan=&job->plan;
+    int i, nnums, *nums=malloc(sizeof(int)*(lineperpage+1));
+    double *numbase=malloc(sizeof(double)*(lineperpage+1));
+    
+    // cairo_select_font_face (cr, args->fontname, CAIRO_FONT_SLANT_NORMAL,
+    // 			    CAIRO_FONT_WEIGHT_NORMAL);
+    // cairo_set_font_size (cr, args->fontsize);
+    pcobj_setfont(obj, args->fontname, args->fontsize);
+    pcobj_font_face(obj, args->bfont_slant, args->bfont_weight);
+    pcobj_set_tabs(obj, args->tab);
+    pcobj_set_rgb(obj, C_BLACK);
+
+    nnums = lines_kernels[plan->kernel](job, obj, in_f, lineperpage, fline,
+                                         scoord, nums, numbase);
     // finish body lines
-		
-    if (args->notebook) {
-	int i;
-	for (i=pline; i < lineperpage; i++){
-	    baseline = scoord->body_top+scoord->oneline_h*i;
-	    // thin baseline
-	    draw_rel_line(cr, mcoord->body_left, baseline, 
-			  mcoord->bwidth, 0, LW_THIN_BASELINE, C_BASEL);
-	}
+    // (the thin baselines of notebook are in draw_decoration())
+    pcobj_set_shaping(obj, ic_complex); // header and others
+
+    // line numbers of the page at once
+    if (nnums > 0){
+        pcobj_set_rgb(obj, C_NUMBER);
+        for (i=0; i<nnums; i++){
+            draw_line_number(obj, gutter, nums[i], mcoord->body_left+scoord->body_inset,
+                             numbase[i]-plan->ascent);
+        }
+        pcobj_set_rgb(obj, C_BLACK);
     }
+    free(nums);
+    free(numbase);
 
     // settle font face default
     pcobj_font_face(obj, PANGO_STYLE_NORMAL, PANGO_WEIGHT_NORMAL);
@@ -367,138 +515,226 @@ void draw_lines(pcobj *obj, UFILE *in_f, args_t *args, int lineperpage,
 } // end of draw_lines()
 
 
-void draw_file(pcobj *obj, UFILE *in_f, args_t *args, int last_file){
+// decorations which are the same on every page of the variant:
+// punchmark, border, and the ruled lines of notebook.
+void draw_decoration(pcobj *obj, args_t *args, mcoord_t *mcoord, scoord_t *scoord){
+    int i;
+
+    // draw punchmark
+    if (args->punchmark){
+        switch (mcoord->markdir){
+        case d_none:
+            break;
+        case d_up:
+            draw_mark(obj, d_up, args->pwidth/2, mcoord->head_top/2);
+            break;
+        case d_down:
+            draw_mark(obj, d_down, args->pwidth/2, args->pheight - mcoord->mbottom/2);
+            break;
+        case d_left:
+            draw_mark(obj, d_left, mcoord->body_left/2, args->pheight/2);
+            break;
+        case d_right:
+            draw_mark(obj, d_right, args->pwidth-mcoord->mright/2, args->pheight/2);
+            break;
+        }
+    }
+    // draw border
+    if (args->border){
+        draw_rectangle(obj, mcoord->body_left, mcoord->head_top, mcoord->bwidth,
+                       args->pheight - mcoord->mbottom - mcoord->head_top,
+                       LW_BORDER, C_BORDER);
+        if (args->header){
+            draw_rel_line(obj, mcoord->body_left, scoord->body_top,
+                          mcoord->bwidth, 0, LW_BORDER, C_BORDER);
+        }
+    }
+    if (!args->notebook){
+        return;
+    }
+    if (args->header){
+        // header base line
+        if (args->numbering) {
+            // virtical line
+            draw_rel_line(obj, scoord->num_right, scoord->body_top, 
+                          0, scoord->bottombase - scoord->body_top+LW_THICK_BASELINE,
+                          LW_VLINE, C_NUMVL);
+        }
+#if DEBUG_HOLDING
+        draw_rel_line(obj, mcoord->body_left + scoord->body_inset,
+                      scoord->body_top, 0, scoord->bottombase - scoord->body_top,
+                      LW_VLINE, C_GREEN);
+        draw_rel_line(obj, mcoord->body_right - scoord->body_inset,
+                      scoord->body_top, 0, scoord->bottombase - scoord->body_top,
+                      LW_VLINE, C_GREEN);
+#endif
+        // top line
+        draw_rel_line(obj, mcoord->body_left, mcoord->head_top, mcoord->bwidth, 0,
+                      LW_THICK_BASELINE, C_BASEL);
+        draw_rel_line(obj, mcoord->body_left, scoord->body_top, mcoord->bwidth, 0,
+                      LW_THICK_BASELINE, C_BASEL);
+    } else {
+        // no header
+        // top line
+        draw_rel_line(obj, mcoord->body_left, mcoord->head_top, mcoord->bwidth, 0,
+                      1, C_BASEL);
+        if (args->numbering) {
+            // vertical line
+            draw_rel_line(obj, scoord->num_right, mcoord->head_top,
+                          0, scoord->bottombase - mcoord->head_top+LW_THICK_BASELINE,
+                          LW_VLINE, C_NUMVL);
+        }
+    }
+    // thin baselines of every line, but the last one
+    for (i=1; i < scoord->lineperpage; i++){
+        draw_rel_line(obj, mcoord->body_left, scoord->body_top+scoord->oneline_h*i,
+                      mcoord->bwidth, 0, LW_THIN_BASELINE, C_BASEL);
+    }
+    // footer line
+    draw_rel_line(obj, mcoord->body_left, scoord->bottombase+1,
+                  mcoord->bwidth, 0, 1, C_BASEL);
+}
+
+
+job_t *job_new(args_t *args){
+    job_t *job=calloc(1, sizeof(job_t));
+
+    job->args = args;
+    job->page = 1;
+    job->shape_cache = shcache_new(args->shape_cache);
+    return job;
+}
+
+void job_free(job_t *job){
+    shcache_free(job->shape_cache);
+    free(job);
+}
+
+void draw_file(job_t *job, pcobj *obj, UFILE *in_f, int last_file, incr_t *incr){
+    args_t *args=job->args;
+    plan_t *plan=&job->plan;
     // header
     char datebuf[S_LEN];
-    struct tm *modt;
+    struct tm *modt, modt_store;
     // numbering
-    static int page=1;
     int file_page=1, file_line=1;
-    cairo_t *cr=obj->cr;
-    mcoord_t mc_store, *mcoord=&mc_store;
-    scoord_t sc_store, *scoord=&sc_store;
+    mcoord_t *mcoord;
+    scoord_t *scoord;
+    int variant;
+    hcache_t *hc=NULL;
+    gutter_t *gt=NULL;
         
     // pcobj *obj=pcobj_new(cr);
     
-    modt = localtime(args->mtime);
+    // a file starts with a new line.
+    job->cont = 0;
+    job->over_sp = 0;
+
+    modt = localtime_r(args->mtime, &modt_store);
     strftime(datebuf, S_LEN, args->date_format, modt);
+    if (args->header){
+        hc = header_new(obj, args, datebuf);
+    }
+    if (args->numbering){
+        gt = gutter_new(obj, args);
+    }
+    if (!in_f->follow){
+        // fallback fonts of the characters in the sample
+        unsigned int cps[SAMPLE_CHARS];
+        int n=sample_u(in_f, cps, SAMPLE_CHARS);
+
+        pcobj_setfont(obj, args->fontname, args->fontsize);
+        pcobj_font_face(obj, args->bfont_slant, args->bfont_weight);
+        pcobj_cover_warm(obj, cps, n);
+    }
 
     if (args->rotate_right){
         pcobj_turn_right(obj);
     }
+    if (!job->planned){
+        plan_build(plan, obj, args);
+        job->planned = 1;
+    }
+    if ((incr != NULL) && (incr->resume > 0)){
+        // the sheets before were copied from the previous output:
+        // start at the state on the top of the first changed page.
+        pagefp_t *p=&incr->old.pages[incr->resume];
+        int i;
+
+        if (!seek_u(in_f, p->start)){
+            perror(in_f->fname); // in_f->error: the caller fails
+        }
+        job->cont = p->cont;
+        job->over_sp = p->over_sp;
+        job->row_bytes = p->row_bytes;
+        file_line = p->line;
+        file_page += incr->resume;
+        job->page += incr->resume;
+        for (i=0; args->upside_down_page && (i < incr->resume/incr->per_sheet); i++){
+            pcobj_upside_down(obj);
+        }
+    }
     // draw each page
     do {
-        // calc. every coordinate, which moved per pages.
-        calc_page_coordinates(args, page, mcoord);
-        calc_page_subcoordinates(obj, args, mcoord, scoord);
-        // draw punchmark
-	if (args->punchmark){
-	    switch (mcoord->markdir){
-	    case d_none:
-		break;
-	    case d_up:
-		draw_mark(cr, d_up, args->pwidth/2, mcoord->head_top/2);
-		break;
-	    case d_down:
-		draw_mark(cr, d_down, args->pwidth/2, args->pheight - mcoord->mbottom/2);
-		break;
-	    case d_left:
-		draw_mark(cr, d_left, mcoord->body_left/2, args->pheight/2);
-		break;
-	    case d_right:
-		draw_mark(cr, d_right, args->pwidth-mcoord->mright/2, args->pheight/2);
-		break;
-	    }
-        }
-        // draw watermark
+        // obj->cr is renewed every page in streaming.
+        pcobj_begin_page(obj);
+        // page fingerprint for incremental mode
+        incr_page(incr, in_f->pos, job->cont, job->over_sp, job->row_bytes,
+                  page_variant(args, job->page), file_line);
+        // every coordinate, which moved per pages.
+        variant = page_variant(args, job->page);
+        mcoord = &plan->mcoord[variant];
+        scoord = &plan->scoord[variant];
+        // draw watermark: fitted once per variant
         if (args->wmark_text != NULL){
-            pcobj_draw_watermark(obj, args->wmark_text, args->wmark_font,
-                                 mcoord->body_left, mcoord->head_top, mcoord->bwidth,
-                                 args->pheight - mcoord->mbottom - mcoord->head_top,
-                                 args->wmark_weight, args->wmark_slant,
-                                 args->wmark_r, args->wmark_g, args->wmark_b);
+            if (!pcobj_has_form(obj, FORM_WATERMARK+variant)){
+                pcobj_form_begin(obj);
+                pcobj_draw_watermark(obj, args->wmark_text, args->wmark_font,
+                                     mcoord->body_left, mcoord->head_top, mcoord->bwidth,
+                                     args->pheight - mcoord->mbottom - mcoord->head_top,
+                                     args->wmark_weight, args->wmark_slant,
+                                     args->wmark_r, args->wmark_g, args->wmark_b);
+                pcobj_form_end(obj, FORM_WATERMARK+variant);
+            }
+            pcobj_paint_form(obj, FORM_WATERMARK+variant);
         }
-        cairo_set_source_rgb(obj->cr, C_BLACK);
-        
-        // draw border
-        if (args->border){
-            draw_rectangle(cr, mcoord->body_left, mcoord->head_top, mcoord->bwidth,
-                           args->pheight - mcoord->mbottom - mcoord->head_top,
-                           LW_BORDER, C_BORDER);
-            if (args->header){
-                draw_rel_line(cr, mcoord->body_left, scoord->body_top,
-                              mcoord->bwidth, 0, LW_BORDER, C_BORDER);
+        pcobj_set_rgb(obj, C_BLACK);
+
+        // punchmark, border and ruled lines: recorded once per variant
+        if (args->punchmark || args->border || args->notebook){
+            if (!pcobj_has_form(obj, FORM_DECORATION+variant)){
+                pcobj_form_begin(obj);
+                draw_decoration(obj, args, mcoord, scoord);
+                pcobj_form_end(obj, FORM_DECORATION+variant);
             }
+            pcobj_paint_form(obj, FORM_DECORATION+variant);
         }
         // draw header
         if (args->header){
             //
-            draw_header(obj, args, file_page, mcoord, scoord, datebuf);
+            draw_header(obj, hc, file_page, mcoord, scoord);
             //
-            // header base line
-            if (args->notebook){
-                if (args->numbering) {
-                    // virtical line
-                    draw_rel_line(cr, scoord->num_right, scoord->body_top, 
-                                  0, scoord->bottombase - scoord->body_top+LW_THICK_BASELINE,
-                                  LW_VLINE, C_NUMVL);
-                }
-#if DEBUG_HOLDING
-                draw_rel_line(cr, mcoord->body_left + scoord->body_inset,
-                              scoord->body_top, 0, scoord->bottombase - scoord->body_top,
-                              LW_VLINE, C_GREEN);
-                draw_rel_line(cr, mcoord->body_right - scoord->body_inset,
-                              scoord->body_top, 0, scoord->bottombase - scoord->body_top,
-                              LW_VLINE, C_GREEN);
-#endif
-                // top line
-                draw_rel_line(cr, mcoord->body_left, mcoord->head_top, mcoord->bwidth, 0,
-                              LW_THICK_BASELINE, C_BASEL);
-                draw_rel_line(cr, mcoord->body_left, scoord->body_top, mcoord->bwidth, 0,
-                              LW_THICK_BASELINE, C_BASEL);
-                cairo_set_source_rgb(cr, C_BLACK);
-            }
-        } else {
-            // no header
-            if (args->notebook) {
-                // top line
-                draw_rel_line(cr, mcoord->body_left, mcoord->head_top, mcoord->bwidth, 0,
-                              1, C_BASEL);
-                cairo_set_source_rgb(cr, C_BLACK);
-                if (args->numbering) {
-                    // vertical line
-                    draw_rel_line(cr, scoord->num_right, mcoord->head_top,
-                                  0, scoord->bottombase - mcoord->head_top+LW_THICK_BASELINE,
-                                  LW_VLINE, C_NUMVL);
-                }
-            }
-        } // if (args->header)
+        }
 
-        page++;
+        job->page++;
         file_page++;
         
         // draw body
-        draw_lines(obj, in_f, args, scoord->lineperpage, &file_line,
+        draw_lines(job, obj, in_f, gt, scoord->lineperpage, &file_line,
                    mcoord, scoord);
         //
-	
-        if (args->notebook){
-            // footer line
-            draw_rel_line(cr, mcoord->body_left, scoord->bottombase+1,
-                          mcoord->bwidth, 0, 1, C_BASEL);
-        }
 
         if (!args->twocols){
             // one column
             if (!(eof_u(in_f))){
-                cairo_show_page(cr); // new page
+                pcobj_show_page(obj); // new page
                 if (args->upside_down_page) {
                     pcobj_upside_down(obj);
                 }
             }
-        } else if ((page % 2 != 0)){
+        } else if ((job->page % 2 != 0)){
             // ((two column) and next page is odd page)
-            cairo_show_page(cr); // new pagea
+            pcobj_show_page(obj); // new pagea
             if (args->upside_down_page) {
                 pcobj_upside_down(obj);
             }
@@ -510,12 +746,18 @@ void draw_file(pcobj *obj, UFILE *in_f, args_t *args, int last_file){
     if (!args->twocols){
         // one column
         if (args->one_output && !last_file){
-            cairo_show_page(cr); // new page
+            pcobj_show_page(obj); // new page
             if (args->upside_down_page) {
                 pcobj_upside_down(obj);
             }
         }
     }
+    if (hc != NULL){
+        header_free(hc);
+    }
+    if (gt != NULL){
+        gutter_free(gt);
+    }
 }   
 
 
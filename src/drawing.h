@@ -25,29 +25,83 @@
 #include "args.h"
 #include "coord.h"
 #include "pangoprint.h"
+#include "incr.h"
+#include "shcache.h"
+
+// a job: one output from the input files. Rendering keeps no other
+// state, so that jobs may run in threads at the same time.
+typedef struct job {
+    args_t *args;
+    plan_t plan;          // geometry, built at the first file
+    int planned;
+    int page;             // page number through the files
+    // folding state carried over to the next row
+    int cont;             // this row continues the folded line
+    int over_sp;          // spaces of the tab which was overflowed
+    int row_bytes;        // bytes of the last full row of a long line
+    shcache_t *shape_cache;
+    ustats_t input;       // --stats: classification of input
+    pdfw_stats_t output;  // --stats: page content of the native writers
+} job_t;
+
+// slots of forms (pcobj_form_begin())
+#define FORM_DECORATION 0 // + page variant
+#define FORM_WATERMARK  4 // + page variant
+
+// header of a file, shaped once
+typedef struct header_cache {
+    pcglyphs_t *title, *date, *label, *digit[10];
+    double tail;          // width of the spaces after page number
+    double head_ascent, side_ascent, descent, hinset;
+} hcache_t;
+
+// glyphs of line numbers, shaped once per file
+#define GUTTER_SPACE 10
+#define GUTTER_WIDTH 5       // "%5d"
+#define GUTTER_MAX   100000  // numbers of GUTTER_WIDTH digits
+typedef struct gutter {
+    pcglyphs_t *digit[GUTTER_SPACE+1]; // '0'-'9', and ' '
+    pcglyphs_t *line;  // a number, rewritten for every line (NULL: joined every time)
+} gutter_t;
 
 extern void show_text_at_center(pcobj *obj, const char *str);
 extern void show_text_at_right(pcobj *obj, const char *str);
 extern void show_text_at_left(pcobj *obj, const char *str);
 extern void draw_rel_line
-    (cairo_t *cr, double x, double y, double dx, double dy, double line_w,
+    (pcobj *obj, double x, double y, double dx, double dy, double line_w,
      double r, double g, double b);
 
-extern void draw_mark(cairo_t *cr, enum direction d, double x, double y);
+extern void draw_mark(pcobj *obj, enum direction d, double x, double y);
 extern void draw_return_arrow
-    (cairo_t *cr, double x, double y, double edge, double width,
+    (pcobj *obj, double x, double y, double edge, double width,
      double r, double g, double b);
 extern void draw_cont_arrow
-    (cairo_t *cr, double x, double y, double edge, double width,
+    (pcobj *obj, double x, double y, double edge, double width,
      double r, double g, double b);
 
+extern void draw_decoration
+    (pcobj *obj, args_t *args, mcoord_t *mcoord, scoord_t *scoord);
+extern hcache_t *header_new(pcobj *obj, args_t *args, char *datebuf);
+extern void header_free(hcache_t *hc);
 extern void draw_header
-   (pcobj *obj, args_t *args, int page, mcoord_t *mcoord,
-    scoord_t *scoord, char *datebuf);
+   (pcobj *obj, hcache_t *hc, int page, mcoord_t *mcoord, scoord_t *scoord);
+extern gutter_t *gutter_new(pcobj *obj, args_t *args);
+extern void gutter_free(gutter_t *gt);
+extern void draw_line_number(pcobj *obj, gutter_t *gt, int num, double x, double top);
 extern void draw_lines
-    (pcobj *obj, UFILE *in_f, args_t *args,int lineperpage,
-    int *fline,  mcoord_t *mcoord, scoord_t *scoord);
-extern void draw_file(pcobj *obj, UFILE *in_f, args_t *args, int last_file);
+    (job_t *job, pcobj *obj, UFILE *in_f, gutter_t *gutter,
+     int lineperpage, int *fline,  mcoord_t *mcoord, scoord_t *scoord);
+extern job_t *job_new(args_t *args);
+extern void job_free(job_t *job);
+extern void draw_file(job_t *job, pcobj *obj, UFILE *in_f, int last_file,
+                      incr_t *incr);
+
+// outputs of libutpdf.c, shared with the command line
+extern time_t utpdf_creation_date(args_t *args);
+extern pcobj *utpdf_output_new(args_t *args, int pdf, cairo_write_func_t write,
+                               void *closure, duplex_t *duplex);
+extern pcobj *utpdf_fanout_new(args_t *args, int pdf, pcobj *out, cairo_write_func_t write,
+                               void *closure, duplex_t *duplex);
 
 #endif
 
@@ -0,0 +1,365 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <hb.h>
+#include <hb-ot.h>
+#include <hb-subset.h>
+
+#include "fontsub.h"
+#include "cache.h"
+
+/*
+  font subsets for the native writers
+
+  Glyphs are collected per HarfBuzz face, which pango shaped them with.
+  The subset keeps the original glyph ids (HB_SUBSET_FLAGS_RETAIN_GIDS),
+  so that glyph ids written in pages before the end need no renumbering.
+  Every metric is in 1/1000 em, as PDF/PostScript font dictionaries.
+*/
+
+#define EM1000(fs, v) ((int)((double)(v)*1000/(fs)->upem))
+
+//
+// forward declaration
+int fontsub_head(fontsub_t *fs, int offset);
+void fontsub_name(fontsub_t *fs);
+long cff_index(const unsigned char *p, long len, long off, long *start, long *end);
+int cff_dict_int(const unsigned char *p, long len, int op, long *v);
+void fontsub_charset(fontsub_t *fs, hb_blob_t *cff);
+//
+//
+
+fontsub_t *fontsub_get(fslist_t *l, PangoFont *font){
+    hb_font_t *hbf=pango_font_get_hb_font(font);
+    hb_face_t *face;
+    hb_blob_t *cff;
+    fontsub_t *fs;
+
+    if (hbf == NULL) return NULL;
+    face = hb_font_get_face(hbf);
+    for (fs=l->top; fs != NULL; fs=fs->next){
+        if (fs->face == face) return fs;
+    }
+    fs = calloc(1, sizeof(fontsub_t));
+    fs->face = hb_face_reference(face);
+    fs->font = hb_font_create(face); // default scale is units per em
+    fs->upem = hb_face_get_upem(face);
+    fs->nglyphs = hb_face_get_glyph_count(face);
+    fs->used = calloc(fs->nglyphs, sizeof(unsigned char));
+    fs->uni = calloc(fs->nglyphs, sizeof(gunichar));
+    fs->id = ++l->nfonts;
+    cff = hb_face_reference_table(face, HB_TAG('C','F','F',' '));
+    fs->cff = (hb_blob_get_length(cff) > 0);
+    if (fs->cff){
+        fontsub_charset(fs, cff);
+    }
+    hb_blob_destroy(cff);
+    fontsub_name(fs);
+
+    if (l->last == NULL){
+        l->top = fs;
+    } else {
+        l->last->next = fs;
+    }
+    l->last = fs;
+    return fs;
+}
+
+// PostScript name, which is usable as PDF name
+void fontsub_name(fontsub_t *fs){
+    char buf[S_LEN];
+    unsigned int len=S_LEN;
+    int i, j=0;
+
+    buf[0] = '\0';
+    hb_ot_name_get_utf8(fs->face, HB_OT_NAME_ID_POSTSCRIPT_NAME,
+                        HB_LANGUAGE_INVALID, &len, buf);
+    for (i=0; buf[i] != '\0'; i++){
+        if (isalnum((unsigned char)buf[i]) || (buf[i] == '-') || (buf[i] == '_')){
+            fs->name[j++] = buf[i];
+        }
+    }
+    fs->name[j] = '\0';
+    if (j == 0){
+        snprintf(fs->name, S_LEN, "Font%d", fs->id);
+    }
+}
+
+void fontsub_use(fontsub_t *fs, PangoGlyph gid, gunichar uc){
+    if (gid >= fs->nglyphs) return;
+    fs->used[gid] |= FS_USED|FS_PAGE; // keeps FS_SENT
+    fs->on_page = 1;
+    if (fs->uni[gid] == 0){
+        fs->uni[gid] = uc;
+    }
+}
+
+// advance width
+int fontsub_width(fontsub_t *fs, PangoGlyph gid){
+    return EM1000(fs, hb_font_get_glyph_h_advance(fs->font, gid));
+}
+
+// the code of glyph in the PDF font: CID of CID-keyed CFF, or gid
+unsigned int fontsub_cid(fontsub_t *fs, PangoGlyph gid){
+    if ((fs->cid == NULL) || (gid >= fs->nglyphs)) return gid;
+    return fs->cid[gid];
+}
+
+/*
+  CID-keyed CFF
+
+  A CIDFontType0 font program selects glyphs by CID through the charset
+  of CFF, not by glyph id. The subset keeps the charset entries of the
+  retained glyphs, so the CIDs of the original face are used as codes.
+*/
+
+// INDEX at off: the range of its first element in start..end.
+// returns the offset after the INDEX, or -1.
+long cff_index(const unsigned char *p, long len, long off, long *start, long *end){
+    long i, count, osize, data, o[2]={0, 0}, last=0;
+
+    if (off+2 > len) return -1;
+    count = (p[off]<<8) | p[off+1];
+    if (count == 0){
+        *start = *end = off+2;
+        return off+2;
+    }
+    if (off+3 > len) return -1;
+    osize = p[off+2];
+    if ((osize < 1) || (osize > 4) || (off+3+(count+1)*osize > len)) return -1;
+    for (i=0; i<osize; i++){
+        o[0] = (o[0]<<8) | p[off+3+i];
+        o[1] = (o[1]<<8) | p[off+3+osize+i];
+        last = (last<<8) | p[off+3+count*osize+i];
+    }
+    data = off+3+(count+1)*osize-1; // offsets start at 1
+    if ((data+last > len) || (o[0] < 1) || (o[0] > o[1]) || (o[1] > last)) return -1;
+    *start = data+o[0];
+    *end = data+o[1];
+    return data+last;
+}
+
+// integer operand of op in a DICT (12 x is 0x0c00|x). 0: not found
+int cff_dict_int(const unsigned char *p, long len, int op, long *v){
+    long i=0, arg=0;
+
+    while (i < len){
+        int b0=p[i];
+
+        if ((b0 == 28) && (i+3 <= len)){
+            arg = (short)((p[i+1]<<8) | p[i+2]);
+            i += 3;
+        } else if ((b0 == 29) && (i+5 <= len)){
+            arg = (int)(((unsigned int)p[i+1]<<24) | (p[i+2]<<16) | (p[i+3]<<8) | p[i+4]);
+            i += 5;
+        } else if (b0 == 30){
+            // real: nibbles to 0xf
+            for (i++; (i < len) && ((p[i] & 0x0f) != 0x0f) && ((p[i] & 0xf0) != 0xf0); i++);
+            i++;
+            arg = 0;
+        } else if ((b0 >= 32) && (b0 <= 246)){
+            arg = b0-139;
+            i++;
+        } else if ((b0 >= 247) && (b0 <= 250) && (i+2 <= len)){
+            arg = (b0-247)*256+p[i+1]+108;
+            i += 2;
+        } else if ((b0 >= 251) && (b0 <= 254) && (i+2 <= len)){
+            arg = -(b0-251)*256-p[i+1]-108;
+            i += 2;
+        } else if (b0 <= 21){
+            int o=b0;
+
+            if ((b0 == 12) && (i+2 <= len)){
+                o = 0x0c00 | p[i+1];
+                i++;
+            }
+            i++;
+            if (o == op){
+                *v = arg;
+                return 1;
+            }
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// fs->cid[] from the charset, if the CFF is CID-keyed (ROS in Top DICT)
+void fontsub_charset(fontsub_t *fs, hb_blob_t *cff){
+    unsigned int ulen;
+    const unsigned char *p=(const unsigned char *)hb_blob_get_data(cff, &ulen);
+    long len=ulen, off, start, end, charset, ros, gid, first, left;
+
+    if ((p == NULL) || (len < 4)) return;
+    // header, Name INDEX, Top DICT INDEX
+    if (((off = cff_index(p, len, p[2], &start, &end)) < 0)
+        || (cff_index(p, len, off, &start, &end) < 0) || (start == end)
+        || !cff_dict_int(p+start, end-start, 0x0c1e, &ros)
+        || !cff_dict_int(p+start, end-start, 15, &charset)
+        || (charset <= 2) || (charset >= len)) return;
+
+    fs->cid = calloc(fs->nglyphs, sizeof(unsigned short));
+    switch (p[charset]){
+    case 0:
+        for (gid=1; (gid < fs->nglyphs) && (charset+1+gid*2 <= len); gid++){
+            fs->cid[gid] = (p[charset-1+gid*2]<<8) | p[charset+gid*2];
+        }
+        break;
+    case 1:
+    case 2:
+        off = charset+1;
+        for (gid=1; gid < fs->nglyphs; ){
+            if (off + ((p[charset] == 1) ? 3 : 4) > len) break;
+            first = (p[off]<<8) | p[off+1];
+            left = (p[charset] == 1) ? p[off+2] : ((p[off+2]<<8) | p[off+3]);
+            off += (p[charset] == 1) ? 3 : 4;
+            for (; (left >= 0) && (gid < fs->nglyphs); left--, first++, gid++){
+                fs->cid[gid] = first;
+            }
+        }
+        break;
+    default:
+        free(fs->cid);
+        fs->cid = NULL;
+        break;
+    }
+}
+
+// subset tag: same glyphs, same tag.
+void fontsub_tag(fontsub_t *fs, char *tag){
+    hash_t h=hash_bytes(HASH_INIT, fs->used, fs->nglyphs);
+    int i;
+
+    for (i=0; i<FS_TAGLEN-1; i++){
+        tag[i] = 'A' + (h % 26);
+        h /= 26;
+    }
+    tag[i] = '\0';
+}
+
+// signed 16bit value in 'head' table
+int fontsub_head(fontsub_t *fs, int offset){
+    hb_blob_t *head=hb_face_reference_table(fs->face, HB_TAG('h','e','a','d'));
+    unsigned int len;
+    const unsigned char *p=(const unsigned char *)hb_blob_get_data(head, &len);
+    int v=0;
+
+    if ((p != NULL) && (len >= (unsigned int)offset+2)){
+        v = (short)((p[offset]<<8) | p[offset+1]);
+    }
+    hb_blob_destroy(head);
+    return v;
+}
+
+// xMin, yMin, xMax, yMax
+void fontsub_bbox(fontsub_t *fs, int *bbox){
+    int i;
+
+    for (i=0; i<4; i++){
+        bbox[i] = EM1000(fs, fontsub_head(fs, 36+i*2));
+    }
+}
+
+int fontsub_ascent(fontsub_t *fs){
+    hb_font_extents_t ext;
+
+    hb_font_get_h_extents(fs->font, &ext);
+    return EM1000(fs, ext.ascender);
+}
+
+int fontsub_descent(fontsub_t *fs){
+    hb_font_extents_t ext;
+
+    hb_font_get_h_extents(fs->font, &ext);
+    return EM1000(fs, ext.descender);
+}
+
+int fontsub_capheight(fontsub_t *fs){
+    hb_position_t cap;
+
+    if (hb_ot_metrics_get_position(fs->font, HB_OT_METRICS_TAG_CAP_HEIGHT, &cap)){
+        return EM1000(fs, cap);
+    }
+    return fontsub_ascent(fs);
+}
+
+// font file of the glyphs with mask in used[].
+// hb_blob_destroy() it after use.
+hb_blob_t *fontsub_subset(fontsub_t *fs, int mask){
+    hb_subset_input_t *input=hb_subset_input_create_or_fail();
+    hb_face_t *sub;
+    hb_blob_t *blob;
+    unsigned int gid;
+
+    if (input == NULL){
+        return hb_face_reference_blob(fs->face); // whole font
+    }
+    for (gid=0; gid<fs->nglyphs; gid++){
+        if (fs->used[gid] & mask){
+            hb_set_add(hb_subset_input_glyph_set(input), gid);
+        }
+    }
+    hb_subset_input_set_flags(input, HB_SUBSET_FLAGS_RETAIN_GIDS);
+    sub = hb_subset_or_fail(fs->face, input);
+    hb_subset_input_destroy(input);
+    if (sub == NULL){
+        return hb_face_reference_blob(fs->face);
+    }
+    blob = hb_face_reference_blob(sub);
+    hb_face_destroy(sub);
+    return blob;
+}
+
+// a new page starts.
+void fslist_page_clear(fslist_t *l){
+    fontsub_t *fs;
+    unsigned int gid;
+
+    for (fs=l->top; fs != NULL; fs=fs->next){
+        if (!fs->on_page) continue;
+        for (gid=0; gid<fs->nglyphs; gid++){
+            fs->used[gid] &= ~FS_PAGE;
+        }
+        fs->on_page = 0;
+    }
+}
+
+void fslist_free(fslist_t *l){
+    fontsub_t *fs=l->top, *next;
+
+    while (fs != NULL){
+        next = fs->next;
+        hb_font_destroy(fs->font);
+        hb_face_destroy(fs->face);
+        free(fs->used);
+        free(fs->uni);
+        free(fs->cid);
+        free(fs);
+        fs = next;
+    }
+    l->top = l->last = NULL;
+    l->nfonts = 0;
+}
+
+// end of fontsub.c
@@ -0,0 +1,71 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __FONTSUB_H__
+#define __FONTSUB_H__
+
+#include <pango/pangocairo.h>
+#include <hb.h>
+#include "utpdf.h"
+
+#define FS_TAGLEN 7 // "ABCDEF" + '\0'
+
+// flags of fontsub_t.used[]
+#define FS_USED 0x01 // in the document
+#define FS_PAGE 0x02 // in the current page
+#define FS_SENT 0x04 // defined in the PostScript VM (pswriter.c)
+
+// glyphs used in one font face, for embedding its subset
+typedef struct font_subset {
+    hb_face_t *face;
+    hb_font_t *font;       // scaled to units per em
+    unsigned int upem, nglyphs;
+    int id;                // 1, 2, ... in order of use
+    int ref;               // object number/name used by the writer
+    int cff;               // CFF outlines, otherwise TrueType
+    char name[S_LEN];      // PostScript name
+    unsigned char *used;   // used[gid]: FS_USED|FS_PAGE|FS_SENT
+    int on_page;           // used in the current page
+    int defined;           // the font is defined in the PostScript VM
+    gunichar *uni;         // uni[gid]: the character of glyph, or 0
+    unsigned short *cid;   // cid[gid] of CID-keyed CFF, or NULL: cid == gid
+    struct font_subset *next;
+} fontsub_t;
+
+typedef struct font_subset_list {
+    fontsub_t *top, *last;
+    int nfonts;
+} fslist_t;
+
+extern fontsub_t *fontsub_get(fslist_t *l, PangoFont *font);
+extern void fontsub_use(fontsub_t *fs, PangoGlyph gid, gunichar uc);
+extern int fontsub_width(fontsub_t *fs, PangoGlyph gid);
+extern unsigned int fontsub_cid(fontsub_t *fs, PangoGlyph gid);
+extern void fontsub_tag(fontsub_t *fs, char *tag);
+extern void fontsub_bbox(fontsub_t *fs, int *bbox);
+extern int fontsub_ascent(fontsub_t *fs);
+extern int fontsub_descent(fontsub_t *fs);
+extern int fontsub_capheight(fontsub_t *fs);
+extern hb_blob_t *fontsub_subset(fontsub_t *fs, int mask);
+extern void fslist_page_clear(fslist_t *l);
+extern void fslist_free(fslist_t *l);
+
+#endif
+
+// end of fontsub.h
@@ -0,0 +1,414 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "utpdf.h"
+#include "args.h"
+#include "cache.h"
+#include "incr.h"
+
+/*
+  per-page fingerprints stored next to the output
+
+  <output>.pages:
+    utpdf-pages 2
+    key <hash of args, input name and header date>
+    size <input size>
+    page <start> <end> <hash> <cont> <over_sp> <row_bytes> <variant> <line>
+    ...
+
+  A page is unchanged, when the bytes of its range, the folding state
+  at its top, its geometry variant and its first line number are all
+  same as the previous run. If every page is unchanged and the input
+  is not grown, the output is up to date and is not rendered again.
+
+  Otherwise, with the native PDF writer, the sheets before the first
+  changed page are copied from the previous output, and rendering
+  starts at the state recorded at the top of that page. The last page
+  of the previous run is always rendered again: it may be filled by
+  the lines appended since then.
+
+  The new output is written to a temporary file next to the output,
+  and replaces it only when it is finished. The sidecar is removed
+  before the new output is written, and saved after it replaced the
+  previous one: a failed run keeps the previous output, and never
+  leaves fingerprints of an output it did not finish.
+*/
+
+#define INCR_BUFLEN 65536
+
+// counters for --stats
+int incr_files=0, incr_skipped=0, incr_pages=0, incr_unchanged=0, incr_copied=0;
+
+// the temporary output, removed at exit() before it is finished
+static char incr_pending[S_LEN];
+
+//
+// forward declaration
+hash_t incr_fingerprint(int fd, pagefp_t *p, int *ok);
+void incr_load(incr_t *inc);
+void fplist_add(fplist_t *l, long start);
+int incr_reusable(incr_t *inc);
+void incr_prev_close(incr_t *inc);
+void incr_cleanup();
+int incr_output_close(incr_t *inc);
+//
+//
+
+hash_t incr_fingerprint(int fd, pagefp_t *p, int *ok){
+    char buf[INCR_BUFLEN];
+    hash_t h=HASH_INIT;
+    long pos=p->start;
+    int rlen, len;
+
+    while (pos < p->end){
+        len = (p->end - pos < INCR_BUFLEN) ? (p->end - pos) : INCR_BUFLEN;
+        if ((rlen=pread(fd, buf, len, pos)) <= 0){
+            *ok = 0;
+            return h;
+        }
+        h = hash_bytes(h, buf, rlen);
+        pos += rlen;
+    }
+    h = hash_bytes(h, &p->cont, sizeof(p->cont));
+    h = hash_bytes(h, &p->over_sp, sizeof(p->over_sp));
+    h = hash_bytes(h, &p->row_bytes, sizeof(p->row_bytes));
+    h = hash_bytes(h, &p->variant, sizeof(p->variant));
+    h = hash_bytes(h, &p->line, sizeof(p->line));
+    *ok = 1;
+    return h;
+}
+
+void fplist_add(fplist_t *l, long start){
+    if (l->npages >= l->alloc){
+        l->alloc = (l->alloc > 0) ? l->alloc*2 : 64;
+        l->pages = realloc(l->pages, sizeof(pagefp_t)*l->alloc);
+    }
+    memset(&l->pages[l->npages], 0, sizeof(pagefp_t));
+    l->pages[l->npages].start = start;
+    l->pages[l->npages].end = start;
+    l->npages++;
+}
+
+// read previous fingerprints. old.npages < 0, if there is none.
+void incr_load(incr_t *inc){
+    char buf[S_LEN];
+    pagefp_t p;
+    FILE *f=fopen(inc->path, "r");
+
+    inc->old.npages = -1;
+    if (f == NULL) return;
+
+    if ((fgets(buf, S_LEN, f) == NULL)
+        || (strncmp(buf, INCR_MAGIC, strlen(INCR_MAGIC)) != 0)
+        || (fscanf(f, " key %llx size %ld", &inc->old.key, &inc->old.size) != 2)){
+        fclose(f);
+        return;
+    }
+    inc->old.npages = 0;
+    while (fscanf(f, " page %ld %ld %llx %d %d %d %d %d", &p.start, &p.end, &p.hash,
+                  &p.cont, &p.over_sp, &p.row_bytes, &p.variant, &p.line) == 8){
+        fplist_add(&inc->old, p.start);
+        inc->old.pages[inc->old.npages-1] = p;
+    }
+    fclose(f);
+}
+
+incr_t *incr_open(args_t *args, char *outfile, int in_fd){
+    struct stat stat_b;
+    char datebuf[S_LEN];
+    incr_t *inc;
+
+    if (args->follow || (strncmp(outfile, "-", S_LEN)==0)
+        || (fstat(in_fd, &stat_b) < 0) || !S_ISREG(stat_b.st_mode)){
+        // only fixed regular file could be compared with previous run.
+        return NULL;
+    }
+    inc = calloc(1, sizeof(incr_t));
+    // the input may be closed before the fingerprints are saved
+    if ((inc->in_fd = dup(in_fd)) < 0){
+        free(inc);
+        return NULL;
+    }
+    snprintf(inc->path, S_LEN, "%s%s", outfile, INCR_SUFFIX);
+    inc->outfile = outfile;
+    inc->per_sheet = 1;
+
+    strftime(datebuf, S_LEN, args->date_format, localtime(args->mtime));
+    inc->cur.key = hash_args(HASH_INIT, args);
+    inc->cur.key = hash_str(inc->cur.key, args->in_fname);
+    inc->cur.key = hash_str(inc->cur.key, datebuf);
+    inc->cur.size = stat_b.st_size;
+
+    incr_load(inc);
+    incr_files++;
+    return inc;
+}
+
+int incr_up_to_date(incr_t *inc){
+    struct stat stat_b;
+    int i, ok;
+
+    if ((inc->old.npages <= 0)
+        || (inc->old.key != inc->cur.key) || (inc->old.size != inc->cur.size)
+        || (stat(inc->outfile, &stat_b) < 0)){
+        return 0;
+    }
+    for (i=0; i<inc->old.npages; i++){
+        pagefp_t *p=&inc->old.pages[i];
+        if ((incr_fingerprint(inc->in_fd, p, &ok) != p->hash) || !ok){
+            return 0;
+        }
+    }
+    incr_skipped++;
+    incr_pages += inc->old.npages;
+    incr_unchanged += inc->old.npages;
+    return 1;
+}
+
+// unchanged sheets at the top of the previous output, followed by
+// more input than the previous run had on them.
+int incr_reusable(incr_t *inc){
+    int i, ok, n=0;
+
+    if ((inc->old.npages <= 0) || (inc->old.key != inc->cur.key)){
+        return 0;
+    }
+    // not the last page
+    for (i=0; i<inc->old.npages-1; i++){
+        pagefp_t *p=&inc->old.pages[i];
+
+        if ((incr_fingerprint(inc->in_fd, p, &ok) != p->hash) || !ok) break;
+        n++;
+    }
+    n -= n % inc->per_sheet;
+    while ((n > 0) && (inc->old.pages[n-1].end >= inc->cur.size)){
+        n -= inc->per_sheet;
+    }
+    return n / inc->per_sheet;
+}
+
+/*
+  With the native PDF writer, the previous output is read to copy its
+  unchanged sheets (pcobj_copy_pages()). It is kept as it is until the
+  new one replaces it. returns the sheets, which may be copied.
+*/
+int incr_prev_open(incr_t *inc, args_t *args, int pdf){
+    struct stat stat_b;
+    int fd, sheets;
+    size_t len=0;
+    ssize_t rlen;
+
+    if (!pdf || !args->native || args->optimize || args->linearize
+        || (strcmp(inc->outfile, "-") == 0)){
+        return 0;
+    }
+    inc->per_sheet = args->twocols ? 2 : 1;
+    if ((sheets = incr_reusable(inc)) == 0){
+        return 0;
+    }
+    if ((fd = open(inc->outfile, O_RDONLY)) < 0){
+        return 0;
+    }
+    if (fstat(fd, &stat_b) < 0){
+        close(fd);
+        return 0;
+    }
+    // with a terminator for the parser
+    inc->prev = malloc(stat_b.st_size+1);
+    while ((len < (size_t)stat_b.st_size)
+           && ((rlen = read(fd, inc->prev+len, stat_b.st_size-len)) > 0)){
+        len += rlen;
+    }
+    close(fd);
+    if (len < (size_t)stat_b.st_size){
+        incr_prev_close(inc);
+        return 0;
+    }
+    inc->prev[len] = '\0';
+    inc->prev_len = len;
+    return sheets;
+}
+
+void incr_prev_close(incr_t *inc){
+    free(inc->prev);
+    inc->prev = NULL;
+}
+
+void incr_cleanup(){
+    if (incr_pending[0] != '\0') unlink(incr_pending);
+}
+
+// the new output in the directory of outfile, or -1 (shown on stderr).
+// The sidecar of the previous output is removed here.
+int incr_output_open(incr_t *inc){
+    static int registered=0;
+    struct stat stat_b;
+    mode_t mask;
+    int fd;
+
+    unlink(inc->path);
+    snprintf(inc->tmp, S_LEN, "%s.XXXXXX", inc->outfile);
+    if ((fd = mkstemp(inc->tmp)) < 0){
+        perror(inc->tmp);
+        inc->tmp[0] = '\0';
+        return -1;
+    }
+    if (!registered){
+        atexit(incr_cleanup);
+        registered = 1;
+    }
+    snprintf(incr_pending, S_LEN, "%s", inc->tmp);
+    // as the output made by open(2)
+    if (stat(inc->outfile, &stat_b) == 0){
+        fchmod(fd, stat_b.st_mode & 07777);
+    } else {
+        mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+    return fd;
+}
+
+// the finished output replaces the previous one. -1: failed
+int incr_output_close(incr_t *inc){
+    if (rename(inc->tmp, inc->outfile) < 0){
+        perror(inc->outfile);
+        return -1;
+    }
+    inc->tmp[0] = incr_pending[0] = '\0';
+    return 0;
+}
+
+// sheets were copied from the previous output: their fingerprints are
+// kept, and rendering resumes at old.pages[inc->resume].
+void incr_resume(incr_t *inc, int sheets){
+    int i;
+
+    inc->resume = sheets * inc->per_sheet;
+    for (i=0; i<inc->resume; i++){
+        fplist_add(&inc->cur, inc->old.pages[i].start);
+        inc->cur.pages[i] = inc->old.pages[i];
+    }
+    incr_copied += inc->resume;
+    incr_prev_close(inc);
+}
+
+// called at the top of every page
+void incr_page(incr_t *inc, long pos, int cont, int over_sp, int row_bytes,
+               int variant, int line){
+    pagefp_t *p;
+
+    if (inc == NULL) return;
+    if (inc->cur.npages > 0){
+        inc->cur.pages[inc->cur.npages-1].end = pos;
+    }
+    fplist_add(&inc->cur, pos);
+    p = &inc->cur.pages[inc->cur.npages-1];
+    p->cont = cont;
+    p->over_sp = over_sp;
+    p->row_bytes = row_bytes;
+    p->variant = variant;
+    p->line = line;
+}
+
+void incr_save(incr_t *inc, long end){
+    FILE *f;
+    int i, ok, same_key;
+
+    if (inc->cur.npages > 0){
+        inc->cur.pages[inc->cur.npages-1].end = end;
+    }
+    same_key = (inc->old.npages > 0) && (inc->old.key == inc->cur.key);
+
+    if ((f=fopen(inc->path, "w")) == NULL){
+        perror(inc->path);
+        return; // not fatal: next run renders everything.
+    }
+    fprintf(f, "%s\nkey %016llx\nsize %ld\n", INCR_MAGIC, inc->cur.key, inc->cur.size);
+    for (i=0; i<inc->cur.npages; i++){
+        pagefp_t *p=&inc->cur.pages[i];
+
+        p->hash = incr_fingerprint(inc->in_fd, p, &ok);
+        if (!ok){
+            // input was changed while rendering.
+            fclose(f);
+            unlink(inc->path);
+            return;
+        }
+        fprintf(f, "page %ld %ld %016llx %d %d %d %d %d\n", p->start, p->end, p->hash,
+                p->cont, p->over_sp, p->row_bytes, p->variant, p->line);
+        if (same_key && (i < inc->old.npages)
+            && (inc->old.pages[i].start == p->start) && (inc->old.pages[i].end == p->end)
+            && (inc->old.pages[i].hash == p->hash)){
+            incr_unchanged++;
+        }
+    }
+    incr_pages += inc->cur.npages;
+    fclose(f);
+}
+
+// the output is finished and closed: it replaces the previous one, the
+// fingerprints up to end of input are saved, and inc is freed.
+// -1: the output could not be replaced
+int incr_finish(incr_t *inc, long end){
+    int result=0;
+
+    if (inc == NULL) return 0;
+    if (inc->tmp[0] != '\0'){
+        result = incr_output_close(inc);
+    }
+    if (result == 0){
+        incr_save(inc, end);
+    }
+    incr_close(inc);
+    return result;
+}
+
+void incr_close(incr_t *inc){
+    if (inc == NULL) return;
+    if (inc->tmp[0] != '\0'){
+        // not finished
+        unlink(inc->tmp);
+        incr_pending[0] = '\0';
+    }
+    close(inc->in_fd);
+    incr_prev_close(inc);
+    free(inc->cur.pages);
+    free(inc->old.pages);
+    free(inc);
+}
+
+void incr_report(args_t *args){
+    if (!args->incremental) return;
+    fprintf(stderr, "%s: incremental: %d of %d file(s) up to date, %d of %d page(s) unchanged\n",
+            utpdf_prog_name, incr_skipped, incr_files, incr_unchanged, incr_pages);
+    if (incr_copied > 0){
+        fprintf(stderr, "%s: incremental: %d page(s) copied from the previous output\n",
+                utpdf_prog_name, incr_copied);
+    }
+}
+
+// end of incr.c
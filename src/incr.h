@@ -0,0 +1,73 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __INCR_H__
+#define __INCR_H__
+
+#include "utpdf.h"
+#include "args.h"
+#include "cache.h"
+
+#define INCR_SUFFIX ".pages"  // sidecar: <output>.pages
+#define INCR_MAGIC  "utpdf-pages 2"
+
+typedef struct page_fingerprint {
+    long start, end;   // byte range of input
+    hash_t hash;       // hash of the byte range and the state below
+    int cont, over_sp; // folding state at the top of page
+    int row_bytes;
+    int variant;       // geometry variant, page_variant()
+    int line;          // line number at the top of page
+} pagefp_t;
+
+typedef struct page_fingerprints {
+    hash_t key;        // args, input name and header date
+    long size;         // input size
+    int npages, alloc;
+    pagefp_t *pages;
+} fplist_t;
+
+typedef struct incremental {
+    char path[S_LEN];  // sidecar
+    char *outfile;
+    char tmp[S_LEN];   // the new output, renamed to outfile when finished
+    int in_fd;         // a copy of the input fd, for the fingerprints
+    fplist_t cur, old;
+    // previous output, whose first sheets are copied (NULL: none)
+    char *prev;
+    size_t prev_len;
+    int per_sheet;     // pages per sheet: 2 with two columns
+    int resume;        // the first page rendered
+} incr_t;
+
+extern incr_t *incr_open(args_t *args, char *outfile, int in_fd);
+extern int incr_up_to_date(incr_t *inc);
+extern int incr_prev_open(incr_t *inc, args_t *args, int pdf);
+extern int incr_output_open(incr_t *inc);
+extern void incr_resume(incr_t *inc, int sheets);
+extern void incr_page(incr_t *inc, long pos, int cont, int over_sp, int row_bytes,
+                      int variant, int line);
+extern void incr_save(incr_t *inc, long end);
+extern int incr_finish(incr_t *inc, long end);
+extern void incr_close(incr_t *inc);
+extern void incr_report(args_t *args);
+
+#endif
+
+// end of incr.h
@@ -22,6 +22,13 @@
 #include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "io.h"
 #include "utpdf.h"
@@ -54,7 +61,7 @@ int nbytechar(char c){
     }
 }
 
-// open file descriptor
+// open file descriptor, or -1 (shown on stderr)
 int openfd(const char *path, int flag){
     int fd=open(path, flag, 0666);
     char ebuf[S_LEN];
@@ -66,12 +73,80 @@ int openfd(const char *path, int flag){
 	    snprintf(ebuf, S_LEN, "Could not open: %s\n", path);
 	}
 	perror(ebuf);
-	exit(1);
     }
     return fd;
 }
 
 
+//
+// classification of input: every read of file is classified, and
+// shaped by the cheapest way for the class (see pcobj_shape_at()).
+//   ic_ascii:   only ASCII
+//   ic_grid:    no combining, bidi nor joining, e.g. CJK
+//   ic_complex: needs itemization of pango
+
+enum input_class classify(const unsigned char *s, int len, char *reason, int rlen){
+    static const struct { unsigned int from, to; const char *what; } complex[]={
+        {0x0300, 0x036F, "combining mark"},
+        {0x0483, 0x0489, "combining mark"},
+        {0x0590, 0x08FF, "right-to-left script"},
+        {0x0900, 0x0DFF, "Indic script"},
+        {0x0E00, 0x0FFF, "Thai/Lao/Tibetan script"},
+        {0x1000, 0x109F, "Myanmar script"},
+        {0x1100, 0x11FF, "Hangul jamo"},
+        {0x1780, 0x17FF, "Khmer script"},
+        {0x1800, 0x18AF, "Mongolian script"},
+        {0x1A20, 0x1AAF, "Tai Tham script"},
+        {0x1AB0, 0x1AFF, "combining mark"},
+        {0x1B00, 0x1B7F, "Balinese script"},
+        {0x1CD0, 0x1CFF, "Vedic extensions"},
+        {0x1DC0, 0x1DFF, "combining mark"},
+        {0x200C, 0x200F, "joiner or bidi control"},
+        {0x202A, 0x202E, "bidi control"},
+        {0x2066, 0x2069, "bidi control"},
+        {0x20D0, 0x20FF, "combining mark"},
+        {0x302A, 0x302F, "combining mark"},
+        {0x3099, 0x309A, "combining mark"},
+        {0xA980, 0xA9DF, "Javanese script"},
+        {0xFB1D, 0xFDFF, "right-to-left script"},
+        {0xFE00, 0xFE0F, "variation selector"},
+        {0xFE20, 0xFE2F, "combining mark"},
+        {0xFE70, 0xFEFF, "right-to-left script"},
+        {0x10800, 0x10FFF, "right-to-left script"},
+        {0x11000, 0x11FFF, "Brahmic script"},
+        {0x1E800, 0x1EFFF, "right-to-left script"},
+        {0x1F1E6, 0x1F1FF, "regional indicator"},
+        {0x1F3FB, 0x1F3FF, "emoji modifier"},
+        {0xE0000, 0xE01EF, "tag or variation selector"},
+    };
+    enum input_class cls=ic_ascii;
+    int i, j, clen;
+
+    for (i=0; i<len; i+=clen){
+        unsigned int cp;
+
+        clen = nbytechar(s[i]);
+        if (clen == 1){
+            if (s[i] >= 0x80) cls = ic_grid; // stray byte
+            continue;
+        }
+        if (i+clen > len) break;
+        cp = s[i] & (0x7F >> clen);
+        for (j=1; j<clen; j++) cp = (cp << 6) | (s[i+j] & 0x3F);
+        cls = ic_grid;
+        if (cp < complex[0].from) continue;
+        for (j=0; j<(int)(sizeof(complex)/sizeof(complex[0])); j++){
+            if ((complex[j].from <= cp) && (cp <= complex[j].to)){
+                if (reason[0] == '\0'){
+                    snprintf(reason, rlen, "U+%04X %s", cp, complex[j].what);
+                }
+                return ic_complex;
+            }
+        }
+    }
+    return cls;
+}
+
 //
 // UFILE: utf-8 reading interface
 
@@ -100,6 +175,7 @@ int openfd(const char *path, int flag){
 
 */
 
+// NULL: could not open (shown on stderr)
 UFILE *open_u(char *path) {
     char ebuf[S_LEN];
     int fd=open(path, O_RDONLY);
@@ -107,7 +183,7 @@ UFILE *open_u(char *path) {
     if (fd < 0){
         snprintf(ebuf, S_LEN, "Could not open for read: %s\n", path);
         perror(ebuf);
-        exit(1);
+        return NULL;
     }
     return fdopen_u(fd, path);
 }
@@ -117,27 +193,100 @@ UFILE *fdopen_u(int fd, char *path){
 
     f = malloc(sizeof(UFILE));
     f->fd = fd;
+    f->reader = NULL;
+    f->closure = NULL;
     f->eof = 0;
+    f->error = 0;
     f->qindex = 0;
     f->lastr = 0;
     f->sindex = 0;
+    f->pos = 0;
+    f->follow = 0;
+    f->timeout = 0;
+    f->idle_since = 0;
+    f->watch_fd = -1;
+    f->cls = ic_ascii;
+    f->stats = NULL;
     f->fname = path;
     return f;
 }
 
+// input from memory or a stream of the caller (see libutpdf.c)
+UFILE *cbopen_u(ureader_t reader, void *closure, char *name){
+    UFILE *f=fdopen_u(-1, name);
+
+    f->reader = reader;
+    f->closure = closure;
+    return f;
+}
+
 int close_u(UFILE *f){
-    int result;
-    result=close(f->fd);
+    int result=0;
+    if (f->watch_fd >= 0) close(f->watch_fd);
+    if (f->fd >= 0) result=close(f->fd);
     free(f);
     return result;
 }
 
+// read(2) into the queue, waiting at end-of-file while following.
+int read_u(UFILE *f, char *q, int len){
+    char ebuf[S_LEN];
+    int rlen;
+
+    if (f->reader != NULL) {
+        rlen = f->reader(f->closure, q, len);
+    } else {
+        rlen = read(f->fd, q, len);
+    }
+    while ((rlen == 0) && f->follow && wait_u(f)) {
+        // end-of-file is not the end, while following.
+        rlen = read(f->fd, q, len);
+    }
+    if ((rlen < 0) && (errno == EINTR) && follow_stop) {
+        // interrupted while blocking on pipe
+        rlen = 0;
+    }
+    if (rlen < 0) {
+        // the end of file for the layout, and an error for the caller
+        snprintf(ebuf, S_LEN, "Could not read: %s\n", f->fname);
+        perror(ebuf);
+        f->error = 1;
+        rlen = 0;
+    }
+    if (rlen > 0) {
+        enum input_class cls;
+        int back=0;
+
+        f->idle_since = 0;
+        // from the top of the character, which the last read cut
+        while ((q-back > f->queue) && (back < UC_LEN) && ((q[-back-1] & 0xC0) == 0x80)) back++;
+        if ((q-back > f->queue) && ((q[-back-1] & 0xC0) == 0xC0)) back++;
+        if (f->stats != NULL){
+            ustats_t *s=f->stats;
+
+            cls = classify((unsigned char *)q-back, rlen+back, s->reason, S_LEN);
+            s->chunks[cls]++;
+            if ((cls == ic_complex) && (s->file == NULL)) s->file = f->fname;
+        } else {
+            char reason[S_LEN]="";
+
+            cls = classify((unsigned char *)q-back, rlen+back, reason, S_LEN);
+        }
+        // the rest of the last read is still in the queue.
+        f->cls = ((q > f->queue) && (f->cls > cls)) ? f->cls : cls;
+    }
+    f->eof=(rlen==0);
+    return rlen;
+}
+
 int get_one_uchar(UFILE *f, char *dst){
     int i, clen;
-    char ebuf[S_LEN];
 
     // read from stack
-    if ((clen=pop_u(f, dst))>0) return clen;
+    if ((clen=pop_u(f, dst))>0) {
+        f->pos += clen;
+        return clen;
+    }
     
     // read from queue
     if ((f->lastr - f->qindex) >= 1) {
@@ -147,6 +296,7 @@ int get_one_uchar(UFILE *f, char *dst){
                 dst[i] = f->queue[(f->qindex)++];
             }
             dst[clen]='\0';
+            f->pos += clen;
             return clen;
         }
     }
@@ -167,20 +317,15 @@ int get_one_uchar(UFILE *f, char *dst){
         f->qindex = 0;
         
         // read from file
-        rlen = read(f->fd, q, UBUFLEN - f->lastr);
-        if (rlen < 0) {
-            snprintf(ebuf, S_LEN, "Could not read: %s\n", f->fname);
-            perror(ebuf);
-            exit(1);
-        }
+        rlen = read_u(f, q, UBUFLEN - f->lastr);
         f->lastr += rlen;
-        f->eof=(rlen==0);
         clen = nbytechar(f->queue[f->qindex]);
         if ((f->lastr - f->qindex)>=clen) {
             for (i=0; i<clen; i++) {
                 dst[i] = f->queue[(f->qindex)++];
             }
             dst[clen]='\0';
+            f->pos += clen;
             return clen;
         } else {
             return 0;
@@ -188,15 +333,55 @@ int get_one_uchar(UFILE *f, char *dst){
     }
 }
 
+/*
+  fill_u(): at least n bytes (or up to end-of-file, or the end of
+  line) are readable at f->queue+f->qindex, without copying them one
+  by one. The end of line does not wait for more bytes, while following.
+  Pushed back characters return to the top of queue.
+  skip_u(): consume the bytes, which are read there.
+*/
+int fill_u(UFILE *f, int n){
+    int i, rest=f->lastr - f->qindex;
+
+    if (n > UBUFLEN) n = UBUFLEN;
+    if ((f->sindex == 0) && ((rest >= n) || f->eof
+                             || memchr(f->queue + f->qindex, '\n', rest))){
+        return rest;
+    }
+    if (rest + f->sindex > UBUFLEN){
+        fprintf(stderr, "queue overflow at reading %s\n", f->fname);
+        f->error = f->eof = 1;
+        return rest;
+    }
+    memmove(f->queue + f->sindex, f->queue + f->qindex, rest);
+    for (i=0; i<f->sindex; i++){
+        f->queue[i] = f->stack[f->sindex-1-i];
+    }
+    f->lastr = rest + f->sindex;
+    f->qindex = 0;
+    f->sindex = 0;
+    while ((f->lastr < n) && !f->eof && !memchr(f->queue, '\n', f->lastr)){
+        f->lastr += read_u(f, f->queue + f->lastr, UBUFLEN - f->lastr);
+    }
+    return f->lastr;
+}
+
+void skip_u(UFILE *f, int n){
+    f->qindex += n;
+    f->pos += n;
+}
+
 int push_u(UFILE *f, char *d){
     int i, len=nbytechar(d[0]);
     if ((f->sindex+len)>USTACKLEN){
         fprintf(stderr, "stack overflow at reading %s\n", f->fname);
-        exit(1);
+        f->error = 1;
+        return 0;
     }
     for (i=len-1; i>=0; i--){
         f->stack[f->sindex++]=d[i];
     }
+    f->pos -= len;
 #ifdef SINGLE_DEBUG
     fprintf(stderr, "PUSH sindex: %d, data: \"%s\"\n", f->sindex, d);
 #endif
@@ -220,12 +405,116 @@ int pop_u(UFILE *f, char *d){
     return len;
 }
 
+// read again from pos of a regular file (incremental mode). 0: failed,
+// and nothing is read after that (f->error).
+int seek_u(UFILE *f, long pos){
+    if ((f->fd < 0) || (f->reader != NULL) || (lseek(f->fd, pos, SEEK_SET) < 0)){
+        f->error = f->eof = 1;
+        f->qindex = f->lastr = f->sindex = 0;
+        return 0;
+    }
+    f->eof = 0;
+    f->qindex = f->lastr = f->sindex = 0;
+    f->pos = pos;
+    f->cls = ic_ascii;
+    return 1;
+}
+
 int eof_u(UFILE *f){
     return (f->eof
             && (f->qindex == f->lastr)
             && (f->sindex == 0));
 }
 
+/*
+  sample_u(): distinct code points in the first read of file, without
+  consuming them. Fonts of them are resolved before drawing.
+*/
+#define SAMPLE_SET (SAMPLE_CHARS*4) // power of 2
+
+int sample_u(UFILE *f, unsigned int *cps, int max){
+    unsigned int set[SAMPLE_SET];
+    int i, j, clen, n=0, len=fill_u(f, UBUFLEN);
+    unsigned char *q=(unsigned char *)f->queue + f->qindex;
+
+    if (max > SAMPLE_CHARS) max = SAMPLE_CHARS;
+    memset(set, 0, sizeof(set));
+    for (i=0; (i < len) && (n < max); i+=clen){
+        unsigned int cp;
+
+        clen = nbytechar(q[i]);
+        if (i+clen > len) break;
+        if (clen == 1){
+            cp = q[i];
+        } else {
+            cp = q[i] & (0x7F >> clen);
+            for (j=1; j<clen; j++) cp = (cp << 6) | (q[i+j] & 0x3F);
+        }
+        if (cp < 0x20) continue; // control
+        for (j=(cp*2654435761u) & (SAMPLE_SET-1); set[j] != 0; j=(j+1) & (SAMPLE_SET-1)){
+            if (set[j] == cp) break;
+        }
+        if (set[j] == 0){
+            set[j] = cp;
+            cps[n++] = cp;
+        }
+    }
+    return n;
+}
+
+//
+// follow mode: keep reading the growing file, like "tail -f".
+// end-of-file is reported only after SIGINT or idle timeout.
+
+volatile sig_atomic_t follow_stop=0;
+
+void follow_sigint(int sig){
+    (void)sig;
+    follow_stop = 1;
+}
+
+void follow_u(UFILE *f, double timeout){
+    struct sigaction sa;
+
+    f->follow = 1;
+    f->timeout = timeout;
+    f->idle_since = 0;
+#ifdef __linux__
+    f->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((f->watch_fd >= 0)
+        && (inotify_add_watch(f->watch_fd, f->fname, IN_MODIFY) < 0)){
+        // e.g. stdin: fall back to polling
+        close(f->watch_fd);
+        f->watch_fd = -1;
+    }
+#endif
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = follow_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // without SA_RESTART, to interrupt read() and poll()
+    sigaction(SIGINT, &sa, NULL);
+}
+
+// wait for the growth of file. returns 0, when following should stop.
+int wait_u(UFILE *f){
+    struct pollfd pfd;
+    char buf[S_LEN];
+    time_t now=time(NULL);
+
+    if (follow_stop) return 0;
+    if (f->idle_since == 0) f->idle_since = now;
+    if ((f->timeout > 0) && (difftime(now, f->idle_since) >= f->timeout)){
+        return 0;
+    }
+    pfd.fd = f->watch_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, (f->watch_fd >= 0) ? 1 : 0, FOLLOW_INTERVAL) > 0){
+        // drain the events: the file itself is read again anyway.
+        while (read(f->watch_fd, buf, S_LEN) > 0);
+    }
+    return !follow_stop;
+}
+
 //
 // write functions for cairo_{ps,pdf}_surface_create_for_stream()
 
@@ -246,44 +535,45 @@ cairo_status_t write_func (void *closure, const unsigned char *data,
 #define PS_END_C  "%%EndComments"
 #define PS_DUPLEX "<</Duplex true /Tumble false>> setpagedevice\n"
 
-// write with Duplex command
+// write with Duplex command. closure is duplex_t.
 cairo_status_t write_ps_duplex(void *closure, const unsigned char *data,
                                unsigned int length){
-    static unsigned char line[1024]="";
-    static unsigned int i=0;
+    duplex_t *d=closure;
+    unsigned char *line=d->line;
     unsigned int p=0;
-    static int finished=0;
     int end_of_line;
+    cairo_write_func_t write_func=d->write;
+
+    closure = d->closure;
+    if (d->finished) return write_func(closure, data, length);
     
-    if (finished) return write_func(closure, data, length);
-    
-    while ((p<length) && !finished){
+    while ((p<length) && !d->finished){
         if (data[p] == 0x0D){
-            line[i++]=data[p++];
+            line[d->i++]=data[p++];
             if (data[p] == 0x0A){
-                line[i++]=data[p++];
+                line[d->i++]=data[p++];
             }
             end_of_line=1;            
         } else if (data[p]==0x0A){
-            line[i++]=data[p++];
+            line[d->i++]=data[p++];
             end_of_line=1;            
         } else {
-            line[i++]=data[p++];
+            line[d->i++]=data[p++];
             end_of_line=0;            
         }
         if (end_of_line){
-            if (write_func(closure, line, i) != CAIRO_STATUS_SUCCESS)
+            if (write_func(closure, line, d->i) != CAIRO_STATUS_SUCCESS)
                 return CAIRO_STATUS_WRITE_ERROR;
-            i=0;
+            d->i=0;
             if (bcmp(line, PS_END_C, strlen(PS_END_C))==0){
                 if (write_func(closure, (unsigned char *)PS_DUPLEX, strlen(PS_DUPLEX)) != CAIRO_STATUS_SUCCESS)
                     return CAIRO_STATUS_WRITE_ERROR;
-                finished=1;
+                d->finished=1;
             }
         }
     } // while(p<length)
 
-    if ((finished)&&(p<length)){
+    if ((d->finished)&&(p<length)){
         return write_func(closure, &data[p], length-p);
     }
 
@@ -298,7 +588,7 @@ int main(int argc, char **argv){
     char data[UC_LEN];
     
     for (i=1; i<argc; i++){
-        f=open_u(argv[i]);
+        if ((f=open_u(argv[i])) == NULL) exit(1);
         for (j=0; j<5; j++){
             get_one_uchar(f, data);
             clen=push_u(f, data);
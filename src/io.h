@@ -20,32 +20,78 @@
 #ifndef __IO_H__
 #define __IO_H__
 
+#include <signal.h>
+#include <time.h>
 #include <cairo.h>
+#include "utpdf.h"
 
 #define UBUFLEN   16384 // 16Kbyte
 #define USTACKLEN 256
 
+#define FOLLOW_INTERVAL 500 // polling interval of --follow (msec)
+#define SAMPLE_CHARS   1024 // distinct characters of sample_u()
+
+// classification of reads (see classify())
+typedef struct input_stats {
+    long chunks[INPUT_CLASSES];
+    char reason[S_LEN];   // the first complex character
+    char *file;           // where it was
+} ustats_t;
+
+// reads up to len bytes, 0 at end of input, or -1 (with errno).
+typedef int (*ureader_t)(void *closure, char *buf, int len);
+
 typedef struct utf8_file {
     int fd;
+    ureader_t reader;      // instead of read(2) of fd, if not NULL
+    void *closure;
     char queue[UBUFLEN];   // reading queue
     char stack[USTACKLEN]; // push back stack
     char *fname; // filename
     int eof;     // end-of-file flag
+    int error;   // could not read: the rest is lost (shown on stderr)
     int qindex;  // queue index
     int lastr;   // last readed index
     int sindex;  // stack index
+    long pos;    // bytes consumed from the top of file
+    int follow;     // wait for the growth at end-of-file
+    double timeout; // give up following after idle seconds (<=0: never)
+    time_t idle_since;
+    int watch_fd;   // inotify, or -1 for polling
+    enum input_class cls; // of the bytes in the queue
+    ustats_t *stats;      // NULL: not counted
 } UFILE;
 
+// write_ps_duplex(): the closure, and the state over calls
+typedef struct duplex_writer {
+    cairo_write_func_t write;
+    void *closure;
+    unsigned char line[1024];
+    unsigned int i;
+    int finished;
+} duplex_t;
+
+extern volatile sig_atomic_t follow_stop;
+
 extern int nbytechar(char c);
 extern int openfd(const char *path, int flag);
 
 extern UFILE *open_u(char *path);
 extern UFILE *fdopen_u(int fd, char *path);
+extern UFILE *cbopen_u(ureader_t reader, void *closure, char *name);
 extern int close_u(UFILE *f);
+extern int read_u(UFILE *f, char *q, int len);
 extern int get_one_uchar(UFILE *f, char *dst);
+extern int fill_u(UFILE *f, int n);
+extern void skip_u(UFILE *f, int n);
 extern int push_u(UFILE *f, char *d);
 extern int pop_u(UFILE *f, char *d);
+extern int seek_u(UFILE *f, long pos);
 extern int eof_u(UFILE *f);
+extern int sample_u(UFILE *f, unsigned int *cps, int max);
+extern enum input_class classify(const unsigned char *s, int len, char *reason, int rlen);
+extern void follow_u(UFILE *f, double timeout);
+extern int wait_u(UFILE *f);
 
 extern cairo_status_t write_func
 	(void *closure, const unsigned char *data, unsigned int length);
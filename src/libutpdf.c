@@ -0,0 +1,396 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cairo-pdf.h>
+
+#include "libutpdf.h"
+#include "utpdf.h"
+#include "drawing.h"
+
+// PDF (utpdf) or PostScript (utps) of the command line, and the name
+// on messages. utpdf.c sets them.
+int utpdf_makepdf=1;
+char *utpdf_prog_name="utpdf";
+
+// args_t before settling, and the values it points
+struct utpdf_options {
+    args_t args;
+    char **values;  // copies of the values of utpdf_options_set()
+    int nvalues;
+};
+
+struct utpdf_job {
+    args_t args;
+    time_t mtime;
+    int pdf;
+    job_t *job;
+    pcobj *obj;
+    utpdf_write_func write;
+    void *closure;
+    int failed;     // a write or a read failed
+    int files;
+    duplex_t duplex;
+};
+
+//
+// forward declaration
+void output_creation_date(pcobj *obj, args_t *args, int pdf);
+cairo_status_t utpdf_write(void *closure, const unsigned char *data, unsigned int length);
+int buffer_write(void *closure, const unsigned char *data, unsigned int length);
+int memory_read(void *closure, char *buf, int len);
+void settle_error(char *message);
+int settle_failed();
+//
+//
+
+//
+// errors of options, shown at the end of settling them
+
+static __thread char *settle_message; // of this thread
+
+void settle_error(char *message){
+    if (settle_message == NULL) settle_message = strdup(message);
+}
+
+// 1: an error is shown
+int settle_failed(){
+    if (settle_message == NULL){
+        return 0;
+    }
+    fprintf(stderr, "%s: %s", utpdf_prog_name, settle_message);
+    free(settle_message);
+    settle_message = NULL;
+    return 1;
+}
+
+//
+// deterministic output: every date in output is fixed to
+// $SOURCE_DATE_EPOCH, or the timestamp on the header.
+// The environment is only read here: setenv() is not safe while other
+// jobs run in threads (see fix_creation_date() of utpdf.c).
+
+time_t utpdf_creation_date(args_t *args){
+    char *epoch=getenv(SOURCE_DATE_EPOCH);
+    long long t;
+
+    if ((epoch != NULL) && (sscanf(epoch, "%lld", &t)==1)){
+        return (time_t)t;
+    }
+    return *args->mtime;
+}
+
+// the native writers and cairo's PDF take the date. cairo's PostScript
+// reads $SOURCE_DATE_EPOCH by itself.
+void output_creation_date(pcobj *obj, args_t *args, int pdf){
+    char buf[S_LEN];
+    time_t t=utpdf_creation_date(args);
+    struct tm tm;
+
+    if (obj->pdf != NULL){
+        pdfw_set_date(obj->pdf, t);
+        return;
+    }
+    if (!pdf) return;
+    strftime(buf, S_LEN, "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&t, &tm));
+    cairo_pdf_surface_set_metadata(obj->surface, CAIRO_PDF_METADATA_CREATE_DATE, buf);
+    cairo_pdf_surface_set_metadata(obj->surface, CAIRO_PDF_METADATA_MOD_DATE, buf);
+}
+
+// the output document. PostScript has the DSC of duplex and
+// orientation, and duplex keeps the state of --force-duplex.
+// NULL: failed (shown on stderr)
+pcobj *utpdf_output_new(args_t *args, int pdf, cairo_write_func_t write,
+                        void *closure, duplex_t *duplex){
+    pcobj *obj;
+
+    if (pdf) {
+        pcobj *(*pdf_new)(cairo_write_func_t, int *, double, double)
+            = args->native ? pcobj_pdf_native_new : pcobj_pdf_new;
+        pdfopt_t *opt=NULL;
+
+        if (args->optimize || args->linearize){
+            // rewritten when the document is finished
+            if ((opt = pdfopt_new(write, closure, args->compress_level,
+                                  args->linearize)) == NULL){
+                return NULL;
+            }
+            write = pdfopt_write;
+            closure = opt;
+        }
+        obj = pdf_new(write, closure, args->pwidth, args->pheight);
+        obj->opt = opt;
+        if (args->deterministic){
+            output_creation_date(obj, args, pdf);
+        }
+        return obj;
+    }
+    // PostScript
+    // the native writer writes every page as soon as it is finished.
+    {
+        pcobj *(*ps_new)(cairo_write_func_t, int *, double, double)
+            = args->native ? pcobj_ps_native_new
+            : args->stream ? pcobj_ps_stream_new : pcobj_ps_new;
+
+        if (args->duplex) {
+            if (args->force_duplex){
+                memset(duplex, 0, sizeof(duplex_t));
+                duplex->write = write;
+                duplex->closure = closure;
+                obj = ps_new((cairo_write_func_t )write_ps_duplex, (int *)duplex,
+                             args->phys_width, args->phys_height);
+            } else {
+                obj = ps_new(write, closure, args->phys_width, args->phys_height);
+            }
+            pcobj_dsc_comment(obj, "%%Requirements: duplex");
+            pcobj_dsc_begin_setup(obj);
+            pcobj_dsc_comment(obj, "%%IncludeFeature: *Duplex DuplexNoTumble");
+        } else {
+            // simplex printing
+            obj = ps_new(write, closure, args->pwidth, args->pheight);
+        }
+        // set orientation
+        if (args->portrait) {
+            pcobj_page_dsc(obj, "%%PageOrientation: Portrait");
+        } else {
+            pcobj_page_dsc(obj, "%%PageOrientation: Landscape");
+        }
+        if (args->deterministic){
+            output_creation_date(obj, args, pdf);
+        }
+    }
+    return obj;
+}
+
+// --tee and --png: every page is laid out once, and goes to out, to
+// the other format written by write(closure), and to PNG.
+// NULL: failed (shown on stderr), and out is freed.
+pcobj *utpdf_fanout_new(args_t *args, int pdf, pcobj *out, cairo_write_func_t write,
+                        void *closure, duplex_t *duplex){
+    pcobj *obj=pcobj_fanout_new(args->pwidth, args->pheight);
+
+    pcobj_add_sink(obj, out, args->rotate_right, args->upside_down_page);
+    if (args->tee != NULL){
+        args_t other=*args;
+        pcobj *tee;
+
+        settle_message = NULL;
+        args_paper(&other, !pdf, settle_error);
+        if (settle_failed()){
+            pcobj_free(obj);
+            return NULL;
+        }
+        other.stream = 0;
+        if ((tee = utpdf_output_new(&other, !pdf, write, closure, duplex)) == NULL){
+            pcobj_free(obj);
+            return NULL;
+        }
+        pcobj_add_sink(obj, tee, other.rotate_right, other.upside_down_page);
+    }
+    if (args->png != NULL){
+        obj->raster = raster_new(args->png, args->dpi, args->pwidth, args->pheight);
+    }
+    return obj;
+}
+
+//
+// jobs of the library
+
+utpdf_options *utpdf_options_new(void){
+    utpdf_options *opt=calloc(1, sizeof(utpdf_options));
+
+    if (opt != NULL) opt->args = args_default;
+    return opt;
+}
+
+// name is a long option (or a key of the config file), and value its
+// argument. -1 at a wrong option, shown on stderr.
+int utpdf_options_set(utpdf_options *opt, const char *name, const char *value){
+    char *copy=NULL, **values;
+
+    if (value != NULL){
+        // args_t keeps the pointers of strings
+        if ((values = realloc(opt->values, (opt->nvalues+1)*sizeof(char *))) == NULL){
+            perror(utpdf_prog_name);
+            return -1;
+        }
+        opt->values = values;
+        if ((copy = strdup(value)) == NULL){
+            perror(utpdf_prog_name);
+            return -1;
+        }
+        opt->values[opt->nvalues++] = copy;
+    }
+    settle_message = NULL;
+    args_set(&opt->args, name, copy, settle_error);
+    return settle_failed() ? -1 : 0;
+}
+
+void utpdf_options_free(utpdf_options *opt){
+    int i;
+
+    if (opt == NULL) return;
+    for (i=0; i<opt->nvalues; i++) free(opt->values[i]);
+    free(opt->values);
+    free(opt);
+}
+
+cairo_status_t utpdf_write(void *closure, const unsigned char *data, unsigned int length){
+    utpdf_job *j=closure;
+
+    if (j->failed || (j->write(j->closure, data, length) != (int)length)){
+        j->failed = 1;
+        return CAIRO_STATUS_WRITE_ERROR;
+    }
+    return CAIRO_STATUS_SUCCESS;
+}
+
+// NULL at a wrong option, or when the output can not be made, which is
+// shown on stderr.
+utpdf_job *utpdf_job_new(const utpdf_options *opt, int pdf,
+                         utpdf_write_func write, void *closure){
+    utpdf_job *j=calloc(1, sizeof(utpdf_job));
+
+    j->args = opt->args;
+    j->args.mtime = &j->mtime;
+    j->args.one_output = 1;
+    j->pdf = pdf;
+    time(&j->mtime);
+    settle_message = NULL;
+    args_settle(&j->args, pdf, settle_error);
+    if (j->args.deterministic && !pdf && !j->args.native
+        && (getenv(SOURCE_DATE_EPOCH) == NULL)){
+        settle_error("deterministic PostScript of the cairo backend needs $"
+                     SOURCE_DATE_EPOCH "\n");
+    }
+    if (settle_failed()){
+        free(j);
+        return NULL;
+    }
+    j->write = write;
+    j->closure = closure;
+    if ((j->obj = utpdf_output_new(&j->args, pdf, utpdf_write, j, &j->duplex)) == NULL){
+        free(j);
+        return NULL;
+    }
+    j->job = job_new(&j->args);
+    pcobj_count_content(j->obj, &j->job->output);
+    return j;
+}
+
+int buffer_write(void *closure, const unsigned char *data, unsigned int length){
+    utpdf_buffer *b=closure;
+
+    if (b->len + length > b->size){
+        size_t size=(b->size > 0) ? b->size : 65536;
+        unsigned char *p;
+
+        while (b->len + length > size) size *= 2;
+        if ((p = realloc(b->data, size)) == NULL) return -1;
+        b->data = p;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, length);
+    b->len += length;
+    return length;
+}
+
+utpdf_job *utpdf_job_new_buffer(const utpdf_options *opt, int pdf, utpdf_buffer *out){
+    return utpdf_job_new(opt, pdf, buffer_write, out);
+}
+
+// a file of the document, which starts on a new page.
+int utpdf_add_reader(utpdf_job *j, const char *name,
+                     utpdf_read_func read, void *closure){
+    UFILE *in_f=cbopen_u(read, closure, (char *)name);
+
+    in_f->stats = &j->job->input;
+    j->args.in_fname = (char *)name;
+    time(&j->mtime);
+    if (j->args.deterministic){
+        // no file timestamp: the header has the date of output too
+        j->mtime = utpdf_creation_date(&j->args);
+    }
+    if ((j->files > 0) && !j->args.twocols){
+        pcobj_show_page(j->obj);
+        if (j->args.upside_down_page) {
+            pcobj_upside_down(j->obj);
+        }
+    }
+    pcobj_set_rgb(j->obj, C_BLACK);
+    draw_file(j->job, j->obj, in_f, 1, NULL);
+    if (in_f->error){
+        j->failed = 1;
+    }
+    close_u(in_f);
+    j->files++;
+    return j->failed ? -1 : 0;
+}
+
+typedef struct memory_input {
+    const char *data;
+    size_t len, pos;
+} meminput_t;
+
+int memory_read(void *closure, char *buf, int len){
+    meminput_t *m=closure;
+    size_t n=m->len - m->pos;
+
+    if (n > (size_t)len) n = len;
+    memcpy(buf, m->data + m->pos, n);
+    m->pos += n;
+    return (int)n;
+}
+
+int utpdf_add_memory(utpdf_job *j, const char *name, const char *data, size_t len){
+    meminput_t m={data, len, 0};
+
+    return utpdf_add_reader(j, name, memory_read, &m);
+}
+
+// the rest of output is written, and the job is freed.
+int utpdf_finish(utpdf_job *j){
+    return utpdf_finish_stats(j, NULL);
+}
+
+// utpdf_finish(), and the counters of the job are added to stats.
+// Each thread keeps its own stats, and sums them after the jobs.
+int utpdf_finish_stats(utpdf_job *j, utpdf_stats *stats){
+    int failed;
+
+    failed = (pcobj_free(j->obj) < 0) || j->failed;
+    if (stats != NULL){
+        stats->content_ops += j->job->output.ops;
+        stats->content_bytes += j->job->output.bytes;
+    }
+    job_free(j->job);
+    free(j);
+    return failed ? -1 : 0;
+}
+
+void utpdf_buffer_free(utpdf_buffer *buf){
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->size = 0;
+}
+
+// end of libutpdf.c
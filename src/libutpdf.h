@@ -0,0 +1,101 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __LIBUTPDF_H__
+#define __LIBUTPDF_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  libutpdf: the converter in a process, without files.
+
+    utpdf_options *opt=utpdf_options_new();
+    utpdf_buffer out={0};
+    utpdf_job *job;
+
+    utpdf_options_set(opt, "number", NULL);       // as --number
+    job = utpdf_job_new_buffer(opt, 1, &out);     // 1: PDF, 0: PostScript
+    utpdf_add_memory(job, "log.txt", text, len);  // a file of the document
+    utpdf_finish(job);                            // out.data[0..out.len)
+    utpdf_buffer_free(&out);
+    utpdf_options_free(opt);
+
+  Options are the long options of the command line (keys of the
+  config file), which is not read. Lengths are in mm (or inch after
+  "inch"), and unset ones are settled by utpdf_job_new(). Free the
+  options after the jobs made of them. Every input goes to one output.
+  Jobs may run in threads at the same time.
+
+  Errors are shown on stderr, and never exit the process:
+  utpdf_options_new() and utpdf_job_new() return NULL, and
+  utpdf_options_set() returns -1 at a wrong option. utpdf_add_*() and
+  utpdf_finish() return -1 when the input could not be read or the
+  output failed.
+
+  With "deterministic", every date in output (and on the header) is
+  $SOURCE_DATE_EPOCH if it is set. The library never sets it: set it
+  before jobs start, as PostScript of the cairo backend needs it.
+*/
+
+typedef struct utpdf_options utpdf_options;
+typedef struct utpdf_job utpdf_job;
+
+// returns the bytes written (== len), or -1
+typedef int (*utpdf_write_func)(void *closure, const unsigned char *data, unsigned int len);
+// reads up to len bytes, 0 at end of input, or -1
+typedef int (*utpdf_read_func)(void *closure, char *buf, int len);
+
+// counters of jobs (--stats of the command line)
+typedef struct utpdf_stats {
+    long content_ops;    // operators of page content (native backend)
+    long content_bytes;  // bytes of page content (native backend)
+} utpdf_stats;
+
+// growable output in memory
+typedef struct utpdf_buffer {
+    unsigned char *data;
+    size_t len, size;
+} utpdf_buffer;
+
+extern utpdf_options *utpdf_options_new(void);
+extern int utpdf_options_set(utpdf_options *opt, const char *name, const char *value);
+extern void utpdf_options_free(utpdf_options *opt);
+extern utpdf_job *utpdf_job_new(const utpdf_options *opt, int pdf,
+                                utpdf_write_func write, void *closure);
+extern utpdf_job *utpdf_job_new_buffer(const utpdf_options *opt, int pdf,
+                                       utpdf_buffer *out);
+extern int utpdf_add_memory(utpdf_job *job, const char *name,
+                            const char *data, size_t len);
+extern int utpdf_add_reader(utpdf_job *job, const char *name,
+                            utpdf_read_func read, void *closure);
+extern int utpdf_finish(utpdf_job *job);
+extern int utpdf_finish_stats(utpdf_job *job, utpdf_stats *stats);
+extern void utpdf_buffer_free(utpdf_buffer *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// end of libutpdf.h
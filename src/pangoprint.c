@@ -20,22 +20,37 @@
 #include "pangoprint.h"
 #include <math.h>
 
+//
+// forward declaration
+void pcobj_new_cr(pcobj *obj);
+void pcobj_fanout_page(pcobj *obj);
+//
+//
+
 pcobj *pcobj_setup(pcobj *obj, double width, double height){
-    obj->cr = cairo_create(obj->surface);
     obj->desc = pango_font_description_new();    
-    obj->layout = pango_cairo_create_layout (obj->cr);
+    if (obj->pdf == NULL){
+        obj->cr = cairo_create(obj->surface);
+        obj->layout = pango_cairo_create_layout (obj->cr);
+    } else {
+        obj->cr = NULL;
+        obj->layout = pango_layout_new(obj->context);
+    }
 
     obj->phys_width = width;
     obj->phys_height = height;
     obj->l_width = width;
     obj->l_height = height;
     obj->axis = d_up;
+    obj->stream = NULL;
+    obj->page_dsc = NULL;
+    obj->shaping = ic_complex;
     return obj;
 }
 
 pcobj *pcobj_pdf_new(cairo_write_func_t write_func, int *out_fd,
                      double width, double height){
-    pcobj *obj = malloc(sizeof(pcobj));    
+    pcobj *obj = calloc(1, sizeof(pcobj));
     obj->surface = cairo_pdf_surface_create_for_stream
         ((cairo_write_func_t )write_func, (void *)out_fd,
          width, height);
@@ -44,19 +59,286 @@ pcobj *pcobj_pdf_new(cairo_write_func_t write_func, int *out_fd,
 
 pcobj *pcobj_ps_new(cairo_write_func_t write_func, int *out_fd,
                     double width, double height){
-    pcobj *obj = malloc(sizeof(pcobj));    
+    pcobj *obj = calloc(1, sizeof(pcobj));
     obj->surface = cairo_ps_surface_create_for_stream
         ((cairo_write_func_t )write_func, (void *)out_fd,
          width, height);
     return pcobj_setup(obj, width, height);
 }
 
-void pcobj_free(pcobj *obj){
+// one cairo document per page, joined by psstream.
+pcobj *pcobj_ps_stream_new(cairo_write_func_t write_func, int *out_fd,
+                           double width, double height){
+    pcobj *obj = calloc(1, sizeof(pcobj));
+    psstream_t *st = psstream_new(write_func, (void *)out_fd);
+
+    obj->surface = cairo_ps_surface_create_for_stream
+        ((cairo_write_func_t )psstream_write, (void *)st,
+         width, height);
+    pcobj_setup(obj, width, height);
+    obj->stream = st;
+    return obj;
+}
+
+// the layout is shaped without cairo_t, for the native writers.
+pcobj *pcobj_native_setup(pcobj *obj, double width, double height){
+    cairo_font_options_t *options = cairo_font_options_create();
+
+    obj->context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+    // unhinted metrics, as cairo's vector surfaces
+    cairo_font_options_set_hint_style(options, CAIRO_HINT_STYLE_NONE);
+    cairo_font_options_set_hint_metrics(options, CAIRO_HINT_METRICS_OFF);
+    pango_cairo_context_set_font_options(obj->context, options);
+    cairo_font_options_destroy(options);
+    return pcobj_setup(obj, width, height);
+}
+
+// native PDF writer
+pcobj *pcobj_pdf_native_new(cairo_write_func_t write_func, int *out_fd,
+                            double width, double height){
+    pcobj *obj = calloc(1, sizeof(pcobj));
+
+    obj->pdf = pdfw_new(write_func, (void *)out_fd, width, height);
+    return pcobj_native_setup(obj, width, height);
+}
+
+// native PostScript writer, which writes every page as soon as it is finished.
+pcobj *pcobj_ps_native_new(cairo_write_func_t write_func, int *out_fd,
+                           double width, double height){
+    pcobj *obj = calloc(1, sizeof(pcobj));
+
+    obj->pdf = psw_new(write_func, (void *)out_fd, width, height);
+    return pcobj_native_setup(obj, width, height);
+}
+
+// one layout for several outputs. Every page is recorded in logical
+// space once, and painted on each sink in the direction of the sink.
+pcobj *pcobj_fanout_new(double width, double height){
+    pcobj *obj = calloc(1, sizeof(pcobj));
+    cairo_rectangle_t extents={0, 0, width, height};
+
+    obj->surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    return pcobj_setup(obj, width, height);
+}
+
+// sink: a cairo output, freed with obj. It keeps its own direction.
+void pcobj_add_sink(pcobj *obj, pcobj *sink, int rotate_right, int upside_down_page){
+    obj->sinks = realloc(obj->sinks, (obj->nsinks+1)*sizeof(pcsink_t));
+    obj->sinks[obj->nsinks].obj = sink;
+    obj->sinks[obj->nsinks].upside_down_page = upside_down_page;
+    obj->nsinks++;
+    if (rotate_right){
+        pcobj_turn_right(sink);
+    }
+}
+
+// cairo_t and the layout on a new obj->surface
+void pcobj_new_cr(pcobj *obj){
+    obj->cr = cairo_create(obj->surface);
+    obj->layout = pango_cairo_create_layout(obj->cr);
+    pango_layout_set_font_description(obj->layout, obj->desc);
+    pango_layout_set_tabs(obj->layout, obj->tabs);
+}
+
+// paint the recorded page on every sink
+void pcobj_fanout_page(pcobj *obj){
+    int i;
+
+    for (i=0; i<obj->nsinks; i++){
+        cairo_t *cr=obj->sinks[i].obj->cr;
+
+        cairo_save(cr);
+        cairo_set_source_surface(cr, obj->surface, 0, 0);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+}
+
+// the rest is written, and obj is freed. -1: the output failed
+int pcobj_free(pcobj *obj){
+    cairo_status_t status=CAIRO_STATUS_SUCCESS;
+    int i, failed=0;
+
+    pcobj_flush(obj);
+    if (obj->sinks != NULL){
+        // the last page is emitted by the sinks, as cairo does, unless
+        // it is the empty one after pcobj_show_page().
+        if (!obj->fresh) pcobj_fanout_page(obj);
+        for (i=0; i<obj->nsinks; i++){
+            failed |= (pcobj_free(obj->sinks[i].obj) < 0);
+        }
+        free(obj->sinks);
+    }
+    for (i=0; i<obj->balloc; i++){
+        free(obj->batch[i].paths);
+    }
+    free(obj->batch);
+    if (obj->cover != NULL){
+        for (i=0; i<PCCOVER_SIZE; i++){
+            if (obj->cover[i].font != NULL) g_object_unref(obj->cover[i].font);
+        }
+        free(obj->cover);
+    }
+    for (i=0; i<PCOBJ_FORMS; i++){
+        if (obj->forms[i].pattern != NULL) cairo_pattern_destroy(obj->forms[i].pattern);
+    }
     pango_font_description_free(obj->desc);
+    if (obj->tabs != NULL) pango_tab_array_free(obj->tabs);
     g_object_unref(obj->layout);
+    if (obj->pdf != NULL){
+        if (obj->pdf->ps){
+            status = psw_finish(obj->pdf);
+        } else {
+            status = pdfw_finish(obj->pdf);
+        }
+        g_object_unref(obj->context);
+        if ((obj->opt != NULL) && (pdfopt_close(obj->opt) != CAIRO_STATUS_SUCCESS)) failed = 1;
+        free(obj);
+        return (failed || (status != CAIRO_STATUS_SUCCESS)) ? -1 : 0;
+    }
     cairo_destroy(obj->cr);
+    if (obj->raster != NULL){
+        if (!obj->fresh) raster_page(obj->raster, obj->surface);
+        failed |= (raster_finish(obj->raster) < 0);
+    }
+    if ((obj->stream != NULL) && obj->stream->fresh && (obj->stream->pages > 0)){
+        // nothing drawn after the last page: cairo would emit a blank page.
+        obj->stream->discard = 1;
+    }
+    if (obj->nsinks == 0){
+        // the document is written out here, not a recorded page
+        cairo_surface_finish(obj->surface);
+        status = cairo_surface_status(obj->surface);
+    }
     cairo_surface_destroy(obj->surface);
+    if (obj->stream != NULL){
+        psstream_next(obj->stream);
+        if (psstream_close(obj->stream) != CAIRO_STATUS_SUCCESS) failed = 1;
+    }
+    if ((obj->opt != NULL) && (pdfopt_close(obj->opt) != CAIRO_STATUS_SUCCESS)) failed = 1;
     free(obj);
+    return (failed || (status != CAIRO_STATUS_SUCCESS)) ? -1 : 0;
+}
+
+// pages of a previous output, copied by the native PDF writer.
+// returns the pages copied: npages, or 0.
+int pcobj_copy_pages(pcobj *obj, const char *buf, size_t len, int npages){
+    if ((obj->pdf == NULL) || obj->pdf->ps){
+        return 0;
+    }
+    return pdfw_copy_pages(obj->pdf, buf, len, npages);
+}
+
+// --stats: page content of the native writers is counted in stats,
+// also in the sinks.
+void pcobj_count_content(pcobj *obj, pdfw_stats_t *stats){
+    int i;
+
+    for (i=0; i<obj->nsinks; i++){
+        pcobj_count_content(obj->sinks[i].obj, stats);
+    }
+    if (obj->pdf != NULL){
+        obj->pdf->stats = stats;
+    }
+}
+
+// DSC comment of page setup, repeated on every surface of streaming.
+void pcobj_page_dsc(pcobj *obj, const char *comment){
+    obj->page_dsc = comment;
+    if (obj->pdf != NULL){
+        psw_page_dsc(obj->pdf, comment);
+        return;
+    }
+    cairo_ps_surface_dsc_begin_page_setup(obj->surface);
+    cairo_ps_surface_dsc_comment(obj->surface, comment);
+}
+
+// DSC comment of header, or of setup after pcobj_dsc_begin_setup()
+void pcobj_dsc_comment(pcobj *obj, const char *comment){
+    if (obj->pdf != NULL){
+        psw_dsc_comment(obj->pdf, comment);
+    } else {
+        cairo_ps_surface_dsc_comment(obj->surface, comment);
+    }
+}
+
+void pcobj_dsc_begin_setup(pcobj *obj){
+    if (obj->pdf != NULL){
+        psw_dsc_begin_setup(obj->pdf);
+    } else {
+        cairo_ps_surface_dsc_begin_setup(obj->surface);
+    }
+}
+
+void pcobj_begin_page(pcobj *obj){
+    int i;
+
+    for (i=0; i<obj->nsinks; i++){
+        pcobj_begin_page(obj->sinks[i].obj);
+    }
+    obj->fresh = 0;
+    if (obj->stream != NULL){
+        obj->stream->fresh = 0;
+    }
+}
+
+// finish the page. in streaming, the page is written out here,
+// and obj->cr is replaced with a new one.
+void pcobj_show_page(pcobj *obj){
+    pcobj_flush(obj);
+    if (obj->pdf != NULL){
+        if (obj->pdf->ps){
+            psw_show_page(obj->pdf);
+        } else {
+            pdfw_show_page(obj->pdf);
+        }
+        return;
+    }
+    if (obj->sinks != NULL){
+        int i;
+
+        pcobj_fanout_page(obj);
+        for (i=0; i<obj->nsinks; i++){
+            pcobj_show_page(obj->sinks[i].obj);
+            if (obj->sinks[i].upside_down_page){
+                pcobj_upside_down(obj->sinks[i].obj);
+            }
+        }
+        // a recording surface per page
+        g_object_unref(obj->layout);
+        cairo_destroy(obj->cr);
+        if (obj->raster != NULL){
+            raster_page(obj->raster, obj->surface);
+        }
+        cairo_surface_destroy(obj->surface);
+        {
+            cairo_rectangle_t extents={0, 0, obj->phys_width, obj->phys_height};
+
+            obj->surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+        }
+        pcobj_new_cr(obj);
+        obj->fresh = 1;
+        return;
+    }
+    cairo_show_page(obj->cr);
+    if (obj->stream == NULL){
+        return;
+    }
+    g_object_unref(obj->layout);
+    cairo_destroy(obj->cr);
+    cairo_surface_destroy(obj->surface); // finish: one page document
+    psstream_next(obj->stream);
+
+    obj->surface = cairo_ps_surface_create_for_stream
+        ((cairo_write_func_t )psstream_write, (void *)obj->stream,
+         obj->phys_width, obj->phys_height);
+    if (obj->page_dsc != NULL){
+        cairo_ps_surface_dsc_begin_page_setup(obj->surface);
+        cairo_ps_surface_dsc_comment(obj->surface, obj->page_dsc);
+    }
+    pcobj_new_cr(obj);
+    pcobj_setdir(obj, obj->axis); // cairo_show_page() keeps the matrix
+    obj->stream->fresh = 1;
 }
 
 void pcobj_setfont(pcobj *obj, char *family, double size){
@@ -76,8 +358,468 @@ void pcobj_settext(pcobj *obj, const char *str){
 }    
 
 void pcobj_print(pcobj *obj, const char *str){
-    pcobj_settext(obj, str);
-    pango_cairo_show_layout (obj->cr, obj->layout);
+    pcglyphs_t *g=pcobj_shape(obj, str, -1);
+
+    pcobj_show_glyphs(obj, g);
+    pcglyphs_free(g);
+}
+
+//
+// forms: the same drawing on many pages is recorded once in user
+// space, e.g. decorations of page. The slot is given by the caller.
+
+int pcobj_has_form(pcobj *obj, int slot){
+    return obj->forms[slot].recorded;
+}
+
+// drawing goes to the form until pcobj_form_end().
+void pcobj_form_begin(pcobj *obj){
+    double m=2*(obj->phys_width+obj->phys_height); // user space may be rotated
+    cairo_rectangle_t extents={-m, -m, 2*m, 2*m};
+    cairo_surface_t *rec;
+
+    if (obj->pdf != NULL){
+        pdfw_form_begin(obj->pdf);
+        return;
+    }
+    pcobj_flush(obj);
+    rec = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    obj->page_cr = obj->cr;
+    obj->cr = cairo_create(rec);
+    cairo_surface_destroy(rec);
+}
+
+void pcobj_form_end(pcobj *obj, int slot){
+    pcform_t *f=&obj->forms[slot];
+
+    if (obj->pdf != NULL){
+        f->id = pdfw_form_end(obj->pdf);
+    } else {
+        pcobj_flush(obj);
+        f->pattern = cairo_pattern_create_for_surface(cairo_get_target(obj->cr));
+        cairo_destroy(obj->cr);
+        obj->cr = obj->page_cr;
+        obj->page_cr = NULL;
+        pcobj_update_layout(obj); // the layout may follow the form
+    }
+    f->recorded = 1;
+}
+
+// cairo's PDF/PostScript surface writes the pattern once, too.
+void pcobj_paint_form(pcobj *obj, int slot){
+    pcform_t *f=&obj->forms[slot];
+
+    if (obj->pdf != NULL){
+        pdfw_paint_form(obj->pdf, f->id);
+    } else {
+        pcobj_flush(obj);
+        cairo_save(obj->cr);
+        cairo_set_source(obj->cr, f->pattern);
+        cairo_paint(obj->cr);
+        cairo_restore(obj->cr);
+    }
+}
+
+//
+// glyphs: one line of text shaped without PangoLayout.
+// PangoLayout is kept only for the watermark.
+
+// tab stops at every <tab> width of "M" of the current font.
+// pango repeats the interval of the last tab stop.
+void pcobj_set_tabs(pcobj *obj, int tab){
+    if (obj->tabs != NULL) pango_tab_array_free(obj->tabs);
+    obj->tabs = pango_tab_array_new(1, FALSE);
+    pango_tab_array_set_tab(obj->tabs, 0, PANGO_TAB_LEFT,
+                            (gint)(pcobj_text_width(obj, "M")*tab*PANGO_SCALE));
+    pango_layout_set_tabs(obj->layout, obj->tabs);
+}
+
+//
+// coverage map: the fontset is searched for a code point only at the
+// first sight, and runs are split by the map. pango itemizes with
+// the first font only.
+
+// the font is owned by the map.
+PangoFont *pcobj_cover_font(pcobj *obj, guint desc, gunichar cp){
+    PangoContext *ctx=pango_layout_get_context(obj->layout);
+    PangoFontset *fontset;
+    pccover_t *e=NULL;
+    guint h=(desc ^ (cp*2654435761u)) & (PCCOVER_SIZE-1);
+    int i;
+
+    if (obj->cover == NULL){
+        obj->cover = calloc(PCCOVER_SIZE, sizeof(pccover_t));
+    }
+    for (i=0; i<PCCOVER_PROBE; i++){
+        e = &obj->cover[(h+i) & (PCCOVER_SIZE-1)];
+        if (e->font == NULL) break;
+        if ((e->desc == desc) && (e->cp == cp)) return e->font;
+    }
+    if (i == PCCOVER_PROBE){
+        // crowded: the first entry is replaced.
+        e = &obj->cover[h];
+        g_object_unref(e->font);
+    }
+    fontset = pango_context_load_fontset(ctx, obj->desc, pango_context_get_language(ctx));
+    e->desc = desc;
+    e->cp = cp;
+    e->font = pango_fontset_get_font(fontset, cp);
+    g_object_unref(fontset);
+    return e->font;
+}
+
+// in the current font description
+void pcobj_cover_warm(pcobj *obj, const unsigned int *cps, int n){
+    guint desc=pango_font_description_hash(obj->desc);
+    int i;
+
+    for (i=0; i<n; i++){
+        pcobj_cover_font(obj, desc, cps[i]);
+    }
+}
+
+void pcitem_set_font(PangoItem *item, PangoFont *font){
+    if (item->analysis.font == font) return;
+    if (item->analysis.font != NULL) g_object_unref(item->analysis.font);
+    item->analysis.font = g_object_ref(font);
+}
+
+// items (logical order) are split where the font changes.
+// spaces and marks follow the font before them, if it has them.
+GList *pcobj_split_fonts(pcobj *obj, const char *text, GList *items){
+    guint desc=pango_font_description_hash(obj->desc);
+    GList *l;
+
+    for (l=items; l != NULL; l=l->next){
+        PangoItem *item=l->data;
+        const char *top=text + item->offset, *p=top;
+        PangoFont *font=NULL, *f;
+        int nchars=0;
+
+        for (; p < top + item->length; p=g_utf8_next_char(p), nchars++){
+            gunichar cp=g_utf8_get_char(p);
+
+            if ((font != NULL)
+                && (g_unichar_ismark(cp) || (g_unichar_type(cp) == G_UNICODE_SPACE_SEPARATOR))
+                && pango_font_has_char(font, cp)){
+                continue;
+            }
+            f = pcobj_cover_font(obj, desc, cp);
+            if (font == NULL){
+                font = f;
+            } else if (f != font){
+                // the head keeps font, and the rest is the next item.
+                l->data = pango_item_split(item, p - top, nchars);
+                pcitem_set_font(l->data, font);
+                items = g_list_insert_before(items, l->next, item);
+                break;
+            }
+        }
+        if (p >= top + item->length){
+            pcitem_set_font(item, font);
+        }
+    }
+    return items;
+}
+
+// the class of text, which is shaped next. see classify() of io.c.
+void pcobj_set_shaping(pcobj *obj, enum input_class cls){
+    obj->shaping = cls;
+}
+
+// fast path of itemization, for text without bidi, combining nor
+// joining: items are split by the font and the script only.
+// ic_ascii: the script is Latin.
+GList *pcobj_itemize_simple(pcobj *obj, const char *text, int len){
+    PangoLanguage *lang=pango_context_get_language(pango_layout_get_context(obj->layout));
+    guint desc=pango_font_description_hash(obj->desc);
+    GList *items=NULL;
+    PangoItem *item=NULL;
+    const char *p;
+    int nchars=0;
+
+    for (p=text; p < text+len; p=g_utf8_next_char(p)){
+        gunichar cp=g_utf8_get_char(p);
+        PangoScript script=PANGO_SCRIPT_LATIN;
+        PangoFont *font;
+
+        if (obj->shaping != ic_ascii) script = (PangoScript)g_unichar_get_script(cp);
+        if ((item != NULL) && (g_unichar_type(cp) == G_UNICODE_SPACE_SEPARATOR)
+            && pango_font_has_char(item->analysis.font, cp)){
+            font = item->analysis.font;
+        } else {
+            font = pcobj_cover_font(obj, desc, cp);
+        }
+        if ((item != NULL) && (font == item->analysis.font)){
+            if ((script == PANGO_SCRIPT_COMMON) || (script == PANGO_SCRIPT_INHERITED)){
+                script = item->analysis.script;
+            } else if (item->analysis.script == PANGO_SCRIPT_COMMON){
+                item->analysis.script = script;
+            }
+        }
+        if ((item == NULL) || (font != item->analysis.font) || (script != item->analysis.script)){
+            if (item != NULL){
+                item->length = p - text - item->offset;
+                item->num_chars = nchars;
+                items = g_list_prepend(items, item);
+            }
+            item = pango_item_new();
+            item->offset = p - text;
+            item->analysis.font = g_object_ref(font);
+            item->analysis.script = script;
+            item->analysis.language = lang;
+            item->analysis.gravity = PANGO_GRAVITY_SOUTH;
+            item->analysis.level = 0; // left to right
+            nchars = 0;
+        }
+        nchars++;
+    }
+    if (item != NULL){
+        item->length = p - text - item->offset;
+        item->num_chars = nchars;
+        items = g_list_prepend(items, item);
+    }
+    return g_list_reverse(items);
+}
+
+// a tab glyph is widened to the next tab stop. x0 is the position of
+// text from the origin of tab stops.
+void pcglyphs_expand_tabs(pcglyphs_t *g, PangoTabArray *tabs, double x0){
+    PangoTabAlign align;
+    gint stop;
+    double tabw, pen=x0;
+    int i, j;
+
+    pango_tab_array_get_tab(tabs, 0, &align, &stop);
+    tabw = (double)stop/PANGO_SCALE;
+    if (tabw <= 0) return;
+    g->width = 0;
+    for (i=0; i<g->nruns; i++){
+        PangoGlyphItem *run=&g->runs[i];
+
+        for (j=0; j<run->glyphs->num_glyphs; j++){
+            PangoGlyphInfo *gi=&run->glyphs->glyphs[j];
+
+            if (g->text[run->item->offset + run->glyphs->log_clusters[j]] == '\t'){
+                gi->glyph = PANGO_GLYPH_EMPTY;
+                gi->geometry.width
+                    = (int)((tabw*(floor(pen/tabw)+1) - pen)*PANGO_SCALE);
+            }
+            pen += (double)gi->geometry.width/PANGO_SCALE;
+        }
+        g->width += (double)pango_glyph_string_get_width(run->glyphs)/PANGO_SCALE;
+    }
+}
+
+// len<0: whole str
+pcglyphs_t *pcobj_shape(pcobj *obj, const char *str, int len){
+    return pcobj_shape_at(obj, str, len, 0);
+}
+
+pcglyphs_t *pcobj_shape_at(pcobj *obj, const char *str, int len, double x0){
+    pcglyphs_t *g=calloc(1, sizeof(pcglyphs_t));
+    GList *items, *visual, *l;
+    int i;
+
+    if (len < 0) len = strlen(str);
+    g->len = len;
+    g->text = malloc(len+1);
+    memcpy(g->text, str, len);
+    g->text[len] = '\0';
+
+    if (obj->shaping == ic_complex){
+        PangoAttrList *attrs=pango_attr_list_new();
+
+        // itemized as obj->layout, but fonts are from the coverage map
+        pango_attr_list_insert(attrs, pango_attr_font_desc_new(obj->desc));
+        pango_attr_list_insert(attrs, pango_attr_fallback_new(FALSE));
+        items = pango_itemize(pango_layout_get_context(obj->layout), g->text, 0, len,
+                              attrs, NULL);
+        items = pcobj_split_fonts(obj, g->text, items);
+        visual = pango_reorder_items(items);
+        g_list_free(items);
+        pango_attr_list_unref(attrs);
+    } else {
+        visual = pcobj_itemize_simple(obj, g->text, len); // left to right
+    }
+
+    g->nruns = g_list_length(visual);
+    g->runs = calloc(g->nruns, sizeof(PangoGlyphItem));
+    for (l=visual, i=0; l != NULL; l=l->next, i++){
+        PangoItem *item=l->data;
+        PangoRectangle logical;
+
+        g->runs[i].item = item;
+        g->runs[i].glyphs = pango_glyph_string_new();
+        pango_shape_full(g->text + item->offset, item->length, g->text, len,
+                         &item->analysis, g->runs[i].glyphs);
+        pango_glyph_string_extents(g->runs[i].glyphs, item->analysis.font, NULL, &logical);
+        g->width += (double)logical.width/PANGO_SCALE;
+        // baseline of the line, as PangoLayout
+        if (g->ascent < (double)-logical.y/PANGO_SCALE){
+            g->ascent = (double)-logical.y/PANGO_SCALE;
+        }
+    }
+    g_list_free(visual);
+    if ((obj->tabs != NULL) && (memchr(g->text, '\t', len) != NULL)){
+        pcglyphs_expand_tabs(g, obj->tabs, x0);
+    }
+    return g;
+}
+
+// show glyphs at the current point, which is the top of line.
+void pcobj_show_glyphs(pcobj *obj, pcglyphs_t *g){
+    double x, y, pen=0;
+    int i;
+
+    if (obj->pdf != NULL){
+        pdfw_get_current_point(obj->pdf, &x, &y);
+    } else {
+        cairo_get_current_point(obj->cr, &x, &y);
+    }
+    for (i=0; i<g->nruns; i++){
+        PangoGlyphItem *run=&g->runs[i];
+
+        if (obj->pdf != NULL){
+            pdfw_glyphs(obj->pdf, run->item->analysis.font, run->glyphs,
+                        g->text + run->item->offset, x+pen, y+g->ascent);
+        } else {
+            cairo_move_to(obj->cr, x+pen, y+g->ascent);
+            pango_cairo_show_glyph_string(obj->cr, run->item->analysis.font, run->glyphs);
+        }
+        pen += (double)pango_glyph_string_get_width(run->glyphs)/PANGO_SCALE;
+    }
+    if (obj->pdf == NULL){
+        cairo_move_to(obj->cr, x, y); // as pango_cairo_show_layout()
+    }
+}
+
+// bytes of the longest head of text, which is not wider than avail.
+// the width is summed up per cluster, and a cluster is not divided.
+// a tab jumps only to a stop before avail, otherwise it overflows.
+int pcobj_fold(pcglyphs_t *g, double avail){
+    double *w=calloc(g->len+1, sizeof(double)), sum=0;
+    int i, j, fold=g->len;
+
+    for (i=0; i<g->nruns; i++){
+        PangoGlyphItem *run=&g->runs[i];
+
+        for (j=0; j<run->glyphs->num_glyphs; j++){
+            w[run->item->offset + run->glyphs->log_clusters[j]]
+                += (double)run->glyphs->glyphs[j].geometry.width/PANGO_SCALE;
+        }
+    }
+    for (i=0; i<g->len; i++){
+        sum += w[i];
+        // the width of tab is rounded down to pango units.
+        if ((sum > avail) || ((g->text[i] == '\t') && (sum+1.0/PANGO_SCALE > avail))){
+            // back to the top of character
+            while ((i > 0) && ((g->text[i] & 0xC0) == 0x80)) i--;
+            fold = i;
+            break;
+        }
+    }
+    free(w);
+    return fold;
+}
+
+// glyphs of the parts in a row, e.g. digits of a number, without
+// shaping again. The runs of the same font are joined.
+pcglyphs_t *pcglyphs_concat(pcglyphs_t **parts, int n){
+    pcglyphs_t *g=calloc(1, sizeof(pcglyphs_t));
+    int i, j, k, nruns=0;
+
+    for (i=0; i<n; i++){
+        g->len += parts[i]->len;
+        nruns += parts[i]->nruns;
+    }
+    g->text = malloc(g->len+1);
+    g->runs = calloc(nruns, sizeof(PangoGlyphItem));
+    g->len = 0;
+    for (i=0; i<n; i++){
+        pcglyphs_t *p=parts[i];
+
+        for (j=0; j<p->nruns; j++){
+            PangoGlyphItem *src=&p->runs[j];
+            PangoGlyphItem *run=(g->nruns > 0) ? &g->runs[g->nruns-1] : NULL;
+            int offset=g->len + src->item->offset, base;
+
+            if ((run != NULL) && (run->item->analysis.font == src->item->analysis.font)
+                && (run->item->analysis.level % 2 == 0)
+                && (src->item->analysis.level == run->item->analysis.level)
+                && (run->item->offset + run->item->length == offset)){
+                // continue the run
+                base = run->glyphs->num_glyphs;
+                run->item->length += src->item->length;
+                run->item->num_chars += src->item->num_chars;
+            } else {
+                run = &g->runs[g->nruns++];
+                run->item = pango_item_copy(src->item);
+                run->item->offset = offset;
+                run->glyphs = pango_glyph_string_new();
+                base = 0;
+            }
+            pango_glyph_string_set_size(run->glyphs, base + src->glyphs->num_glyphs);
+            for (k=0; k<src->glyphs->num_glyphs; k++){
+                run->glyphs->glyphs[base+k] = src->glyphs->glyphs[k];
+                run->glyphs->log_clusters[base+k]
+                    = src->glyphs->log_clusters[k] + offset - run->item->offset;
+            }
+        }
+        memcpy(g->text + g->len, p->text, p->len);
+        g->len += p->len;
+        g->width += p->width;
+        if (g->ascent < p->ascent) g->ascent = p->ascent;
+    }
+    g->text[g->len] = '\0';
+    return g;
+}
+
+void pcglyphs_free(pcglyphs_t *g){
+    int i;
+
+    for (i=0; i<g->nruns; i++){
+        pango_item_free(g->runs[i].item);
+        pango_glyph_string_free(g->runs[i].glyphs);
+    }
+    free(g->runs);
+    free(g->text);
+    free(g);
+}
+
+// show obj->layout at the current point
+void pcobj_show_layout(pcobj *obj){
+    PangoLayoutIter *iter;
+    const char *text;
+    double x, y;
+
+    if (obj->pdf == NULL){
+        pango_cairo_show_layout (obj->cr, obj->layout);
+        return;
+    }
+    // native: every run of glyphs, at its baseline
+    pdfw_get_current_point(obj->pdf, &x, &y);
+    text = pango_layout_get_text(obj->layout);
+    iter = pango_layout_get_iter(obj->layout);
+    do {
+        PangoLayoutRun *run = pango_layout_iter_get_run_readonly(iter);
+        PangoRectangle logical;
+
+        if (run == NULL) continue; // end of line
+        pango_layout_iter_get_run_extents(iter, NULL, &logical);
+        pdfw_glyphs(obj->pdf, run->item->analysis.font, run->glyphs,
+                    text + run->item->offset,
+                    x + (double)logical.x/PANGO_SCALE,
+                    y + (double)pango_layout_iter_get_baseline(iter)/PANGO_SCALE);
+    } while (pango_layout_iter_next_run(iter));
+    pango_layout_iter_free(iter);
+}
+
+// after the matrix is changed
+void pcobj_update_layout(pcobj *obj){
+    if (obj->pdf == NULL){
+        pango_cairo_update_layout(obj->cr, obj->layout);
+    }
 }
 
 /*
@@ -154,8 +896,11 @@ double pcobj_font_height(pcobj *obj){
 }
 
 double pcobj_text_width(pcobj *obj, const char *str){
-    pcobj_settext(obj, str);
-    return pcobj_width(obj);
+    pcglyphs_t *g=pcobj_shape(obj, str, -1);
+    double width=g->width;
+
+    pcglyphs_free(g);
+    return width;
 }
 
 double pcobj_width(pcobj *obj){
@@ -173,7 +918,160 @@ double pcobj_ink_width(pcobj *obj){
 }
 
 void pcobj_move_to(pcobj *obj, double x, double y){
-    cairo_move_to(obj->cr, x, y-pcobj_font_ascent(obj));
+    pcobj_path_move_to(obj, x, y-pcobj_font_ascent(obj));
+}
+
+//
+// drawing primitives of both cairo and native writer
+
+void pcobj_set_rgb(pcobj *obj, double r, double g, double b){
+    if (obj->pdf != NULL) pdfw_set_rgb(obj->pdf, r, g, b);
+    else cairo_set_source_rgb(obj->cr, r, g, b);
+}
+
+void pcobj_line_width(pcobj *obj, double w){
+    if (obj->pdf != NULL) pdfw_line_width(obj->pdf, w);
+    else cairo_set_line_width(obj->cr, w);
+}
+
+void pcobj_save(pcobj *obj){
+    if (obj->pdf != NULL) pdfw_save(obj->pdf);
+    else cairo_save(obj->cr);
+}
+
+void pcobj_restore(pcobj *obj){
+    if (obj->pdf != NULL) pdfw_restore(obj->pdf);
+    else cairo_restore(obj->cr);
+}
+
+void pcobj_translate(pcobj *obj, double tx, double ty){
+    if (obj->pdf != NULL) pdfw_translate(obj->pdf, tx, ty);
+    else cairo_translate(obj->cr, tx, ty);
+}
+
+void pcobj_rotate(pcobj *obj, double rad){
+    if (obj->pdf != NULL) pdfw_rotate(obj->pdf, rad);
+    else cairo_rotate(obj->cr, rad);
+}
+
+void pcobj_set_matrix(pcobj *obj, cairo_matrix_t *mat){
+    if (obj->pdf != NULL) pdfw_set_matrix(obj->pdf, mat);
+    else cairo_set_matrix(obj->cr, mat);
+}
+
+void pcobj_path_move_to(pcobj *obj, double x, double y){
+    if (obj->pdf != NULL) pdfw_move_to(obj->pdf, x, y);
+    else cairo_move_to(obj->cr, x, y);
+}
+
+void pcobj_path_rel_move_to(pcobj *obj, double dx, double dy){
+    if (obj->pdf != NULL) pdfw_rel_move_to(obj->pdf, dx, dy);
+    else cairo_rel_move_to(obj->cr, dx, dy);
+}
+
+void pcobj_path_line_to(pcobj *obj, double x, double y){
+    if (obj->pdf != NULL) pdfw_line_to(obj->pdf, x, y);
+    else cairo_line_to(obj->cr, x, y);
+}
+
+void pcobj_path_rel_line_to(pcobj *obj, double dx, double dy){
+    if (obj->pdf != NULL) pdfw_rel_line_to(obj->pdf, dx, dy);
+    else cairo_rel_line_to(obj->cr, dx, dy);
+}
+
+void pcobj_path_rectangle(pcobj *obj, double x, double y, double dx, double dy){
+    if (obj->pdf != NULL) pdfw_rectangle(obj->pdf, x, y, dx, dy);
+    else cairo_rectangle(obj->cr, x, y, dx, dy);
+}
+
+void pcobj_path_arc(pcobj *obj, double xc, double yc, double r, double a1, double a2){
+    if (obj->pdf != NULL) pdfw_arc(obj->pdf, xc, yc, r, a1, a2);
+    else cairo_arc(obj->cr, xc, yc, r, a1, a2);
+}
+
+void pcobj_path_close(pcobj *obj){
+    if (obj->pdf != NULL) pdfw_close_path(obj->pdf);
+    else cairo_close_path(obj->cr);
+}
+
+//
+// strokes are batched per color and line width (pdfw_stroke() does
+// the same), and painted at the end of page or before a form.
+
+void pcobj_stroke(pcobj *obj){
+    cairo_matrix_t m;
+    pcbatch_t *b=NULL;
+    double r, g, bl, a, lw;
+    int i;
+
+    if (obj->pdf != NULL){
+        pdfw_stroke(obj->pdf);
+        return;
+    }
+    if (cairo_pattern_get_rgba(cairo_get_source(obj->cr), &r, &g, &bl, &a)
+        != CAIRO_STATUS_SUCCESS){
+        cairo_stroke(obj->cr);
+        return;
+    }
+    cairo_get_matrix(obj->cr, &m);
+    lw = cairo_get_line_width(obj->cr)*sqrt(fabs(m.xx*m.yy - m.xy*m.yx));
+    for (i=0; i<obj->nbatch; i++){
+        b = &obj->batch[i];
+        if ((b->r == r) && (b->g == g) && (b->b == bl) && (b->a == a) && (b->lw == lw)){
+            break;
+        }
+    }
+    if (i == obj->nbatch){
+        if (obj->nbatch >= obj->balloc){
+            obj->balloc = (obj->balloc > 0) ? obj->balloc*2 : 8;
+            obj->batch = realloc(obj->batch, sizeof(pcbatch_t)*obj->balloc);
+            memset(&obj->batch[obj->nbatch], 0, sizeof(pcbatch_t)*(obj->balloc-obj->nbatch));
+        }
+        b = &obj->batch[obj->nbatch++];
+        b->r = r;
+        b->g = g;
+        b->b = bl;
+        b->a = a;
+        b->lw = lw;
+        b->npaths = 0;
+    }
+    if (b->npaths >= b->palloc){
+        b->palloc = (b->palloc > 0) ? b->palloc*2 : 32;
+        b->paths = realloc(b->paths, sizeof(cairo_path_t *)*b->palloc);
+    }
+    // the path is kept in device space
+    cairo_save(obj->cr);
+    cairo_identity_matrix(obj->cr);
+    b->paths[b->npaths++] = cairo_copy_path(obj->cr);
+    cairo_restore(obj->cr);
+    cairo_new_path(obj->cr);
+}
+
+void pcobj_flush(pcobj *obj){
+    int i, j;
+
+    if ((obj->pdf != NULL) || (obj->nbatch == 0)) return;
+    cairo_save(obj->cr);
+    cairo_identity_matrix(obj->cr);
+    cairo_new_path(obj->cr);
+    for (i=0; i<obj->nbatch; i++){
+        pcbatch_t *b=&obj->batch[i];
+
+        for (j=0; j<b->npaths; j++){
+            cairo_append_path(obj->cr, b->paths[j]);
+            cairo_path_destroy(b->paths[j]);
+        }
+        cairo_set_source_rgba(obj->cr, b->r, b->g, b->b, b->a);
+        cairo_set_line_width(obj->cr, b->lw);
+        cairo_stroke(obj->cr);
+    }
+    cairo_restore(obj->cr);
+    obj->nbatch = 0;
+}
+
+void pcobj_fill(pcobj *obj){
+    if (obj->pdf != NULL) pdfw_fill(obj->pdf);
+    else cairo_fill(obj->cr);
 }
 
 #define SAMPLE_SIZE 64
@@ -186,11 +1084,11 @@ void pcobj_draw_watermark(pcobj *obj, char *text, char *font,
 
     pcobj_setfont(obj, font, SAMPLE_SIZE);
     pcobj_font_face(obj, style, weight);
-    cairo_set_source_rgb(obj->cr, r, g, b);
+    pcobj_set_rgb(obj, r, g, b);
 
-    cairo_save(obj->cr);{
-        cairo_translate(obj->cr, x+dx/2, y+dy/2);
-        pango_cairo_update_layout (obj->cr, obj->layout);
+    pcobj_save(obj);{
+        pcobj_translate(obj, x+dx/2, y+dy/2);
+        pcobj_update_layout(obj);
 
         w=pcobj_text_width(obj, text);
         h=pcobj_font_height(obj);
@@ -213,21 +1111,21 @@ void pcobj_draw_watermark(pcobj *obj, char *text, char *font,
         new_w = pcobj_ink_width(obj);
         new_h = pcobj_font_height(obj);
 
-        cairo_rotate(obj->cr, -rad);
-        pango_cairo_update_layout (obj->cr, obj->layout);
+        pcobj_rotate(obj, -rad);
+        pcobj_update_layout(obj);
 
-        cairo_move_to(obj->cr, -new_w/2, -new_h/2);
-        pango_cairo_show_layout(obj->cr, obj->layout);
-        cairo_set_source_rgb(obj->cr, 0, 0, 0); // C_BLACK
-    } cairo_restore(obj->cr);
+        pcobj_path_move_to(obj, -new_w/2, -new_h/2);
+        pcobj_show_layout(obj);
+        pcobj_set_rgb(obj, 0, 0, 0); // C_BLACK
+    } pcobj_restore(obj);
     
 #ifdef SINGLE_DEBUG
-    cairo_rectangle(obj->cr, x, y, dx, dy);
-    cairo_move_to(obj->cr, x, y+dy);
-    cairo_line_to(obj->cr, x+dx, y);
-    cairo_stroke(obj->cr);
+    pcobj_path_rectangle(obj, x, y, dx, dy);
+    pcobj_path_move_to(obj, x, y+dy);
+    pcobj_path_line_to(obj, x+dx, y);
+    pcobj_stroke(obj);
 #endif
-    pango_cairo_update_layout (obj->cr, obj->layout);
+    pcobj_update_layout(obj);
 }
 
 void dump_matrix(pcobj *obj){
@@ -314,6 +1212,9 @@ void pcobj_turn_left(pcobj *obj){
 void pcobj_setdir(pcobj *obj, enum direction d){
     cairo_matrix_t mat;
 
+    if (obj->sinks != NULL){
+        return; // logical space: every sink turns itself
+    }
     obj->axis=d;
     switch (d){
     case d_none:
@@ -342,8 +1243,8 @@ void pcobj_setdir(pcobj *obj, enum direction d){
         mat.yx= -1; mat.yy= 0; mat.y0= obj->phys_height;
         break;
     }
-    cairo_set_matrix(obj->cr, &mat);
-    pango_cairo_update_layout(obj->cr, obj->layout);
+    pcobj_set_matrix(obj, &mat);
+    pcobj_update_layout(obj);
 }
 
 /* --- debug part --- */
@@ -360,6 +1261,10 @@ void pcobj_setdir(pcobj *obj, enum direction d){
 #define A4_w 595.27
 #define A4_h 841.89
 
+// cache.o, which hashes the glyph set of font subsets
+int utpdf_makepdf=1;
+char *utpdf_prog_name="pangoprint";
+
 // #define PS_TEST
 
 double cairo_text_width(cairo_t *cr, const char *str){
@@ -565,7 +1470,7 @@ int main(int argc, char **argv){
     // dump_matrix(obj);
 #else
     // PDF
-    fd = openfd("p.pdf", O_CREAT|O_RDWR|O_TRUNC);
+    if ((fd = openfd("p.pdf", O_CREAT|O_RDWR|O_TRUNC)) < 0) exit(1);
     obj = pcobj_pdf_new((cairo_write_func_t ) write_func, &fd, A4_h, A4_w);
 #endif
   
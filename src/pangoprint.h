@@ -24,6 +24,42 @@
 #include <cairo-pdf.h>
 #include <cairo-ps.h>
 #include "utpdf.h"
+#include "psstream.h"
+#include "pdfwriter.h"
+#include "pswriter.h"
+#include "raster.h"
+#include "pdfopt.h"
+
+#define PCOBJ_FORMS 8 // forms per document
+#define PCCOVER_SIZE 4096 // entries of the coverage map (power of 2)
+#define PCCOVER_PROBE 8
+
+// coverage map: the font which shows a code point in a font description
+typedef struct pcobj_cover {
+    guint desc;
+    gunichar cp;
+    PangoFont *font; // NULL: empty
+} pccover_t;
+
+// drawing recorded once, and painted on pages
+typedef struct pcobj_form {
+    int recorded;
+    cairo_pattern_t *pattern; // cairo: recording surface
+    int id;                   // native writer: XObject
+} pcform_t;
+
+// cairo: strokes of the same color and width, in device space
+typedef struct pcobj_batch {
+    double r, g, b, a, lw;
+    cairo_path_t **paths;
+    int npaths, palloc;
+} pcbatch_t;
+
+// fan-out: a cairo output, painted with every recorded page
+typedef struct pcobj_sink {
+    struct pango_cairo_print_object *obj;
+    int upside_down_page; // turned after every page
+} pcsink_t;
 
 typedef struct pango_cairo_print_object {
     cairo_surface_t *surface;
@@ -33,19 +69,88 @@ typedef struct pango_cairo_print_object {
     double phys_width, phys_height;
     double l_width, l_height;
     enum direction axis;
+    // per-page PostScript streaming (NULL: whole document at once)
+    psstream_t *stream;
+    const char *page_dsc; // DSC comment for every page setup
+    // native PDF/PostScript writer (NULL: cairo)
+    pdfw_t *pdf;
+    PangoContext *context;
+    // tab stops (NULL: a tab is a glyph)
+    PangoTabArray *tabs;
+    // forms, and cairo_t of the page while recording
+    pcform_t forms[PCOBJ_FORMS];
+    cairo_t *page_cr;
+    // strokes until pcobj_flush()
+    pcbatch_t *batch;
+    int nbatch, balloc;
+    // fallback fonts, resolved once (NULL: not yet used)
+    pccover_t *cover;
+    // how to itemize the text of pcobj_shape()
+    enum input_class shaping;
+    // pages recorded in logical space for the sinks (NULL: drawn directly)
+    pcsink_t *sinks;
+    int nsinks;
+    int fresh;        // nothing is recorded after the last page yet
+    raster_t *raster; // PNG of every recorded page (NULL: none)
+    // the finished PDF is rewritten by this (NULL: as it is)
+    pdfopt_t *opt;
 } pcobj; 
 
+// one line of text, shaped without PangoLayout
+typedef struct pcobj_glyphs {
+    char *text;            // copy of the text, which runs refer to
+    int len;
+    PangoGlyphItem *runs;  // in visual order
+    int nruns;
+    double width;          // logical width
+    double ascent;         // from the top of line to the baseline
+} pcglyphs_t;
+
 extern pcobj *pcobj_pdf_new
 	(cairo_write_func_t write_func, int *out_fd,
          double width, double height);
 extern pcobj *pcobj_ps_new
 	(cairo_write_func_t write_func, int *out_fd,
          double width, double height);
-extern void pcobj_free(pcobj *obj);
+extern pcobj *pcobj_pdf_native_new
+	(cairo_write_func_t write_func, int *out_fd,
+         double width, double height);
+extern pcobj *pcobj_ps_native_new
+	(cairo_write_func_t write_func, int *out_fd,
+         double width, double height);
+extern pcobj *pcobj_ps_stream_new
+	(cairo_write_func_t write_func, int *out_fd,
+         double width, double height);
+extern pcobj *pcobj_fanout_new(double width, double height);
+extern void pcobj_add_sink(pcobj *obj, pcobj *sink, int rotate_right, int upside_down_page);
+extern int pcobj_free(pcobj *obj);
+extern int pcobj_copy_pages(pcobj *obj, const char *buf, size_t len, int npages);
+extern void pcobj_count_content(pcobj *obj, pdfw_stats_t *stats);
+extern void pcobj_page_dsc(pcobj *obj, const char *comment);
+extern void pcobj_dsc_comment(pcobj *obj, const char *comment);
+extern void pcobj_dsc_begin_setup(pcobj *obj);
+extern void pcobj_begin_page(pcobj *obj);
+extern void pcobj_show_page(pcobj *obj);
 extern void pcobj_setfont(pcobj *obj, char *family, double size);
 extern void pcobj_setsize(pcobj *obj, double size);
 extern void pcobj_settext(pcobj *obj, const char *str);
 extern void pcobj_print(pcobj *obj, const char *str);
+extern void pcobj_show_layout(pcobj *obj);
+extern pcglyphs_t *pcobj_shape(pcobj *obj, const char *str, int len);
+extern pcglyphs_t *pcobj_shape_at(pcobj *obj, const char *str, int len, double x0);
+extern void pcobj_set_tabs(pcobj *obj, int tab);
+extern PangoFont *pcobj_cover_font(pcobj *obj, guint desc, gunichar cp);
+extern void pcobj_cover_warm(pcobj *obj, const unsigned int *cps, int n);
+extern void pcobj_set_shaping(pcobj *obj, enum input_class cls);
+extern int pcobj_has_form(pcobj *obj, int slot);
+extern void pcobj_form_begin(pcobj *obj);
+extern void pcobj_form_end(pcobj *obj, int slot);
+extern void pcobj_paint_form(pcobj *obj, int slot);
+extern void pcobj_show_glyphs(pcobj *obj, pcglyphs_t *g);
+extern int pcobj_fold(pcglyphs_t *g, double avail);
+extern pcglyphs_t *pcglyphs_concat(pcglyphs_t **parts, int n);
+extern void pcglyphs_free(pcglyphs_t *g);
+extern void pcobj_update_layout(pcobj *obj);
 extern void pcobj_weight(pcobj *obj, PangoWeight w);
 extern void pcobj_style(pcobj *obj, PangoStyle style);
 extern void pcobj_font_face(pcobj *obj, PangoStyle style, PangoWeight w);
@@ -56,6 +161,25 @@ extern double pcobj_width(pcobj *obj);
 extern double pcobj_ink_width(pcobj *obj);
 extern double pcobj_text_width(pcobj *obj, const char *str);
 extern void pcobj_move_to(pcobj *obj, double x, double y);
+
+extern void pcobj_set_rgb(pcobj *obj, double r, double g, double b);
+extern void pcobj_line_width(pcobj *obj, double w);
+extern void pcobj_save(pcobj *obj);
+extern void pcobj_restore(pcobj *obj);
+extern void pcobj_translate(pcobj *obj, double tx, double ty);
+extern void pcobj_rotate(pcobj *obj, double rad);
+extern void pcobj_set_matrix(pcobj *obj, cairo_matrix_t *mat);
+extern void pcobj_path_move_to(pcobj *obj, double x, double y);
+extern void pcobj_path_rel_move_to(pcobj *obj, double dx, double dy);
+extern void pcobj_path_line_to(pcobj *obj, double x, double y);
+extern void pcobj_path_rel_line_to(pcobj *obj, double dx, double dy);
+extern void pcobj_path_rectangle(pcobj *obj, double x, double y, double dx, double dy);
+extern void pcobj_path_arc(pcobj *obj, double xc, double yc, double r,
+                           double a1, double a2);
+extern void pcobj_path_close(pcobj *obj);
+extern void pcobj_stroke(pcobj *obj);
+extern void pcobj_flush(pcobj *obj);
+extern void pcobj_fill(pcobj *obj);
 extern void pcobj_draw_watermark(pcobj *obj, char *text, char *font,
                                  double x, double y, double dx, double dy,
                                  PangoWeight weight, PangoStyle style,
@@ -0,0 +1,487 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "utpdf.h"
+#include "pdfopt.h"
+
+/*
+  linearized PDF: page 1 can be shown from the head of the file.
+
+    header
+    linearization dictionary            object N
+    first-page xref (N..) and trailer
+    catalog                             object N+1
+    hint stream: page offsets and shared objects
+                                        object N+2
+    the first page and what it uses     objects N+3...   (/E: the end)
+    every other page and its own objects
+    objects used by several pages
+    the rest: page tree, info, ...      objects 1..N-1
+    main xref (0..N-1) and trailer
+
+  Every offset is known before the first byte is written: recompressed
+  streams are spooled to a temporary file in the order of output, and
+  written from there. Offsets in hint tables are counted without the
+  hint stream, as the format says, so its length does not matter.
+*/
+
+long pdflinear_stat_first, pdflinear_stat_len;
+
+// bits of hint tables, most significant first
+typedef struct pdflinear_bits {
+    psbuf_t buf;
+    unsigned int acc;
+    int nacc;
+} pbits_t;
+
+// parts of the output
+typedef struct pdflinear_layout {
+    plist_t pages;         // page objects in order
+    plist_t *sections;     // [0]: the first page, [i]: page i
+    plist_t shared, rest;
+    plist_t visits;        // objects used by each page,
+    int *vstart;           //   from visits.v[vstart[i]]
+    int catalog, N, npages;
+    long lin_len, xref_len, hint_len;
+} playout_t;
+
+//
+// forward declaration
+void bits_put(pbits_t *b, unsigned long v, int n);
+void bits_flush(pbits_t *b);
+int bits_needed(unsigned long v);
+int pdflinear_pages(pdoc_t *d, int node, plist_t *pages, int depth);
+void pdflinear_mark(pdoc_t *d, playout_t *l);
+void pdflinear_parts(pdoc_t *d, playout_t *l);
+long pdflinear_offsets(pdoc_t *d, playout_t *l, long hint_len);
+void pdflinear_hints(pdoc_t *d, playout_t *l, psbuf_t *hints, long *s_offset);
+void pdflinear_lindict(pdoc_t *d, playout_t *l, psbuf_t *out, long L, long E, long T);
+void pdflinear_xref1(pdoc_t *d, playout_t *l, psbuf_t *out, long prev);
+void pdflinear_free(playout_t *l);
+//
+//
+
+void bits_put(pbits_t *b, unsigned long v, int n){
+    while (n-- > 0){
+        b->acc = (b->acc << 1) | ((v >> n) & 1);
+        if (++b->nacc == 8){
+            char c=b->acc;
+
+            psbuf_add(&b->buf, &c, 1);
+            b->acc = b->nacc = 0;
+        }
+    }
+}
+
+// the next item starts at a byte
+void bits_flush(pbits_t *b){
+    if (b->nacc > 0){
+        bits_put(b, 0, 8-b->nacc);
+    }
+}
+
+int bits_needed(unsigned long v){
+    int n=0;
+
+    while (v > 0){
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+// pages in order under node of the page tree. 0: broken tree
+int pdflinear_pages(pdoc_t *d, int node, plist_t *pages, int depth){
+    plist_t kids={NULL, 0, 0};
+    const char *v, *ve;
+    pobj_t *ob;
+    int i, ok=1;
+
+    if ((node <= 0) || (node >= d->nobj) || (depth > 64)) return 0;
+    ob = &d->objs[node];
+    if ((ob->val == NULL) || (ob->data != NULL) || ob->tree) return 0;
+    ob->tree = 1;
+    if ((v = pdf_dict_get(ob->val, ob->val+ob->vlen, "/Type", &ve)) == NULL) return 0;
+    if (pdf_token_is(v, ve, "/Page")){
+        plist_add(pages, node);
+        return 1;
+    }
+    if (!pdf_token_is(v, ve, "/Pages")
+        || ((v = pdf_dict_get(ob->val, ob->val+ob->vlen, "/Kids", &ve)) == NULL)) return 0;
+    pdfopt_refs(d, v, ve, NULL, &kids);
+    for (i=0; ok && (i<kids.n); i++){
+        ok = pdflinear_pages(d, kids.v[i], pages, depth+1);
+    }
+    free(kids.v);
+    return ok;
+}
+
+// the objects each page uses, without the page tree and other pages
+void pdflinear_mark(pdoc_t *d, playout_t *l){
+    plist_t stack={NULL, 0, 0}, refs={NULL, 0, 0};
+    int i, k;
+
+    l->vstart = calloc(l->npages+1, sizeof(int));
+    for (i=0; i<l->npages; i++){
+        int pg=l->pages.v[i];
+
+        l->vstart[i] = l->visits.n;
+        d->objs[pg].page = i;
+        d->objs[pg].mark = i+1;
+        d->objs[pg].first = (i == 0);
+        plist_add(&stack, pg);
+        while (stack.n > 0){
+            refs.n = 0;
+            pdfopt_object_refs(d, stack.v[--stack.n], &refs);
+            for (k=0; k<refs.n; k++){
+                int r=refs.v[k];
+                pobj_t *ob=&d->objs[r];
+
+                if ((r == l->catalog) || ob->tree || pdfopt_dropped(d, r) || (ob->mark == i+1)){
+                    continue;
+                }
+                ob->mark = i+1;
+                ob->page = ((ob->page == -1) || (ob->page == i)) ? i : -2;
+                ob->first |= (i == 0);
+                plist_add(&l->visits, r);
+                plist_add(&stack, r);
+            }
+        }
+    }
+    l->vstart[l->npages] = l->visits.n;
+    free(stack.v);
+    free(refs.v);
+}
+
+// sections in the order of output, and object numbers
+void pdflinear_parts(pdoc_t *d, playout_t *l){
+    int i, n, num=1;
+
+    l->sections = calloc(l->npages, sizeof(plist_t));
+    for (i=0; i<l->npages; i++){
+        plist_add(&l->sections[i], l->pages.v[i]);
+    }
+    for (n=1; n<d->nobj; n++){
+        pobj_t *ob=&d->objs[n];
+
+        if (pdfopt_dropped(d, n) || (n == l->catalog) || (ob->tree && (ob->page >= 0))) continue;
+        if (ob->first){
+            plist_add(&l->sections[0], n);
+        } else if (ob->page >= 0){
+            plist_add(&l->sections[ob->page], n);
+        } else if (ob->page == -2){
+            plist_add(&l->shared, n);
+        } else {
+            plist_add(&l->rest, n);
+        }
+    }
+    // main xref: every page but the first, shared objects and the rest
+    for (i=1; i<l->npages; i++){
+        for (n=0; n<l->sections[i].n; n++) d->objs[l->sections[i].v[n]].newnum = num++;
+    }
+    for (n=0; n<l->shared.n; n++) d->objs[l->shared.v[n]].newnum = num++;
+    for (n=0; n<l->rest.n; n++) d->objs[l->rest.v[n]].newnum = num++;
+    l->N = num;
+    // first-page xref
+    d->objs[l->catalog].newnum = l->N+1;
+    for (n=0; n<l->sections[0].n; n++) d->objs[l->sections[0].v[n]].newnum = l->N+3+n;
+    // shared object identifiers: the first page, then shared objects
+    for (n=0; n<l->sections[0].n; n++) d->objs[l->sections[0].v[n]].shared_id = n;
+    for (n=0; n<l->shared.n; n++) d->objs[l->shared.v[n]].shared_id = l->sections[0].n+n;
+}
+
+// offset of every object, and the end of the first page
+long pdflinear_offsets(pdoc_t *d, playout_t *l, long hint_len){
+    long off, E;
+    int i, n;
+
+    off = 15 + l->lin_len + l->xref_len; // after header
+    d->objs[l->catalog].offset = off;
+    off += d->objs[l->catalog].size + hint_len;
+    for (i=0; i<l->npages; i++){
+        for (n=0; n<l->sections[i].n; n++){
+            pobj_t *ob=&d->objs[l->sections[i].v[n]];
+
+            ob->offset = off;
+            off += ob->size;
+        }
+        if (i == 0) E = off;
+    }
+    for (n=0; n<l->shared.n; n++){
+        d->objs[l->shared.v[n]].offset = off;
+        off += d->objs[l->shared.v[n]].size;
+    }
+    for (n=0; n<l->rest.n; n++){
+        d->objs[l->rest.v[n]].offset = off;
+        off += d->objs[l->rest.v[n]].size;
+    }
+    return E;
+}
+
+// page offset hint table and shared object hint table, with the
+// offsets of pdflinear_offsets(d, l, 0).
+void pdflinear_hints(pdoc_t *d, playout_t *l, psbuf_t *hints, long *s_offset){
+    pbits_t b;
+    long *len=calloc(l->npages, sizeof(long)), minlen=-1, maxlen=0, E;
+    int *nshared=calloc(l->npages, sizeof(int)), minobj=-1, maxobj=0, maxshared=0;
+    int maxid=0, i, k, nsh=l->sections[0].n+l->shared.n;
+
+    memset(&b, 0, sizeof(b));
+    E = pdflinear_offsets(d, l, 0);
+    for (i=0; i<l->npages; i++){
+        plist_t *s=&l->sections[i];
+
+        if (i == 0){
+            len[i] = E - d->objs[l->pages.v[0]].offset;
+        } else {
+            for (k=0; k<s->n; k++) len[i] += d->objs[s->v[k]].size;
+        }
+        for (k=l->vstart[i]; (i > 0) && (k<l->vstart[i+1]); k++){
+            pobj_t *ob=&d->objs[l->visits.v[k]];
+
+            if (ob->page != -2) continue;
+            nshared[i]++;
+            if (ob->shared_id > maxid) maxid = ob->shared_id;
+        }
+        if ((minobj < 0) || (s->n < minobj)) minobj = s->n;
+        if (s->n > maxobj) maxobj = s->n;
+        if ((minlen < 0) || (len[i] < minlen)) minlen = len[i];
+        if (len[i] > maxlen) maxlen = len[i];
+        if (nshared[i] > maxshared) maxshared = nshared[i];
+    }
+    // page offset hint table
+    bits_put(&b, minobj, 32);
+    bits_put(&b, d->objs[l->pages.v[0]].offset, 32);
+    bits_put(&b, bits_needed(maxobj-minobj), 16);
+    bits_put(&b, minlen, 32);
+    bits_put(&b, bits_needed(maxlen-minlen), 16);
+    bits_put(&b, 0, 32);                              // content streams from the page
+    bits_put(&b, 0, 16);
+    bits_put(&b, minlen, 32);                         //   to the end of page
+    bits_put(&b, bits_needed(maxlen-minlen), 16);
+    bits_put(&b, bits_needed(maxshared), 16);
+    bits_put(&b, bits_needed(maxid), 16);
+    bits_put(&b, 0, 16);                              // no fractional position
+    bits_put(&b, 1, 16);
+    for (i=0; i<l->npages; i++) bits_put(&b, l->sections[i].n-minobj, bits_needed(maxobj-minobj));
+    bits_flush(&b);
+    for (i=0; i<l->npages; i++) bits_put(&b, len[i]-minlen, bits_needed(maxlen-minlen));
+    bits_flush(&b);
+    for (i=0; i<l->npages; i++) bits_put(&b, nshared[i], bits_needed(maxshared));
+    bits_flush(&b);
+    for (i=1; i<l->npages; i++){
+        for (k=l->vstart[i]; k<l->vstart[i+1]; k++){
+            pobj_t *ob=&d->objs[l->visits.v[k]];
+
+            if (ob->page == -2) bits_put(&b, ob->shared_id, bits_needed(maxid));
+        }
+    }
+    bits_flush(&b);
+    for (i=0; i<l->npages; i++) bits_put(&b, len[i]-minlen, bits_needed(maxlen-minlen));
+    bits_flush(&b);
+    *s_offset = b.buf.len;
+
+    // shared object hint table: a group per object
+    minlen = -1;
+    maxlen = 0;
+    for (k=0; k<nsh; k++){
+        int n=(k < l->sections[0].n) ? l->sections[0].v[k] : l->shared.v[k-l->sections[0].n];
+
+        if ((minlen < 0) || (d->objs[n].size < minlen)) minlen = d->objs[n].size;
+        if (d->objs[n].size > maxlen) maxlen = d->objs[n].size;
+    }
+    if (minlen < 0) minlen = 0;
+    bits_put(&b, (l->shared.n > 0) ? d->objs[l->shared.v[0]].newnum : 0, 32);
+    bits_put(&b, (l->shared.n > 0) ? d->objs[l->shared.v[0]].offset : 0, 32);
+    bits_put(&b, l->sections[0].n, 32);
+    bits_put(&b, nsh, 32);
+    bits_put(&b, 0, 16);                              // an object per group
+    bits_put(&b, minlen, 32);
+    bits_put(&b, bits_needed(maxlen-minlen), 16);
+    for (k=0; k<nsh; k++){
+        int n=(k < l->sections[0].n) ? l->sections[0].v[k] : l->shared.v[k-l->sections[0].n];
+
+        bits_put(&b, d->objs[n].size-minlen, bits_needed(maxlen-minlen));
+    }
+    bits_flush(&b);
+    for (k=0; k<nsh; k++) bits_put(&b, 0, 1);         // no MD5
+    bits_flush(&b);
+    *hints = b.buf;
+    free(len);
+    free(nshared);
+}
+
+void pdflinear_lindict(pdoc_t *d, playout_t *l, psbuf_t *out, long L, long E, long T){
+    char buf[S_LEN];
+
+    psbuf_add(out, buf, snprintf(buf, S_LEN,
+                                 "%d 0 obj\n<< /Linearized 1 /L %010ld /H [ %010ld %010ld ]"
+                                 " /O %d /E %010ld /N %d /T %010ld >>\nendobj\n",
+                                 l->N, L, 15+l->lin_len+l->xref_len+d->objs[l->catalog].size,
+                                 l->hint_len, d->objs[l->pages.v[0]].newnum, E, l->npages, T));
+}
+
+// first-page xref and trailer; prev: offset of the main xref
+void pdflinear_xref1(pdoc_t *d, playout_t *l, psbuf_t *out, long prev){
+    char buf[S_LEN];
+    int n;
+
+    psbuf_add(out, buf, snprintf(buf, S_LEN, "xref\n%d %d\n", l->N, 3+l->sections[0].n));
+    psbuf_add(out, buf, snprintf(buf, S_LEN, "%010ld 00000 n \n", 15L));
+    psbuf_add(out, buf, snprintf(buf, S_LEN, "%010ld 00000 n \n", d->objs[l->catalog].offset));
+    psbuf_add(out, buf, snprintf(buf, S_LEN, "%010ld 00000 n \n",
+                                 d->objs[l->catalog].offset+d->objs[l->catalog].size));
+    for (n=0; n<l->sections[0].n; n++){
+        psbuf_add(out, buf, snprintf(buf, S_LEN, "%010ld 00000 n \n",
+                                     d->objs[l->sections[0].v[n]].offset));
+    }
+    psbuf_add(out, buf, snprintf(buf, S_LEN, "trailer\n<< /Size %d /Prev %010ld /Root %d 0 R",
+                                 l->N+3+l->sections[0].n, prev, l->N+1));
+    if (d->info != NULL){
+        psbuf_add(out, " /Info ", 7);
+        pdfopt_refs(d, d->info, d->info_e, out, NULL);
+    }
+    if (d->id != NULL){
+        psbuf_add(out, " /ID ", 5);
+        psbuf_add(out, d->id, d->id_e-d->id);
+    }
+    psbuf_add(out, " >>\nstartxref\n0\n%%EOF\n", 22);
+}
+
+void pdflinear_free(playout_t *l){
+    int i;
+
+    for (i=0; i<l->npages; i++) free(l->sections[i].v);
+    free(l->sections);
+    free(l->pages.v);
+    free(l->shared.v);
+    free(l->rest.v);
+    free(l->visits.v);
+    free(l->vstart);
+}
+
+// 0: not linearized, e.g. no page
+int pdfopt_linearize(pdoc_t *d){
+    playout_t l;
+    plist_t order={NULL, 0, 0};
+    psbuf_t hints={NULL, 0, 0}, t={NULL, 0, 0};
+    const char *v, *ve;
+    long s_offset, E, L, T, main_xref, off;
+    int i, n, catalog=pdfopt_kept(d, atoi(d->root));
+
+    memset(&l, 0, sizeof(l));
+    if ((catalog <= 0) || (catalog >= d->nobj) || (d->objs[catalog].val == NULL)
+        || ((v = pdf_dict_get(d->objs[catalog].val, d->objs[catalog].val+d->objs[catalog].vlen,
+                              "/Pages", &ve)) == NULL)
+        || !pdflinear_pages(d, pdfopt_kept(d, atoi(v)), &l.pages, 0) || (l.pages.n == 0)){
+        for (n=0; n<d->nobj; n++) d->objs[n].tree = 0;
+        free(l.pages.v);
+        return 0;
+    }
+    l.catalog = catalog;
+    l.npages = l.pages.n;
+    pdflinear_mark(d, &l);
+    pdflinear_parts(d, &l);
+    d->renumber = 1;
+
+    // streams recompressed in the order of output, to the spool
+    plist_add(&order, catalog);
+    for (i=0; i<l.npages; i++){
+        for (n=0; n<l.sections[i].n; n++) plist_add(&order, l.sections[i].v[n]);
+    }
+    for (n=0; n<l.shared.n; n++) plist_add(&order, l.shared.v[n]);
+    for (n=0; n<l.rest.n; n++) plist_add(&order, l.rest.v[n]);
+    if ((d->spool = tmpfile()) == NULL){
+        // kept in memory until written, as without linearize
+        perror("Could not create a temporary file of PDF");
+    }
+    for (i=0; i<order.n; i++){
+        pobj_t *ob=&d->objs[order.v[i]];
+
+        if ((ob->data != NULL) && !ob->done) pdfopt_window(d, order.v, order.n, i);
+    }
+    if (d->spool_len > 0){
+        fflush(d->spool);
+        d->spool_map = mmap(NULL, d->spool_len, PROT_READ, MAP_PRIVATE, fileno(d->spool), 0);
+        if (d->spool_map == MAP_FAILED){
+            perror("Could not map the spool of PDF");
+            d->spool_map = NULL;
+            d->status = CAIRO_STATUS_WRITE_ERROR; // nothing is written
+        }
+    }
+    for (i=0; i<order.n; i++){
+        d->objs[order.v[i]].size = pdfopt_object_size(d, order.v[i]);
+    }
+
+    // fixed lengths before the first page
+    pdflinear_lindict(d, &l, &t, 0, 0, 0);
+    l.lin_len = t.len;
+    t.len = 0;
+    pdflinear_xref1(d, &l, &t, 0);
+    l.xref_len = t.len;
+    t.len = 0;
+    pdflinear_hints(d, &l, &hints, &s_offset);
+    {
+        char buf[S_LEN];
+
+        l.hint_len = snprintf(buf, S_LEN, "%d 0 obj\n<< /S %ld /Length %zu >>\nstream\n",
+                              l.N+2, s_offset, hints.len) + hints.len + 18;
+    }
+    E = pdflinear_offsets(d, &l, l.hint_len);
+    off = d->objs[order.v[order.n-1]].offset + d->objs[order.v[order.n-1]].size;
+    main_xref = off;
+    T = main_xref + snprintf(NULL, 0, "xref\n0 %d", l.N);
+    L = main_xref + snprintf(NULL, 0, "xref\n0 %d\n", l.N) + 20*l.N
+        + snprintf(NULL, 0, "trailer\n<< /Size %d >>\nstartxref\n%ld\n%%%%EOF\n",
+                   l.N, 15+l.lin_len);
+
+    // output
+    pdfopt_printf(d, "%%PDF-1.%d\n%%\xe2\xe3\xcf\xd3\n", (d->version > 5) ? d->version : 5);
+    pdflinear_lindict(d, &l, &t, L, E, T);
+    pdflinear_xref1(d, &l, &t, main_xref);
+    pdfopt_emit(d, t.data, t.len);
+    pdfopt_write_object(d, catalog);
+    pdfopt_printf(d, "%d 0 obj\n<< /S %ld /Length %zu >>\nstream\n", l.N+2, s_offset, hints.len);
+    pdfopt_emit(d, hints.data, hints.len);
+    pdfopt_printf(d, "\nendstream\nendobj\n");
+    for (i=1; i<order.n; i++){
+        pdfopt_write_object(d, order.v[i]);
+    }
+    pdfopt_printf(d, "xref\n0 %d\n0000000000 65535 f \n", l.N);
+    for (i=l.sections[0].n+1; i<order.n; i++){
+        pdfopt_printf(d, "%010ld 00000 n \n", d->objs[order.v[i]].offset);
+    }
+    pdfopt_printf(d, "trailer\n<< /Size %d >>\nstartxref\n%ld\n%%%%EOF\n", l.N, 15+l.lin_len);
+    pdflinear_stat_first += E;
+    pdflinear_stat_len += L;
+
+    if (d->spool_map != NULL) munmap((void *)d->spool_map, d->spool_len);
+    if (d->spool != NULL) fclose(d->spool);
+    free(order.v);
+    free(hints.data);
+    free(t.data);
+    pdflinear_free(&l);
+    return 1;
+}
+
+// end of pdflinear.c
@@ -0,0 +1,921 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "utpdf.h"
+#include "pdfopt.h"
+
+/*
+  The whole PDF is needed before its xref is read, so the input is
+  spooled to a temporary file and mapped; the rewritten output is
+  written as it is made. Streams are recompressed on threads in windows
+  of PDFOPT_WINDOW bytes, and the other objects go to object streams of
+  PDFOPT_OBJSTM objects.
+
+  Only what the writers of utpdf make is rewritten: one classic xref
+  table without /Prev nor /Encrypt. Any other PDF is written as it is.
+*/
+
+#define IS_WS(c)    (strchr(" \t\r\n\f", (c)) != NULL) // '\0', too
+#define IS_DELIM(c) (strchr("()<>[]{}/%", (c)) != NULL)
+
+// for --stats
+static long pdfopt_stat_in, pdfopt_stat_out;
+static int pdfopt_stat_objstm, pdfopt_stat_objs, pdfopt_stat_dups;
+static int pdfopt_stat_streams, pdfopt_stat_docs, pdfopt_stat_kept;
+static double pdfopt_stat_seconds;
+
+//
+// forward declaration
+const char *pdf_skip_ws(const char *p, const char *e);
+const char *pdf_token_end(const char *p, const char *e);
+int pdf_is_int(const char *p, const char *q);
+const char *pdf_skip_value(const char *p, const char *e);
+const char *pdf_skip_obj(const char *p, const char *e);
+void pdf_dict_without(const char *d, const char *e, const char *key, psbuf_t *out);
+int pdfopt_num(pdoc_t *d, int n);
+int pdfopt_dedup(pdoc_t *d, int streams);
+unsigned char *pdfopt_inflate(const unsigned char *src, size_t len, size_t *olen);
+unsigned char *pdfopt_deflate(const unsigned char *src, size_t len, int level, size_t *olen);
+void pdfopt_recompress(pdoc_t *d, pobj_t *ob);
+void *pdfopt_worker(void *arg);
+void pdfopt_stm_add(pdoc_t *d, int n);
+void pdfopt_stm_flush(pdoc_t *d);
+void pdfopt_write_xref(pdoc_t *d);
+void pdfopt_prepare(pdoc_t *d);
+//
+//
+
+pdfopt_t *pdfopt_new(cairo_write_func_t write, void *closure, int level, int linearize){
+    pdfopt_t *o=calloc(1, sizeof(pdfopt_t));
+
+    if ((o->in = tmpfile()) == NULL){
+        perror("Could not create a temporary file of PDF");
+        free(o);
+        return NULL;
+    }
+    o->write = write;
+    o->closure = closure;
+    o->level = level;
+    o->linearize = linearize;
+    return o;
+}
+
+cairo_status_t pdfopt_write(void *closure, const unsigned char *data, unsigned int length){
+    pdfopt_t *o=closure;
+
+    if (fwrite(data, 1, length, o->in) != length){
+        return CAIRO_STATUS_WRITE_ERROR;
+    }
+    o->len += length;
+    return CAIRO_STATUS_SUCCESS;
+}
+
+void plist_add(plist_t *l, int n){
+    if (l->n >= l->alloc){
+        l->alloc = (l->alloc > 0) ? l->alloc*2 : 64;
+        l->v = realloc(l->v, sizeof(int)*l->alloc);
+    }
+    l->v[l->n++] = n;
+}
+
+//
+// lexer of PDF objects, in [p, e)
+
+const char *pdf_skip_ws(const char *p, const char *e){
+    while (p < e){
+        if (*p == '%'){
+            while ((p < e) && (*p != '\n') && (*p != '\r')) p++;
+        } else if (IS_WS(*p)){
+            p++;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+// end of a name, number or keyword
+const char *pdf_token_end(const char *p, const char *e){
+    if ((p < e) && (*p == '/')) p++;
+    while ((p < e) && !IS_WS(*p) && !IS_DELIM(*p)) p++;
+    return p;
+}
+
+int pdf_is_int(const char *p, const char *q){
+    if (p == q) return 0;
+    for (; p<q; p++){
+        if ((*p < '0') || (*p > '9')) return 0;
+    }
+    return 1;
+}
+
+int pdf_token_is(const char *p, const char *q, const char *s){
+    return ((size_t)(q-p) == strlen(s)) && (memcmp(p, s, q-p) == 0);
+}
+
+// after a dictionary, array, string, name, number or keyword. NULL: broken
+const char *pdf_skip_value(const char *p, const char *e){
+    const char *q;
+    int depth=0;
+
+    if (p >= e) return NULL;
+    switch (*p){
+    case '<':
+        if ((p+1 >= e) || (p[1] != '<')){
+            // hex string
+            q = memchr(p, '>', e-p);
+            return (q == NULL) ? NULL : q+1;
+        }
+        // fall through
+    case '[':
+        {
+            int dict=(*p == '<');
+
+            p += dict ? 2 : 1;
+            for (;;){
+                p = pdf_skip_ws(p, e);
+                if (p >= e) return NULL;
+                if (dict && (e-p >= 2) && (memcmp(p, ">>", 2) == 0)) return p+2;
+                if (!dict && (*p == ']')) return p+1;
+                if ((p = pdf_skip_value(p, e)) == NULL) return NULL;
+            }
+        }
+    case '(':
+        for (; p<e; p++){
+            if (*p == '\\'){
+                p++;
+            } else if (*p == '('){
+                depth++;
+            } else if ((*p == ')') && (--depth == 0)){
+                return p+1;
+            }
+        }
+        return NULL;
+    default:
+        q = pdf_token_end(p, e);
+        return (q == p) ? NULL : q;
+    }
+}
+
+// a value, or a reference "n g R"
+const char *pdf_skip_obj(const char *p, const char *e){
+    const char *q=pdf_skip_value(p, e), *r, *s;
+
+    if ((q == NULL) || !pdf_is_int(p, q)) return q;
+    r = pdf_skip_ws(q, e);
+    s = pdf_token_end(r, e);
+    if (!pdf_is_int(r, s)) return q;
+    r = pdf_skip_ws(s, e);
+    if ((r < e) && (*r == 'R') && (pdf_token_end(r, e) == r+1)) return r+1;
+    return q;
+}
+
+// value of key in dictionary d, to *vend. NULL: none
+const char *pdf_dict_get(const char *d, const char *e, const char *key, const char **vend){
+    const char *p=pdf_skip_ws(d, e), *k, *ke, *v;
+    size_t klen=strlen(key);
+
+    if ((e-p < 2) || (memcmp(p, "<<", 2) != 0)) return NULL;
+    p += 2;
+    for (;;){
+        p = pdf_skip_ws(p, e);
+        if ((p >= e) || (*p != '/')) return NULL; // ">>"
+        k = p;
+        ke = pdf_token_end(p, e);
+        v = pdf_skip_ws(ke, e);
+        if ((p = pdf_skip_obj(v, e)) == NULL) return NULL;
+        if (((size_t)(ke-k) == klen) && (memcmp(k, key, klen) == 0)){
+            *vend = p;
+            return v;
+        }
+    }
+}
+
+// copy of dictionary d without key
+void pdf_dict_without(const char *d, const char *e, const char *key, psbuf_t *out){
+    const char *p=pdf_skip_ws(d, e)+2, *k, *ke;
+    size_t klen=strlen(key);
+
+    psbuf_add(out, "<<", 2);
+    for (;;){
+        p = pdf_skip_ws(p, e);
+        if ((p >= e) || (*p != '/')) break;
+        k = p;
+        ke = pdf_token_end(p, e);
+        if ((p = pdf_skip_obj(pdf_skip_ws(ke, e), e)) == NULL) break;
+        if (((size_t)(ke-k) != klen) || (memcmp(k, key, klen) != 0)){
+            psbuf_add(out, " ", 1);
+            psbuf_add(out, k, p-k);
+        }
+    }
+    psbuf_add(out, " >>", 3);
+}
+
+//
+// references
+
+// the object kept for n
+int pdfopt_kept(pdoc_t *d, int n){
+    while ((n > 0) && (n < d->nobj) && (d->objs[n].alias != 0)){
+        n = d->objs[n].alias;
+    }
+    return n;
+}
+
+// merged objects and unused lengths are not written
+int pdfopt_dropped(pdoc_t *d, int n){
+    pobj_t *ob=&d->objs[n];
+
+    return (ob->val == NULL) || (ob->alias != 0) || (ob->length_of && (ob->refs == 0));
+}
+
+// number of object n in output
+int pdfopt_num(pdoc_t *d, int n){
+    return (d->renumber && (n < d->nobj)) ? d->objs[n].newnum : n;
+}
+
+// references in [p, e) are rewritten to the kept objects (out), listed
+// (list), or counted (neither).
+void pdfopt_refs(pdoc_t *d, const char *p, const char *e, psbuf_t *out, plist_t *list){
+    const char *q, *r;
+    char buf[S_LEN];
+
+    while (p < e){
+        if ((e-p >= 2) && ((memcmp(p, "<<", 2) == 0) || (memcmp(p, ">>", 2) == 0))){
+            q = p+2;
+        } else if ((*p == '(') || (*p == '<')){
+            // string
+            if ((q = pdf_skip_value(p, e)) == NULL) q = e;
+        } else if (*p == '/'){
+            q = pdf_token_end(p, e);
+        } else if ((*p >= '0') && (*p <= '9')){
+            q = pdf_token_end(p, e);
+            r = pdf_skip_obj(p, e);
+            if (pdf_is_int(p, q) && (r != NULL) && (r > q)){
+                int n=pdfopt_kept(d, atoi(p));
+
+                if (out != NULL){
+                    psbuf_add(out, buf, snprintf(buf, S_LEN, "%d", pdfopt_num(d, n)));
+                    psbuf_add(out, q, r-q); // " 0 R"
+                } else if (list != NULL){
+                    if (n < d->nobj) plist_add(list, n);
+                } else {
+                    if (n < d->nobj) d->objs[n].refs++;
+                }
+                p = r;
+                continue;
+            }
+        } else {
+            q = p+1;
+        }
+        if (out != NULL) psbuf_add(out, p, q-p);
+        p = q;
+    }
+}
+
+// references of object n, to the kept objects
+void pdfopt_object_refs(pdoc_t *d, int n, plist_t *list){
+    pobj_t *ob=&d->objs[n];
+
+    if (ob->data != NULL){
+        pdfopt_refs(d, ob->dict, ob->dict+strlen(ob->dict), NULL, list);
+    } else {
+        pdfopt_refs(d, ob->val, ob->val+ob->vlen, NULL, list);
+    }
+}
+
+//
+// input
+
+// objects and trailer of the classic xref table. 0: not rewritable
+int pdfopt_parse(pdoc_t *d){
+    const char *b=d->buf, *e=d->end, *p, *q, *v, *ve;
+    char *t;
+    long xref;
+    int n, nalloc=0;
+
+    if ((e-b < 32) || (strncmp(b, "%PDF-1.", 7) != 0)) return 0;
+    d->version = b[7]-'0';
+    // startxref near the end
+    for (p=e-9; (p > b) && (p > e-1024); p--){
+        if (memcmp(p, "startxref", 9) == 0) break;
+    }
+    if (memcmp(p, "startxref", 9) != 0) return 0;
+    xref = strtol(p+9, NULL, 10);
+    if ((xref <= 0) || (xref >= e-b-4) || (memcmp(b+xref, "xref", 4) != 0)) {
+        return 0; // e.g. an xref stream
+    }
+    // xref table: subsections of "start count" and 20-byte entries
+    p = b+xref+4;
+    for (;;){
+        long start, count, i, off, gen;
+
+        p = pdf_skip_ws(p, e);
+        if ((e-p >= 7) && (memcmp(p, "trailer", 7) == 0)) break;
+        start = strtol(p, &t, 10);
+        if ((const char *)t == p) return 0;
+        count = strtol(t, &t, 10);
+        if ((start < 0) || (count < 0) || (e-t < count*18)) return 0;
+        for (i=0, p=t; i<count; i++){
+            off = strtol(p, &t, 10);
+            gen = strtol(t, &t, 10);
+            q = pdf_skip_ws(t, e);
+            if (q >= e) return 0;
+            p = q+1;
+            n = start+i;
+            if (n >= nalloc){
+                int old=nalloc;
+
+                nalloc = (n+1)*2;
+                d->objs = realloc(d->objs, sizeof(pobj_t)*nalloc);
+                memset(&d->objs[old], 0, sizeof(pobj_t)*(nalloc-old));
+            }
+            if (n >= d->nobj) d->nobj = n+1;
+            if ((*q == 'n') && (gen == 0) && (off > 0) && (off < e-b)){
+                d->objs[n].val = b+off; // "n 0 obj", parsed below
+            }
+        }
+    }
+    // trailer
+    p = pdf_skip_ws(p+7, e);
+    if ((q = pdf_skip_value(p, e)) == NULL) return 0;
+    if ((pdf_dict_get(p, q, "/Prev", &ve) != NULL)
+        || (pdf_dict_get(p, q, "/Encrypt", &ve) != NULL)) return 0;
+    if ((v = pdf_dict_get(p, q, "/Size", &ve)) != NULL){
+        n = atoi(v);
+        if (n > d->nobj){
+            d->objs = realloc(d->objs, sizeof(pobj_t)*n);
+            memset(&d->objs[d->nobj], 0, sizeof(pobj_t)*(n-d->nobj));
+            d->nobj = n;
+        }
+    }
+    if ((d->root = pdf_dict_get(p, q, "/Root", &d->root_e)) == NULL) return 0;
+    d->info = pdf_dict_get(p, q, "/Info", &d->info_e);
+    d->id = pdf_dict_get(p, q, "/ID", &d->id_e);
+
+    // objects
+    for (n=0; n<d->nobj; n++){
+        d->objs[n].spool = -1;
+        d->objs[n].page = -1;
+    }
+    for (n=1; n<d->nobj; n++){
+        pobj_t *ob=&d->objs[n];
+
+        if (ob->val == NULL) continue;
+        if (strtol(ob->val, &t, 10) != n) return 0;
+        strtol(t, &t, 10);
+        p = pdf_skip_ws(t, e);
+        if ((e-p < 3) || (memcmp(p, "obj", 3) != 0)) return 0;
+        ob->val = pdf_skip_ws(p+3, e);
+        if ((q = pdf_skip_obj(ob->val, e)) == NULL) return 0;
+        ob->vlen = q-ob->val;
+        p = pdf_skip_ws(q, e);
+        if ((e-p >= 6) && (memcmp(p, "stream", 6) == 0)){
+            p += 6;
+            if ((p < e) && (*p == '\r')) p++;
+            if ((p < e) && (*p == '\n')) p++;
+            ob->data = p;
+        }
+    }
+    // length of streams, which may be an object
+    for (n=1; n<d->nobj; n++){
+        pobj_t *ob=&d->objs[n];
+        long len;
+
+        if (ob->data == NULL) continue;
+        if ((v = pdf_dict_get(ob->val, ob->val+ob->vlen, "/Length", &ve)) == NULL) return 0;
+        if (pdf_token_end(v, ve) != ve){
+            // reference
+            int m=atoi(v);
+
+            if ((m <= 0) || (m >= d->nobj) || (d->objs[m].val == NULL)) return 0;
+            d->objs[m].length_of = 1;
+            v = d->objs[m].val;
+        }
+        len = strtol(v, NULL, 10);
+        if ((len < 0) || (len > d->end-ob->data)) return 0;
+        ob->len = len;
+        p = pdf_skip_ws(ob->data+len, e);
+        if ((e-p < 9) || (memcmp(p, "endstream", 9) != 0)) return 0;
+        {
+            psbuf_t dict={NULL, 0, 0};
+
+            pdf_dict_without(ob->val, ob->val+ob->vlen, "/Length", &dict);
+            ob->dict = dict.data;
+        }
+    }
+    return 1;
+}
+
+void pdfopt_free_objs(pdoc_t *d){
+    int n;
+
+    for (n=0; n<d->nobj; n++){
+        free(d->objs[n].dict);
+        free(d->objs[n].text);
+        free(d->objs[n].out);
+    }
+    free(d->objs);
+    d->objs = NULL;
+    d->nobj = 0;
+}
+
+// merge identical streams, or identical fonts and graphics states.
+// returns the objects merged.
+int pdfopt_dedup(pdoc_t *d, int streams){
+    int size=1, *table, n, merged=0;
+
+    while (size < d->nobj*2) size *= 2;
+    table = calloc(size, sizeof(int));
+    for (n=1; n<d->nobj; n++){
+        pobj_t *ob=&d->objs[n];
+        unsigned long h=14695981039346656037UL;
+        const char *key, *ve;
+        size_t klen, i;
+        int m;
+
+        if ((ob->val == NULL) || (ob->alias != 0)) continue;
+        if (streams){
+            if (ob->data == NULL) continue;
+            key = ob->dict;
+        } else {
+            psbuf_t text={NULL, 0, 0};
+            const char *v;
+
+            if (ob->data != NULL) continue;
+            // resources, which are safe to share
+            v = pdf_dict_get(ob->val, ob->val+ob->vlen, "/Type", &ve);
+            if ((v == NULL)
+                || !(pdf_token_is(v, ve, "/Font") || pdf_token_is(v, ve, "/FontDescriptor")
+                     || pdf_token_is(v, ve, "/ExtGState"))) continue;
+            pdfopt_refs(d, ob->val, ob->val+ob->vlen, &text, NULL);
+            free(ob->text);
+            ob->text = text.data;
+            key = ob->text;
+        }
+        klen = strlen(key);
+        for (i=0; i<klen; i++) h = (h ^ (unsigned char)key[i])*1099511628211UL;
+        for (i=0; i<ob->len; i++) h = (h ^ (unsigned char)ob->data[i])*1099511628211UL;
+        for (i=h&(size-1); (m = table[i]) != 0; i=(i+1)&(size-1)){
+            pobj_t *other=&d->objs[m];
+            const char *okey=streams ? other->dict : other->text;
+
+            if ((other->len == ob->len) && (strcmp(okey, key) == 0)
+                && ((ob->len == 0) || (memcmp(other->data, ob->data, ob->len) == 0))){
+                break;
+            }
+        }
+        if (m != 0){
+            ob->alias = m;
+            merged++;
+        } else {
+            table[i] = n;
+        }
+    }
+    free(table);
+    return merged;
+}
+
+//
+// recompression
+
+unsigned char *pdfopt_inflate(const unsigned char *src, size_t len, size_t *olen){
+    z_stream z;
+    size_t size=len*4+1024;
+    unsigned char *out=malloc(size);
+    int r;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit(&z) != Z_OK){
+        free(out);
+        return NULL;
+    }
+    z.next_in = (Bytef *)src;
+    z.avail_in = len;
+    do {
+        if (z.total_out == size){
+            size *= 2;
+            out = realloc(out, size);
+        }
+        z.next_out = out+z.total_out;
+        z.avail_out = size-z.total_out;
+        r = inflate(&z, Z_NO_FLUSH);
+    } while (r == Z_OK);
+    inflateEnd(&z);
+    if (r != Z_STREAM_END){
+        free(out);
+        return NULL;
+    }
+    *olen = z.total_out;
+    return out;
+}
+
+unsigned char *pdfopt_deflate(const unsigned char *src, size_t len, int level, size_t *olen){
+    uLongf dlen=compressBound(len);
+    unsigned char *out=malloc(dlen);
+
+    if (compress2(out, &dlen, src, len, level) != Z_OK){
+        free(out);
+        return NULL;
+    }
+    *olen = dlen;
+    return out;
+}
+
+// FlateDecode again at the level, or uncompressed data compressed.
+// Other filters are kept. The smaller one is written.
+void pdfopt_recompress(pdoc_t *d, pobj_t *ob){
+    const char *ve, *f=pdf_dict_get(ob->dict, ob->dict+strlen(ob->dict), "/Filter", &ve);
+    const unsigned char *raw=(const unsigned char *)ob->data;
+    unsigned char *inflated=NULL, *out;
+    size_t rlen=ob->len, olen;
+
+    if (f != NULL){
+        if (!pdf_token_is(f, ve, "/FlateDecode")) return;
+        if ((inflated = pdfopt_inflate(raw, ob->len, &rlen)) == NULL) return;
+        raw = inflated;
+    }
+    out = pdfopt_deflate(raw, rlen, d->o->level, &olen);
+    free(inflated);
+    if ((out != NULL) && (olen < ob->len)){
+        ob->out = out;
+        ob->olen = olen;
+        ob->flate_added = (f == NULL);
+    } else {
+        free(out);
+    }
+}
+
+void *pdfopt_worker(void *arg){
+    pdoc_t *d=arg;
+    int j;
+
+    for (;;){
+        pthread_mutex_lock(&d->lock);
+        j = (d->next_job < d->njobs) ? d->jobs[d->next_job++] : -1;
+        pthread_mutex_unlock(&d->lock);
+        if (j < 0) return NULL;
+        pdfopt_recompress(d, &d->objs[j]);
+    }
+}
+
+// streams from order[pos], up to PDFOPT_WINDOW bytes, on threads.
+// With the spool, the results go there until they are written.
+void pdfopt_window(pdoc_t *d, const int *order, int norder, int pos){
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN), bytes=0;
+    pthread_t *workers;
+    int i, nworkers;
+
+    d->njobs = d->next_job = 0;
+    for (; (pos < norder) && (bytes < PDFOPT_WINDOW); pos++){
+        pobj_t *ob=&d->objs[order[pos]];
+
+        if ((ob->data == NULL) || ob->done) continue;
+        d->jobs[d->njobs++] = order[pos];
+        ob->done = 1;
+        bytes += ob->len;
+    }
+    nworkers = (cpus < 1) ? 1 : (cpus > d->njobs) ? d->njobs : cpus;
+    workers = calloc(nworkers, sizeof(pthread_t));
+    for (i=0; i<nworkers; i++){
+        if (pthread_create(&workers[i], NULL, pdfopt_worker, d) != 0){
+            nworkers = i; // the rest is done by the others
+            break;
+        }
+    }
+    if (nworkers == 0) pdfopt_worker(d);
+    for (i=0; i<nworkers; i++){
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    if (d->spool == NULL) return;
+    for (i=0; i<d->njobs; i++){
+        pobj_t *ob=&d->objs[d->jobs[i]];
+
+        if (ob->out == NULL) continue;
+        if (fwrite(ob->out, 1, ob->olen, d->spool) != ob->olen){
+            if (d->status == CAIRO_STATUS_SUCCESS) perror("Could not write the spool of PDF");
+            d->status = CAIRO_STATUS_WRITE_ERROR; // nothing is written
+        }
+        ob->spool = d->spool_len;
+        d->spool_len += ob->olen;
+        free(ob->out);
+        ob->out = NULL;
+    }
+}
+
+//
+// output
+
+void pdfopt_emit(pdoc_t *d, const void *data, size_t len){
+    if (d->status == CAIRO_STATUS_SUCCESS){
+        d->status = d->o->write(d->o->closure, data, len);
+    }
+    d->offset += len;
+}
+
+void pdfopt_printf(pdoc_t *d, const char *fmt, ...){
+    char buf[S_LEN];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, S_LEN, fmt, ap);
+    va_end(ap);
+    pdfopt_emit(d, buf, (len < S_LEN) ? len : S_LEN-1);
+}
+
+// non-stream object n into the current object stream
+void pdfopt_stm_add(pdoc_t *d, int n){
+    pobj_t *ob=&d->objs[n];
+    char buf[S_LEN];
+
+    if (d->stm_count == 0){
+        d->stm_num = d->next_num++;
+    }
+    psbuf_add(&d->stm_head, buf, snprintf(buf, S_LEN, "%d %zu ", n, d->stm_body.len));
+    pdfopt_refs(d, ob->val, ob->val+ob->vlen, &d->stm_body, NULL);
+    psbuf_add(&d->stm_body, "\n", 1);
+    d->xref[n].type = 2;
+    d->xref[n].f2 = d->stm_num;
+    d->xref[n].f3 = d->stm_count;
+    pdfopt_stat_objs++;
+    if (++d->stm_count >= PDFOPT_OBJSTM){
+        pdfopt_stm_flush(d);
+    }
+}
+
+void pdfopt_stm_flush(pdoc_t *d){
+    size_t first=d->stm_head.len, olen;
+    unsigned char *out;
+
+    if (d->stm_count == 0) return;
+    psbuf_add(&d->stm_head, d->stm_body.data, d->stm_body.len);
+    out = pdfopt_deflate((unsigned char *)d->stm_head.data, d->stm_head.len, d->o->level, &olen);
+    d->xref[d->stm_num].type = 1;
+    d->xref[d->stm_num].f2 = d->offset;
+    pdfopt_printf(d, "%d 0 obj\n<< /Type /ObjStm /N %d /First %zu /Filter /FlateDecode /Length %zu >>\nstream\n",
+                  d->stm_num, d->stm_count, first, olen);
+    pdfopt_emit(d, out, olen);
+    pdfopt_printf(d, "\nendstream\nendobj\n");
+    free(out);
+    d->stm_head.len = d->stm_body.len = 0;
+    d->stm_count = 0;
+    pdfopt_stat_objstm++;
+}
+
+// object n in output: head, the data of stream, and tail
+void pdfopt_object_text(pdoc_t *d, int n, psbuf_t *head, psbuf_t *tail){
+    pobj_t *ob=&d->objs[n];
+    char buf[S_LEN];
+
+    psbuf_add(head, buf, snprintf(buf, S_LEN, "%d 0 obj\n", pdfopt_num(d, n)));
+    if (ob->data == NULL){
+        pdfopt_refs(d, ob->val, ob->val+ob->vlen, head, NULL);
+        psbuf_add(tail, "\nendobj\n", 8);
+        return;
+    }
+    psbuf_add(head, buf, snprintf(buf, S_LEN, "<< /Length %zu%s",
+                                  ((ob->spool >= 0) || (ob->out != NULL)) ? ob->olen : ob->len,
+                                  ob->flate_added ? " /Filter /FlateDecode" : ""));
+    pdfopt_refs(d, ob->dict+2, ob->dict+strlen(ob->dict), head, NULL); // after "<<"
+    psbuf_add(head, "\nstream\n", 8);
+    psbuf_add(tail, "\nendstream\nendobj\n", 18);
+}
+
+long pdfopt_object_size(pdoc_t *d, int n){
+    pobj_t *ob=&d->objs[n];
+    psbuf_t head={NULL, 0, 0}, tail={NULL, 0, 0};
+    long size;
+
+    pdfopt_object_text(d, n, &head, &tail);
+    size = head.len + tail.len;
+    if (ob->data != NULL){
+        size += ((ob->spool >= 0) || (ob->out != NULL)) ? ob->olen : ob->len;
+    }
+    free(head.data);
+    free(tail.data);
+    return size;
+}
+
+void pdfopt_write_object(pdoc_t *d, int n){
+    pobj_t *ob=&d->objs[n];
+    psbuf_t head={NULL, 0, 0}, tail={NULL, 0, 0};
+
+    pdfopt_object_text(d, n, &head, &tail);
+    pdfopt_emit(d, head.data, head.len);
+    if (ob->out != NULL){
+        pdfopt_emit(d, ob->out, ob->olen);
+        free(ob->out);
+        ob->out = NULL;
+        pdfopt_stat_streams++;
+    } else if ((ob->spool >= 0) && (d->spool_map != NULL)){
+        pdfopt_emit(d, d->spool_map+ob->spool, ob->olen);
+        pdfopt_stat_streams++;
+    } else if (ob->data != NULL){
+        pdfopt_emit(d, ob->data, ob->len);
+    }
+    pdfopt_emit(d, tail.data, tail.len);
+    free(head.data);
+    free(tail.data);
+}
+
+// every entry in the smallest width
+void pdfopt_write_xref(pdoc_t *d){
+    int num=d->next_num++, i, w;
+    long max=d->offset, start=d->offset;
+    unsigned char *entries, *p, *out;
+    size_t olen;
+    psbuf_t t={NULL, 0, 0};
+
+    d->xref[0].f3 = 65535;
+    d->xref[num].type = 1;
+    d->xref[num].f2 = start;
+    if (d->next_num > max) max = d->next_num;
+    for (w=1; (w < 8) && ((max >> (8*w)) != 0); w++);
+    p = entries = malloc((size_t)d->next_num*(1+w+2));
+    for (i=0; i<d->next_num; i++){
+        int k;
+
+        *p++ = d->xref[i].type;
+        for (k=w-1; k>=0; k--) *p++ = (d->xref[i].f2 >> (8*k)) & 0xff;
+        *p++ = (d->xref[i].f3 >> 8) & 0xff;
+        *p++ = d->xref[i].f3 & 0xff;
+    }
+    out = pdfopt_deflate(entries, p-entries, d->o->level, &olen);
+    free(entries);
+
+    psbuf_add(&t, " /Root ", 7);
+    pdfopt_refs(d, d->root, d->root_e, &t, NULL);
+    if (d->info != NULL){
+        psbuf_add(&t, " /Info ", 7);
+        pdfopt_refs(d, d->info, d->info_e, &t, NULL);
+    }
+    if (d->id != NULL){
+        psbuf_add(&t, " /ID ", 5);
+        psbuf_add(&t, d->id, d->id_e-d->id);
+    }
+    pdfopt_printf(d, "%d 0 obj\n<< /Type /XRef /Size %d /W [1 %d 2]", num, d->next_num, w);
+    pdfopt_emit(d, t.data, t.len);
+    pdfopt_printf(d, " /Filter /FlateDecode /Length %zu >>\nstream\n", olen);
+    pdfopt_emit(d, out, olen);
+    pdfopt_printf(d, "\nendstream\nendobj\nstartxref\n%ld\n%%%%EOF\n", start);
+    free(out);
+    free(t.data);
+}
+
+// merged objects, and references of the kept ones
+void pdfopt_prepare(pdoc_t *d){
+    int n;
+
+    pdfopt_dedup(d, 1);
+    while (pdfopt_dedup(d, 0) > 0); // a merged font may make its users identical
+    for (n=1; n<d->nobj; n++){
+        if (d->objs[n].alias != 0) pdfopt_stat_dups++;
+    }
+    // /Length is written directly
+    for (n=1; n<d->nobj; n++){
+        if ((d->objs[n].val != NULL) && (d->objs[n].alias == 0)){
+            pdfopt_object_refs(d, n, NULL);
+        }
+    }
+    pdfopt_refs(d, d->root, d->root_e, NULL, NULL);
+    if (d->info != NULL) pdfopt_refs(d, d->info, d->info_e, NULL, NULL);
+    d->jobs = calloc(d->nobj, sizeof(int));
+    pthread_mutex_init(&d->lock, NULL);
+}
+
+// object streams and an xref stream
+void pdfopt_rewrite(pdoc_t *d){
+    plist_t order={NULL, 0, 0};
+    int n, i;
+
+    for (n=1; n<d->nobj; n++){
+        if (!pdfopt_dropped(d, n)) plist_add(&order, n);
+    }
+    d->xref = calloc(d->nobj + d->nobj/PDFOPT_OBJSTM + 2, sizeof(pxref_t));
+    d->next_num = d->nobj;
+
+    pdfopt_printf(d, "%%PDF-1.%d\n%%\xe2\xe3\xcf\xd3\n", (d->version > 5) ? d->version : 5);
+    for (i=0; i<order.n; i++){
+        pobj_t *ob=&d->objs[n=order.v[i]];
+
+        if (ob->data == NULL){
+            pdfopt_stm_add(d, n);
+            continue;
+        }
+        if (!ob->done){
+            pdfopt_window(d, order.v, order.n, i);
+        }
+        d->xref[n].type = 1;
+        d->xref[n].f2 = d->offset;
+        pdfopt_write_object(d, n);
+    }
+    pdfopt_stm_flush(d);
+    pdfopt_write_xref(d);
+
+    free(order.v);
+    free(d->xref);
+    free(d->stm_head.data);
+    free(d->stm_body.data);
+}
+
+// the optimized PDF is written, and o is freed. returns the status of
+// output, or an error when the PDF could not be read back.
+cairo_status_t pdfopt_close(pdfopt_t *o){
+    pdoc_t d;
+    struct timespec t0, t1;
+    char *map=MAP_FAILED;
+    int done=0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    memset(&d, 0, sizeof(d));
+    d.o = o;
+    // a terminator for strtol()
+    if ((fputc('\0', o->in) != EOF) && (fflush(o->in) == 0)){
+        map = mmap(NULL, o->len+1, PROT_READ, MAP_PRIVATE, fileno(o->in), 0);
+    }
+    if (map == MAP_FAILED){
+        perror("Could not map the temporary file of PDF");
+        fclose(o->in);
+        free(o);
+        return CAIRO_STATUS_WRITE_ERROR;
+    }
+    d.buf = map;
+    d.end = map+o->len;
+    if ((o->len > 0) && pdfopt_parse(&d)){
+        pdfopt_prepare(&d);
+        if (o->linearize){
+            done = pdfopt_linearize(&d);
+        }
+        if (!done){
+            pdfopt_rewrite(&d);
+        }
+        pthread_mutex_destroy(&d.lock);
+        free(d.jobs);
+    } else {
+        // not made by utpdf: as it is
+        d.offset = 0;
+        pdfopt_emit(&d, map, o->len);
+        pdfopt_stat_kept++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pdfopt_stat_docs++;
+    pdfopt_stat_in += o->len;
+    pdfopt_stat_out += d.offset;
+    pdfopt_stat_seconds += (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9;
+
+    pdfopt_free_objs(&d);
+    munmap(map, o->len+1);
+    fclose(o->in);
+    free(o);
+    return d.status;
+}
+
+void pdfopt_report(){
+    if (pdfopt_stat_docs == 0){
+        return;
+    }
+    fprintf(stderr, "%s: optimize: %ld -> %ld bytes (%.1f%%) in %.3f sec\n",
+            utpdf_prog_name, pdfopt_stat_in, pdfopt_stat_out,
+            (pdfopt_stat_in > 0) ? 100.0*pdfopt_stat_out/pdfopt_stat_in : 0.0,
+            pdfopt_stat_seconds);
+    fprintf(stderr, "%s: optimize: %d objects in %d object streams, %d streams recompressed,"
+            " %d duplicates merged\n", utpdf_prog_name, pdfopt_stat_objs, pdfopt_stat_objstm,
+            pdfopt_stat_streams, pdfopt_stat_dups);
+    if (pdflinear_stat_len > 0){
+        fprintf(stderr, "%s: linearize: the first page in %ld of %ld bytes (%.1f%%)\n",
+                utpdf_prog_name, pdflinear_stat_first, pdflinear_stat_len,
+                100.0*pdflinear_stat_first/pdflinear_stat_len);
+    }
+    if (pdfopt_stat_kept > 0){
+        fprintf(stderr, "%s: optimize: %d documents written as they were\n",
+                utpdf_prog_name, pdfopt_stat_kept);
+    }
+}
+
+// end of pdfopt.c
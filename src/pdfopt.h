@@ -0,0 +1,141 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __PDFOPT_H__
+#define __PDFOPT_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <cairo.h>
+#include "psstream.h"
+
+#define PDFOPT_LEVEL  9    // default deflate level of --optimize
+#define PDFOPT_OBJSTM 100  // objects per object stream
+#define PDFOPT_WINDOW (8*1024*1024) // bytes of streams recompressed at once
+
+/*
+  optimizer of a finished PDF: the output of cairo or of the native
+  writer is spooled here, and rewritten at pdfopt_close() with object
+  streams, an xref stream, streams recompressed on threads and
+  identical objects merged. With linearize, it is rewritten into
+  linearized PDF (pdflinear.c) instead of object streams.
+*/
+typedef struct pdf_optimizer {
+    cairo_write_func_t write; // downstream
+    void *closure;
+    FILE *in;                 // the whole PDF, in a temporary file
+    size_t len;
+    int level;                // deflate level
+    int linearize;
+} pdfopt_t;
+
+// list of object numbers
+typedef struct pdfopt_list {
+    int *v;
+    int n, alloc;
+} plist_t;
+
+// an object of the input
+typedef struct pdfopt_object {
+    const char *val;       // value of "n 0 obj" (NULL: free)
+    size_t vlen;
+    const char *data;      // stream data (NULL: not a stream)
+    size_t len;
+    char *dict;            // stream: dictionary without /Length
+    char *text;            // rewritten value, to find identical objects
+    int alias;             // identical to this object (0: none)
+    int refs;              // references from the kept objects
+    int length_of;         // /Length of a stream
+    int done;              // recompressed
+    unsigned char *out;    // recompressed data (NULL: the input data)
+    size_t olen;
+    int flate_added;       // the input data was not compressed
+    long spool;            // recompressed data in the spool (-1: none)
+    // linearization
+    int newnum;            // object number in output
+    int page;              // the page which uses it (-1: none, -2: shared)
+    int mark;              // visited from the page mark-1
+    int tree;              // a node of the page tree
+    int first;             // used by the first page
+    int shared_id;         // in the shared object hint table
+    long size, offset;     // in output
+} pobj_t;
+
+// entry of xref stream
+typedef struct pdfopt_xref {
+    int type;   // 0: free, 1: offset, 2: in an object stream
+    long f2;
+    int f3;
+} pxref_t;
+
+typedef struct pdfopt_doc {
+    pdfopt_t *o;
+    const char *buf, *end;
+    pobj_t *objs;
+    int nobj, version;
+    const char *root, *info, *id; // values in the trailer (id may be NULL)
+    const char *root_e, *info_e, *id_e;
+    int renumber;          // references are written with newnum
+    // output
+    cairo_status_t status;
+    long offset;
+    pxref_t *xref;
+    int next_num;          // number of the next new object
+    psbuf_t stm_head, stm_body;
+    int stm_num, stm_count;
+    // recompression on threads
+    int *jobs, njobs, next_job;
+    pthread_mutex_t lock;
+    // recompressed data until it is written (NULL: kept in memory)
+    FILE *spool;
+    long spool_len;
+    const unsigned char *spool_map;
+} pdoc_t;
+
+extern pdfopt_t *pdfopt_new(cairo_write_func_t write, void *closure, int level, int linearize);
+extern cairo_status_t pdfopt_write
+	(void *closure, const unsigned char *data, unsigned int length);
+extern cairo_status_t pdfopt_close(pdfopt_t *o);
+extern void pdfopt_report();
+
+// shared with pdflinear.c, and pdfwriter.c for incremental mode
+extern int pdfopt_parse(pdoc_t *d);
+extern void pdfopt_free_objs(pdoc_t *d);
+extern const char *pdf_dict_get(const char *d, const char *e, const char *key, const char **vend);
+extern int pdf_token_is(const char *p, const char *q, const char *s);
+extern void plist_add(plist_t *l, int n);
+extern int pdfopt_kept(pdoc_t *d, int n);
+extern int pdfopt_dropped(pdoc_t *d, int n);
+extern void pdfopt_refs(pdoc_t *d, const char *p, const char *e, psbuf_t *out, plist_t *list);
+extern void pdfopt_object_refs(pdoc_t *d, int n, plist_t *list);
+extern void pdfopt_window(pdoc_t *d, const int *order, int norder, int pos);
+extern void pdfopt_emit(pdoc_t *d, const void *data, size_t len);
+extern void pdfopt_printf(pdoc_t *d, const char *fmt, ...);
+extern void pdfopt_object_text(pdoc_t *d, int n, psbuf_t *head, psbuf_t *tail);
+extern long pdfopt_object_size(pdoc_t *d, int n);
+extern void pdfopt_write_object(pdoc_t *d, int n);
+extern void pdfopt_rewrite(pdoc_t *d);
+extern int pdfopt_linearize(pdoc_t *d);
+
+// for --stats
+extern long pdflinear_stat_first, pdflinear_stat_len;
+
+#endif
+
+// end of pdfopt.h
@@ -0,0 +1,995 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <zlib.h>
+
+#include "utpdf.h"
+#include "pdfwriter.h"
+#include "pdfopt.h"
+
+/*
+  native PDF writer
+
+  utpdf draws only text, lines, arcs and filled triangles, so this
+  writes them to PDF directly, instead of cairo's PDF surface.
+
+  - every page is written as soon as it is finished:
+      <content stream> <page>
+    fonts, resources, page tree, catalog and xref follow the last page.
+  - coordinates are transformed to the page here, so the content streams
+    have no "cm" nor "q/Q", and color and line width are written only
+    when they are changed.
+  - text is written by glyph ids of the shaped runs with Identity-H,
+    and the fonts are embedded as subsets which keep the glyph ids.
+  - every stream is compressed with zlib.
+  - consecutive runs of text are in one text object (BT ... ET), which
+    is closed before painting paths or forms.
+  - strokes are batched per color and line width, and painted as one
+    path at the end of page (or before a form).
+  - decorations repeated on pages are forms (XObject), which are
+    recorded once in user space and painted with the matrix of page.
+  - pages of a previous output may be copied as they are, with the
+    objects they use (incremental mode, pdfw_copy_pages()).
+*/
+
+#define PDFW_CMAP_MAX 100 // entries per beginbfchar
+
+//
+// forward declaration
+int pdfw_reserve(pdfw_t *w);
+void pdfw_obj_begin(pdfw_t *w, int n);
+void pdfw_stream(pdfw_t *w, int n, const char *dict, const char *data, size_t len);
+void pdfw_point(pdfw_t *w, double x, double y, double *px, double *py);
+void pdfw_path_op(pdfw_t *w, int n, double *xy, const char *op);
+void pdfw_stroke_state(pdfw_t *w);
+void pdfw_fill_state(pdfw_t *w);
+void pdfw_font(pdfw_t *w, fontsub_t *fs);
+void pdfw_tounicode(pdfw_t *w, fontsub_t *fs, int n);
+void pdfw_date(pdfw_t *w, char *buf);
+void pdfw_form_glyph(pdfw_t *w, fontsub_t *fs, unsigned int gid, gunichar uc);
+int pdfw_prev_pages(pdoc_t *d, plist_t *kids, int npages);
+//
+//
+
+//
+// output
+
+void pdfw_emit(pdfw_t *w, const char *data, size_t len){
+    if (w->status == CAIRO_STATUS_SUCCESS){
+        w->status = w->write(w->closure, (const unsigned char *)data, len);
+    }
+    w->offset += len;
+}
+
+void pdfw_printf(pdfw_t *w, const char *fmt, ...){
+    char buf[S_LEN];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, S_LEN, fmt, ap);
+    va_end(ap);
+    pdfw_emit(w, buf, (len < S_LEN) ? len : S_LEN-1);
+}
+
+// shortest form of number: 12.5, 0, -3.25
+void pdfw_num(char *buf, double v){
+    int len=snprintf(buf, PDFW_NUMLEN, "%.3f", v);
+
+    while (buf[len-1] == '0') buf[--len] = '\0';
+    if (buf[len-1] == '.') buf[--len] = '\0';
+    if (strcmp(buf, "-0") == 0) strcpy(buf, "0");
+}
+
+// "v[0] v[1] ... op\n"
+void pdfw_ops(psbuf_t *b, int n, const double *v, const char *op){
+    char num[PDFW_NUMLEN];
+    int i;
+
+    for (i=0; i<n; i++){
+        pdfw_num(num, v[i]);
+        psbuf_add(b, num, strlen(num));
+        psbuf_add(b, " ", 1);
+    }
+    psbuf_add(b, op, strlen(op));
+    psbuf_add(b, "\n", 1);
+}
+
+int pdfw_reserve(pdfw_t *w){
+    w->nobj++;
+    if (w->nobj >= w->xalloc){
+        w->xalloc *= 2;
+        w->xref = realloc(w->xref, sizeof(long)*w->xalloc);
+    }
+    w->xref[w->nobj] = 0;
+    return w->nobj;
+}
+
+void pdfw_obj_begin(pdfw_t *w, int n){
+    w->xref[n] = w->offset;
+    pdfw_printf(w, "%d 0 obj\n", n);
+}
+
+// compressed stream object
+void pdfw_stream(pdfw_t *w, int n, const char *dict, const char *data, size_t len){
+    uLongf zlen=compressBound(len);
+    Bytef *z=malloc(zlen);
+
+    if (compress2(z, &zlen, (const Bytef *)data, len, Z_DEFAULT_COMPRESSION) != Z_OK){
+        fprintf(stderr, "%s: could not compress PDF stream\n", utpdf_prog_name);
+        w->status = CAIRO_STATUS_NO_MEMORY; // nothing is written after this
+        free(z);
+        return;
+    }
+    pdfw_obj_begin(w, n);
+    pdfw_printf(w, "<< /Length %lu /Filter /FlateDecode %s>>\nstream\n",
+                (unsigned long)zlen, dict);
+    pdfw_emit(w, (const char *)z, zlen);
+    pdfw_printf(w, "\nendstream\nendobj\n");
+    free(z);
+}
+
+// writer without any output yet
+pdfw_t *pdfw_init(cairo_write_func_t write, void *closure, double width, double height){
+    pdfw_t *w=calloc(1, sizeof(pdfw_t));
+
+    w->write = write;
+    w->closure = closure;
+    w->status = CAIRO_STATUS_SUCCESS;
+    w->width = width;
+    w->height = height;
+    w->date = time(NULL);
+    w->xalloc = 64;
+    w->xref = calloc(w->xalloc, sizeof(long));
+    w->nobj = PDFW_INFO; // fixed objects are reserved.
+    w->palloc = 64;
+    w->pages = malloc(sizeof(int)*w->palloc);
+
+    cairo_matrix_init_identity(&w->gs.ctm);
+    w->gs.r = w->gs.g = w->gs.b = 0;
+    w->gs.lw = 2.0; // same as cairo
+    w->sr = w->fr = w->slw = -1; // not set yet
+    return w;
+}
+
+pdfw_t *pdfw_new(cairo_write_func_t write, void *closure, double width, double height){
+    pdfw_t *w=pdfw_init(write, closure, width, height);
+
+    pdfw_emit(w, "%PDF-1.5\n%\xe2\xe3\xcf\xd3\n", 15);
+    return w;
+}
+
+void pdfw_set_date(pdfw_t *w, time_t date){
+    w->date = date;
+}
+
+void pdfw_show_page(pdfw_t *w){
+    int contents=pdfw_reserve(w), page=pdfw_reserve(w);
+
+    pdfw_batch_flush(w);
+    pdfw_text_end(w);
+    pdfw_count_ops(w);
+    pdfw_stream(w, contents, "", w->content.data, w->content.len);
+    pdfw_obj_begin(w, page);
+    pdfw_printf(w, "<< /Type /Page /Parent %d 0 R /Resources %d 0 R /Contents %d 0 R >>\nendobj\n",
+                PDFW_PAGES, PDFW_RESOURCES, contents);
+    if (w->npages >= w->palloc){
+        w->palloc *= 2;
+        w->pages = realloc(w->pages, sizeof(int)*w->palloc);
+    }
+    w->pages[w->npages++] = page;
+    pdfw_page_reset(w);
+}
+
+// an operator per line, but a TJ array of glyphs
+void pdfw_count_ops(pdfw_t *w){
+    size_t i;
+
+    if (w->stats == NULL) return;
+    for (i=0; i<w->content.len; i++){
+        if (w->content.data[i] == '\n') w->stats->ops++;
+    }
+    w->stats->bytes += w->content.len;
+}
+
+// new content stream starts with default graphics state.
+void pdfw_page_reset(pdfw_t *w){
+    w->content.len = 0;
+    w->path.len = 0;
+    w->has_point = 0;
+    w->drawn = 0;
+    w->in_text = 0;
+    w->sr = w->fr = w->slw = -1;
+}
+
+//
+// graphics state
+
+void pdfw_set_rgb(pdfw_t *w, double r, double g, double b){
+    w->gs.r = r;
+    w->gs.g = g;
+    w->gs.b = b;
+}
+
+void pdfw_line_width(pdfw_t *w, double lw){
+    w->gs.lw = lw;
+}
+
+void pdfw_save(pdfw_t *w){
+    if (w->sp < PDFW_STACK){
+        w->stack[w->sp] = w->gs;
+    }
+    w->sp++;
+}
+
+void pdfw_restore(pdfw_t *w){
+    if (w->sp > 0){
+        w->sp--;
+        if (w->sp < PDFW_STACK){
+            w->gs = w->stack[w->sp];
+        }
+    }
+}
+
+void pdfw_translate(pdfw_t *w, double tx, double ty){
+    cairo_matrix_translate(&w->gs.ctm, tx, ty);
+}
+
+void pdfw_rotate(pdfw_t *w, double rad){
+    cairo_matrix_rotate(&w->gs.ctm, rad);
+}
+
+void pdfw_set_matrix(pdfw_t *w, const cairo_matrix_t *m){
+    w->gs.ctm = *m;
+}
+
+// written just before stroke/fill/text, because PDF does not allow
+// to change them in path construction.
+void pdfw_stroke_state(pdfw_t *w){
+    cairo_matrix_t *m=&w->gs.ctm;
+    double v[3], lw=w->gs.lw*sqrt(fabs(m->xx*m->yy - m->xy*m->yx));
+
+    if ((w->sr != w->gs.r) || (w->sg != w->gs.g) || (w->sb != w->gs.b)){
+        v[0] = w->sr = w->gs.r;
+        v[1] = w->sg = w->gs.g;
+        v[2] = w->sb = w->gs.b;
+        pdfw_ops(&w->content, 3, v, "RG");
+    }
+    if (w->slw != lw){
+        v[0] = w->slw = lw;
+        pdfw_ops(&w->content, 1, v, "w");
+    }
+}
+
+void pdfw_fill_state(pdfw_t *w){
+    double v[3];
+
+    if ((w->fr != w->gs.r) || (w->fg != w->gs.g) || (w->fb != w->gs.b)){
+        v[0] = w->fr = w->gs.r;
+        v[1] = w->fg = w->gs.g;
+        v[2] = w->fb = w->gs.b;
+        pdfw_ops(&w->content, 3, v, "rg");
+    }
+}
+
+//
+// path
+
+// user space -> PDF page (y-axis upward)
+void pdfw_point(pdfw_t *w, double x, double y, double *px, double *py){
+    cairo_matrix_transform_point(&w->gs.ctm, &x, &y);
+    *px = x;
+    *py = w->height - y;
+}
+
+// n points in user space, and the last one is the current point.
+void pdfw_path_op(pdfw_t *w, int n, double *xy, const char *op){
+    double v[6];
+    int i;
+
+    for (i=0; i<n; i++){
+        pdfw_point(w, xy[i*2], xy[i*2+1], &v[i*2], &v[i*2+1]);
+    }
+    pdfw_ops(&w->path, n*2, v, op);
+    w->cx = xy[n*2-2];
+    w->cy = xy[n*2-1];
+    w->has_point = 1;
+}
+
+void pdfw_move_to(pdfw_t *w, double x, double y){
+    double xy[2]={x, y};
+
+    pdfw_path_op(w, 1, xy, "m");
+    w->sx = x;
+    w->sy = y;
+}
+
+void pdfw_rel_move_to(pdfw_t *w, double dx, double dy){
+    pdfw_move_to(w, w->cx+dx, w->cy+dy);
+}
+
+void pdfw_line_to(pdfw_t *w, double x, double y){
+    double xy[2]={x, y};
+
+    if (!w->has_point){
+        pdfw_move_to(w, x, y);
+        return;
+    }
+    pdfw_path_op(w, 1, xy, "l");
+}
+
+void pdfw_rel_line_to(pdfw_t *w, double dx, double dy){
+    pdfw_line_to(w, w->cx+dx, w->cy+dy);
+}
+
+void pdfw_curve_to(pdfw_t *w, double x1, double y1, double x2, double y2,
+                   double x3, double y3){
+    double xy[6]={x1, y1, x2, y2, x3, y3};
+
+    if (!w->has_point){
+        pdfw_move_to(w, x1, y1);
+    }
+    pdfw_path_op(w, 3, xy, "c");
+}
+
+// "re" is not used: the page may be rotated.
+void pdfw_rectangle(pdfw_t *w, double x, double y, double dx, double dy){
+    pdfw_move_to(w, x, y);
+    pdfw_rel_line_to(w, dx, 0);
+    pdfw_rel_line_to(w, 0, dy);
+    pdfw_rel_line_to(w, -dx, 0);
+    pdfw_close_path(w);
+}
+
+// same as cairo_arc(): bezier curves per quarter circle at most
+void pdfw_arc(pdfw_t *w, double xc, double yc, double r, double a1, double a2){
+    double step, h, t0, t1;
+    int i, n;
+
+    while (a2 < a1) a2 += 2*PI;
+    n = (int)ceil((a2-a1)/(PI/2));
+    if (n < 1) n = 1;
+    step = (a2-a1)/n;
+    h = 4.0/3.0*tan(step/4);
+
+    if (w->has_point){
+        pdfw_line_to(w, xc+r*cos(a1), yc+r*sin(a1));
+    } else {
+        pdfw_move_to(w, xc+r*cos(a1), yc+r*sin(a1));
+    }
+    for (i=0; i<n; i++){
+        t0 = a1+step*i;
+        t1 = t0+step;
+        pdfw_curve_to(w,
+                      xc+r*(cos(t0)-h*sin(t0)), yc+r*(sin(t0)+h*cos(t0)),
+                      xc+r*(cos(t1)+h*sin(t1)), yc+r*(sin(t1)-h*cos(t1)),
+                      xc+r*cos(t1), yc+r*sin(t1));
+    }
+}
+
+void pdfw_close_path(pdfw_t *w){
+    psbuf_add(&w->path, "h\n", 2);
+    w->cx = w->sx;
+    w->cy = w->sy;
+}
+
+// the path is added to the batch of the same color and width.
+void pdfw_stroke(pdfw_t *w){
+    cairo_matrix_t *m=&w->gs.ctm;
+    double lw=w->gs.lw*sqrt(fabs(m->xx*m->yy - m->xy*m->yx));
+    pdfbatch_t *b=NULL;
+    int i;
+
+    for (i=0; i<w->nbatch; i++){
+        b = &w->batch[i];
+        if ((b->r == w->gs.r) && (b->g == w->gs.g) && (b->b == w->gs.b) && (b->lw == lw)){
+            break;
+        }
+    }
+    if (i == w->nbatch){
+        if (w->nbatch >= w->balloc){
+            w->balloc = (w->balloc > 0) ? w->balloc*2 : 8;
+            w->batch = realloc(w->batch, sizeof(pdfbatch_t)*w->balloc);
+            memset(&w->batch[w->nbatch], 0, sizeof(pdfbatch_t)*(w->balloc-w->nbatch));
+        }
+        b = &w->batch[w->nbatch++];
+        b->r = w->gs.r;
+        b->g = w->gs.g;
+        b->b = w->gs.b;
+        b->lw = lw;
+        b->path.len = 0;
+    }
+    psbuf_add(&b->path, w->path.data, w->path.len);
+    w->path.len = 0;
+    w->has_point = 0;
+    w->drawn = 1;
+}
+
+void pdfw_batch_flush(pdfw_t *w){
+    pdfgs_t gs=w->gs;
+    int i;
+
+    if (w->nbatch == 0) return;
+    pdfw_text_end(w);
+    cairo_matrix_init_identity(&w->gs.ctm);
+    for (i=0; i<w->nbatch; i++){
+        pdfbatch_t *b=&w->batch[i];
+
+        w->gs.r = b->r;
+        w->gs.g = b->g;
+        w->gs.b = b->b;
+        w->gs.lw = b->lw;
+        pdfw_stroke_state(w);
+        psbuf_add(&w->content, b->path.data, b->path.len);
+        psbuf_add(&w->content, "S\n", 2);
+    }
+    w->nbatch = 0;
+    w->gs = gs;
+}
+
+void pdfw_fill(pdfw_t *w){
+    pdfw_text_end(w);
+    pdfw_fill_state(w);
+    psbuf_add(&w->content, w->path.data, w->path.len);
+    psbuf_add(&w->content, "f\n", 2);
+    w->path.len = 0;
+    w->has_point = 0;
+    w->drawn = 1;
+}
+
+void pdfw_get_current_point(pdfw_t *w, double *x, double *y){
+    *x = w->has_point ? w->cx : 0;
+    *y = w->has_point ? w->cy : 0;
+}
+
+//
+// text
+
+/*
+  One run of glyphs, which has its origin of baseline at (x, y).
+
+  Glyphs are written in TJ, and the difference between the advance in
+  the font and the position by pango is adjusted in the array.
+  The rounding error is carried to the next glyph, not to be piled up.
+*/
+void pdfw_glyphs(pdfw_t *w, PangoFont *font, PangoGlyphString *glyphs,
+                 const char *text, double x, double y){
+    fontsub_t *fs=fontsub_get(&w->fonts, font);
+    PangoFontDescription *desc;
+    cairo_matrix_t *m=&w->gs.ctm;
+    double size, pen=0, seg=0, pdfpen=0, v[6];
+    char buf[PDFW_NUMLEN];
+    int i, in_seg=0, in_str=0;
+
+    if ((fs == NULL) || (glyphs->num_glyphs == 0)) return;
+    if (fs->ref == 0){
+        fs->ref = pdfw_reserve(w);
+    }
+    desc = pango_font_describe_with_absolute_size(font);
+    size = (double)pango_font_description_get_size(desc)/PANGO_SCALE;
+    pango_font_description_free(desc);
+    if (size <= 0) return;
+
+    pdfw_fill_state(w);
+    if (!w->in_text){
+        psbuf_add(&w->content, "BT\n", 3);
+        w->in_text = 1;
+        w->tfont = NULL;
+    }
+    if ((w->tfont != fs) || (w->tsize != size)){
+        snprintf(buf, PDFW_NUMLEN, "/F%d", fs->id);
+        v[0] = size;
+        psbuf_add(&w->content, buf, strlen(buf));
+        psbuf_add(&w->content, " ", 1);
+        pdfw_ops(&w->content, 1, v, "Tf");
+        w->tfont = fs;
+        w->tsize = size;
+    }
+
+    for (i=0; i<glyphs->num_glyphs; i++){
+        PangoGlyphInfo *g=&glyphs->glyphs[i];
+        double adv=(double)g->geometry.width/PANGO_SCALE;
+        double xoff=(double)g->geometry.x_offset/PANGO_SCALE;
+        double yoff=(double)g->geometry.y_offset/PANGO_SCALE;
+        int offset=(xoff != 0) || (yoff != 0);
+        gunichar uc=0;
+
+        if ((g->glyph == PANGO_GLYPH_EMPTY) || (g->glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+            || offset){
+            // end of segment
+            if (in_str) psbuf_add(&w->content, ">", 1);
+            if (in_seg) psbuf_add(&w->content, "] TJ\n", 5);
+            in_seg = in_str = 0;
+            if (!offset){
+                pen += adv;
+                continue;
+            }
+        }
+        if ((i == 0) || (glyphs->log_clusters[i] != glyphs->log_clusters[i-1])){
+            uc = g_utf8_get_char(text + glyphs->log_clusters[i]);
+        }
+        fontsub_use(fs, g->glyph, uc);
+        if (w->in_form) pdfw_form_glyph(w, fs, g->glyph, uc);
+
+        if (!in_seg){
+            // text matrix at the origin of this segment
+            double px=x+pen+xoff, py=y+yoff;
+
+            cairo_matrix_transform_point(m, &px, &py);
+            v[0] = m->xx;  v[1] = -m->yx;
+            v[2] = -m->xy; v[3] = m->yy;
+            v[4] = px;     v[5] = w->height - py;
+            pdfw_ops(&w->content, 6, v, "Tm");
+            psbuf_add(&w->content, "[", 1);
+            in_seg = 1;
+            seg = pen;
+            pdfpen = 0;
+        }
+        if (!in_str){
+            psbuf_add(&w->content, "<", 1);
+            in_str = 1;
+        }
+        // the procset of pswriter.c is indexed by glyph id
+        snprintf(buf, PDFW_NUMLEN, "%04X", w->ps ? g->glyph : fontsub_cid(fs, g->glyph));
+        psbuf_add(&w->content, buf, strlen(buf));
+        pen += adv;
+
+        if (offset){
+            // a glyph with offset is a segment by itself.
+            psbuf_add(&w->content, ">] TJ\n", 6);
+            in_seg = in_str = 0;
+        } else {
+            int width=fontsub_width(fs, g->glyph);
+            long adjust=lround(width - (pen-seg-pdfpen)*1000/size);
+
+            pdfpen += (width - adjust)*size/1000;
+            if (adjust != 0){
+                snprintf(buf, PDFW_NUMLEN, ">%ld", adjust);
+                psbuf_add(&w->content, buf, strlen(buf));
+                in_str = 0;
+            }
+        }
+    }
+    if (in_str) psbuf_add(&w->content, ">", 1);
+    if (in_seg) psbuf_add(&w->content, "] TJ\n", 5);
+    w->drawn = 1;
+}
+
+void pdfw_text_end(pdfw_t *w){
+    if (w->in_text){
+        psbuf_add(&w->content, "ET\n", 3);
+        w->in_text = 0;
+    }
+}
+
+//
+// forms
+
+// record the drawing in user space, until pdfw_form_end().
+void pdfw_form_begin(pdfw_t *w){
+    pdfform_t *f;
+
+    if (w->nforms >= w->falloc){
+        w->falloc = (w->falloc > 0) ? w->falloc*2 : 8;
+        w->forms = realloc(w->forms, sizeof(pdfform_t)*w->falloc);
+    }
+    f = &w->forms[w->nforms++];
+    memset(f, 0, sizeof(pdfform_t));
+    pdfw_batch_flush(w);
+    pdfw_text_end(w);
+    w->page_content = w->content;
+    memset(&w->content, 0, sizeof(psbuf_t));
+    w->page_gs = w->gs;
+    cairo_matrix_init_identity(&w->gs.ctm);
+    w->sr = w->fr = w->slw = -1;
+    w->in_form = 1;
+}
+
+// returns the id of form for pdfw_paint_form()
+int pdfw_form_end(pdfw_t *w){
+    pdfform_t *f=&w->forms[w->nforms-1];
+    char dict[S_LEN];
+    int m=(int)ceil(2*(w->width+w->height)); // user space may be rotated
+
+    pdfw_batch_flush(w);
+    pdfw_text_end(w);
+    f->content = w->content;
+    w->content = w->page_content;
+    w->gs = w->page_gs;
+    w->sr = w->fr = w->slw = -1;
+    w->in_form = 0;
+    if (!w->ps){
+        f->ref = pdfw_reserve(w);
+        snprintf(dict, S_LEN, "/Type /XObject /Subtype /Form /BBox [%d %d %d %d] /Resources %d 0 R ",
+                 -m, -m, m, m, PDFW_RESOURCES);
+        pdfw_stream(w, f->ref, dict, f->content.data, f->content.len);
+        free(f->content.data);
+        memset(&f->content, 0, sizeof(psbuf_t));
+    } else if (!w->prolog){
+        // written in the setup with the prolog, otherwise in every page.
+        f->defined = 1;
+    }
+    return w->nforms-1;
+}
+
+void pdfw_form_glyph(pdfw_t *w, fontsub_t *fs, unsigned int gid, gunichar uc){
+    pdfform_t *f=&w->forms[w->nforms-1];
+
+    if (f->nglyphs >= f->galloc){
+        f->galloc = (f->galloc > 0) ? f->galloc*2 : 64;
+        f->glyphs = realloc(f->glyphs, sizeof(pdfgid_t)*f->galloc);
+    }
+    f->glyphs[f->nglyphs].fs = fs;
+    f->glyphs[f->nglyphs].gid = gid;
+    f->glyphs[f->nglyphs].uc = uc;
+    f->nglyphs++;
+}
+
+void pdfw_paint_form(pdfw_t *w, int id){
+    pdfform_t *f=&w->forms[id];
+    cairo_matrix_t flip, m;
+    double v[6];
+    char buf[PDFW_NUMLEN];
+    int i;
+
+    pdfw_batch_flush(w);
+    pdfw_text_end(w);
+    // form (y-axis upward) -> user space -> page
+    cairo_matrix_init(&flip, 1, 0, 0, -1, 0, w->height);
+    cairo_matrix_multiply(&m, &flip, &w->gs.ctm);
+    cairo_matrix_multiply(&m, &m, &flip);
+
+    psbuf_add(&w->content, "q\n", 2);
+    if ((m.xx != 1) || (m.yx != 0) || (m.xy != 0) || (m.yy != 1)
+        || (m.x0 != 0) || (m.y0 != 0)){
+        v[0] = m.xx; v[1] = m.yx;
+        v[2] = m.xy; v[3] = m.yy;
+        v[4] = m.x0; v[5] = m.y0;
+        pdfw_ops(&w->content, 6, v, "cm");
+    }
+    if (w->ps && !f->defined){
+        psbuf_add(&w->content, f->content.data, f->content.len);
+    } else {
+        snprintf(buf, PDFW_NUMLEN, "/Fm%d Do\n", id);
+        psbuf_add(&w->content, buf, strlen(buf));
+    }
+    psbuf_add(&w->content, "Q\n", 2);
+
+    for (i=0; i<f->nglyphs; i++){
+        fontsub_use(f->glyphs[i].fs, f->glyphs[i].gid, f->glyphs[i].uc);
+    }
+    if (w->ps){
+        // colors of the procset are not in the graphics state.
+        w->sr = w->fr = -1;
+    }
+    w->drawn = 1;
+}
+
+void pdfw_batch_free(pdfw_t *w){
+    int i;
+
+    for (i=0; i<w->balloc; i++){
+        free(w->batch[i].path.data);
+    }
+    free(w->batch);
+}
+
+void pdfw_forms_free(pdfw_t *w){
+    int i;
+
+    for (i=0; i<w->nforms; i++){
+        free(w->forms[i].content.data);
+        free(w->forms[i].glyphs);
+    }
+    free(w->forms);
+}
+
+//
+// end of document
+
+// Type0 font, CID font, descriptor, font file and ToUnicode
+void pdfw_font(pdfw_t *w, fontsub_t *fs){
+    int cidfont=pdfw_reserve(w), desc=pdfw_reserve(w);
+    int file=pdfw_reserve(w), tounicode=pdfw_reserve(w);
+    char tag[FS_TAGLEN], dict[S_LEN];
+    int bbox[4], n=0, prev=-2;
+    unsigned int gid, len;
+    hb_blob_t *blob;
+    const char *data;
+
+    fontsub_tag(fs, tag);
+    pdfw_obj_begin(w, fs->ref);
+    pdfw_printf(w, "<< /Type /Font /Subtype /Type0 /BaseFont /%s+%s /Encoding /Identity-H\n"
+                "   /DescendantFonts [%d 0 R] /ToUnicode %d 0 R >>\nendobj\n",
+                tag, fs->name, cidfont, tounicode);
+
+    // widths of used glyphs: cid [w w ...] cid [w ...]
+    pdfw_obj_begin(w, cidfont);
+    pdfw_printf(w, "<< /Type /Font /Subtype /CIDFontType%d /BaseFont /%s+%s\n"
+                "   /CIDSystemInfo << /Registry (Adobe) /Ordering (Identity) /Supplement 0 >>\n"
+                "   /FontDescriptor %d 0 R%s\n   /W [",
+                fs->cff ? 0 : 2, tag, fs->name, desc,
+                fs->cff ? "" : " /CIDToGIDMap /Identity");
+    for (gid=0; gid<fs->nglyphs; gid++){
+        int cid=fontsub_cid(fs, gid);
+
+        if (!fs->used[gid]) continue;
+        if (cid != prev+1){
+            pdfw_printf(w, "%s%d [", (prev < 0) ? "" : "]\n    ", cid);
+        }
+        pdfw_printf(w, " %d", fontsub_width(fs, gid));
+        prev = cid;
+        n++;
+    }
+    pdfw_printf(w, "%s] >>\nendobj\n", (prev < 0) ? "" : "]");
+
+    fontsub_bbox(fs, bbox);
+    pdfw_obj_begin(w, desc);
+    pdfw_printf(w, "<< /Type /FontDescriptor /FontName /%s+%s /Flags 4\n"
+                "   /FontBBox [%d %d %d %d] /ItalicAngle 0 /Ascent %d /Descent %d\n"
+                "   /CapHeight %d /StemV 80 /FontFile%s %d 0 R >>\nendobj\n",
+                tag, fs->name, bbox[0], bbox[1], bbox[2], bbox[3],
+                fontsub_ascent(fs), fontsub_descent(fs), fontsub_capheight(fs),
+                fs->cff ? "3" : "2", file);
+
+    blob = fontsub_subset(fs, FS_USED);
+    data = hb_blob_get_data(blob, &len);
+    if (fs->cff){
+        snprintf(dict, S_LEN, "/Subtype /OpenType ");
+    } else {
+        snprintf(dict, S_LEN, "/Length1 %u ", len);
+    }
+    pdfw_stream(w, file, dict, data, len);
+    hb_blob_destroy(blob);
+
+    pdfw_tounicode(w, fs, tounicode);
+}
+
+// glyph id -> unicode, to copy text from PDF
+void pdfw_tounicode(pdfw_t *w, fontsub_t *fs, int n){
+    psbuf_t cmap={NULL, 0, 0};
+    char buf[S_LEN];
+    unsigned int gid, i, count=0;
+    static const char *head=
+        "/CIDInit /ProcSet findresource begin\n"
+        "12 dict begin\nbegincmap\n"
+        "/CIDSystemInfo << /Registry (Adobe) /Ordering (UCS) /Supplement 0 >> def\n"
+        "/CMapName /Adobe-Identity-UCS def\n/CMapType 2 def\n"
+        "1 begincodespacerange\n<0000> <FFFF>\nendcodespacerange\n";
+    static const char *tail=
+        "endcmap\nCMapName currentdict /CMap defineresource pop\nend\nend\n";
+
+    psbuf_add(&cmap, head, strlen(head));
+    for (gid=0; gid<fs->nglyphs; gid++){
+        if (fs->used[gid] && (fs->uni[gid] != 0)) count++;
+    }
+    i = 0;
+    for (gid=0; gid<fs->nglyphs; gid++){
+        gunichar uc=fs->uni[gid];
+        int len;
+
+        if (!fs->used[gid] || (uc == 0)) continue;
+        if (i % PDFW_CMAP_MAX == 0){
+            len = snprintf(buf, S_LEN, "%u beginbfchar\n",
+                           (count-i < PDFW_CMAP_MAX) ? count-i : PDFW_CMAP_MAX);
+            psbuf_add(&cmap, buf, len);
+        }
+        if (uc < 0x10000){
+            len = snprintf(buf, S_LEN, "<%04X> <%04X>\n", fontsub_cid(fs, gid), uc);
+        } else {
+            // surrogate pair
+            uc -= 0x10000;
+            len = snprintf(buf, S_LEN, "<%04X> <%04X%04X>\n", fontsub_cid(fs, gid),
+                           0xD800 + (uc >> 10), 0xDC00 + (uc & 0x3FF));
+        }
+        psbuf_add(&cmap, buf, len);
+        i++;
+        if ((i % PDFW_CMAP_MAX == 0) || (i == count)){
+            psbuf_add(&cmap, "endbfchar\n", 10);
+        }
+    }
+    psbuf_add(&cmap, tail, strlen(tail));
+    pdfw_stream(w, n, "", cmap.data, cmap.len);
+    free(cmap.data);
+}
+
+//
+// pages of a previous output
+
+// catalog -> page tree -> pages, as pdfw_finish() writes them.
+// returns the page tree, or 0 if there are not npages pages.
+int pdfw_prev_pages(pdoc_t *d, plist_t *kids, int npages){
+    const char *v, *ve;
+    int i, n;
+
+    n = atoi(d->root);
+    if ((n <= 0) || (n >= d->nobj) || (d->objs[n].val == NULL)
+        || ((v = pdf_dict_get(d->objs[n].val, d->objs[n].val+d->objs[n].vlen,
+                              "/Pages", &ve)) == NULL)) return 0;
+    n = atoi(v);
+    if ((n <= 0) || (n >= d->nobj) || (d->objs[n].val == NULL)
+        || ((v = pdf_dict_get(d->objs[n].val, d->objs[n].val+d->objs[n].vlen,
+                              "/Kids", &ve)) == NULL)) return 0;
+    pdfopt_refs(d, v, ve, NULL, kids);
+    if (kids->n < npages) return 0;
+    for (i=0; i<npages; i++){
+        pobj_t *ob=&d->objs[kids->v[i]];
+
+        if ((ob->val == NULL) || (ob->data != NULL)
+            || ((v = pdf_dict_get(ob->val, ob->val+ob->vlen, "/Type", &ve)) == NULL)
+            || !pdf_token_is(v, ve, "/Page")) return 0;
+    }
+    return n;
+}
+
+/*
+  The first npages pages of buf[0..len), a finished output of this
+  writer (buf[len] is '\0'), are written as pages of w. Every object
+  which they use is copied with a new number: contents, and their
+  resources with the fonts and forms of the previous output. /Parent
+  goes to the page tree of w. Returns npages, or 0 without writing
+  anything, if the previous output is not such a document.
+*/
+int pdfw_copy_pages(pdfw_t *w, const char *buf, size_t len, int npages){
+    pdoc_t d;
+    plist_t kids={NULL, 0, 0}, stack={NULL, 0, 0}, copy={NULL, 0, 0};
+    int i, n, tree;
+
+    memset(&d, 0, sizeof(d));
+    d.buf = buf;
+    d.end = buf+len;
+    if (w->ps || (npages <= 0) || !pdfopt_parse(&d)
+        || ((tree = pdfw_prev_pages(&d, &kids, npages)) == 0)){
+        pdfopt_free_objs(&d);
+        free(kids.v);
+        return 0;
+    }
+    // the pages and what they use, but the page tree
+    d.renumber = 1;
+    d.objs[tree].newnum = PDFW_PAGES;
+    for (i=npages-1; i>=0; i--){
+        if (d.objs[kids.v[i]].newnum == 0){
+            d.objs[kids.v[i]].newnum = -1; // on the stack
+            plist_add(&stack, kids.v[i]);
+        }
+    }
+    while (stack.n > 0){
+        plist_t refs={NULL, 0, 0};
+
+        n = stack.v[--stack.n];
+        d.objs[n].newnum = pdfw_reserve(w);
+        plist_add(&copy, n);
+        pdfopt_object_refs(&d, n, &refs);
+        for (i=refs.n-1; i>=0; i--){
+            pobj_t *ob=&d.objs[refs.v[i]];
+
+            if ((ob->val == NULL) || (ob->newnum != 0)) continue;
+            ob->newnum = -1;
+            plist_add(&stack, refs.v[i]);
+        }
+        free(refs.v);
+    }
+    for (i=0; i<copy.n; i++){
+        psbuf_t head={NULL, 0, 0}, tail={NULL, 0, 0};
+        pobj_t *ob=&d.objs[copy.v[i]];
+
+        pdfopt_object_text(&d, copy.v[i], &head, &tail);
+        w->xref[ob->newnum] = w->offset;
+        pdfw_emit(w, head.data, head.len);
+        if (ob->data != NULL) pdfw_emit(w, ob->data, ob->len);
+        pdfw_emit(w, tail.data, tail.len);
+        free(head.data);
+        free(tail.data);
+    }
+    for (i=0; i<npages; i++){
+        if (w->npages >= w->palloc){
+            w->palloc *= 2;
+            w->pages = realloc(w->pages, sizeof(int)*w->palloc);
+        }
+        w->pages[w->npages++] = d.objs[kids.v[i]].newnum;
+    }
+    pdfopt_free_objs(&d);
+    free(kids.v);
+    free(stack.v);
+    free(copy.v);
+    return npages;
+}
+
+void pdfw_date(pdfw_t *w, char *buf){
+    struct tm tm;
+
+    strftime(buf, S_LEN, "D:%Y%m%d%H%M%SZ", gmtime_r(&w->date, &tm));
+}
+
+// write the rest of document, and free the writer. returns the status
+// of output.
+cairo_status_t pdfw_finish(pdfw_t *w){
+    fontsub_t *fs;
+    char date[S_LEN];
+    long xref;
+    int i, cff=0;
+    cairo_status_t status;
+
+    if (w->drawn || (w->npages == 0)){
+        pdfw_show_page(w);
+    }
+    for (fs=w->fonts.top; fs != NULL; fs=fs->next){
+        pdfw_font(w, fs);
+        cff |= fs->cff;
+    }
+
+    pdfw_obj_begin(w, PDFW_RESOURCES);
+    pdfw_printf(w, "<< /ProcSet [/PDF /Text] /Font <<");
+    for (fs=w->fonts.top; fs != NULL; fs=fs->next){
+        pdfw_printf(w, " /F%d %d 0 R", fs->id, fs->ref);
+    }
+    pdfw_printf(w, " >>");
+    if (w->nforms > 0){
+        pdfw_printf(w, "\n   /XObject <<");
+        for (i=0; i<w->nforms; i++){
+            pdfw_printf(w, " /Fm%d %d 0 R", i, w->forms[i].ref);
+        }
+        pdfw_printf(w, " >>");
+    }
+    pdfw_printf(w, " >>\nendobj\n");
+
+    pdfw_obj_begin(w, PDFW_PAGES);
+    pdfw_printf(w, "<< /Type /Pages /MediaBox [0 0 %.2f %.2f] /Count %d\n   /Kids [",
+                w->width, w->height, w->npages);
+    for (i=0; i<w->npages; i++){
+        pdfw_printf(w, "%s%d 0 R", ((i%8 == 0) && (i > 0)) ? "\n    " : " ", w->pages[i]);
+    }
+    pdfw_printf(w, " ] >>\nendobj\n");
+
+    pdfw_date(w, date);
+    pdfw_obj_begin(w, PDFW_INFO);
+    pdfw_printf(w, "<< /Producer (utpdf %s) /CreationDate (%s) /ModDate (%s) >>\nendobj\n",
+                VERSION, date, date);
+
+    pdfw_obj_begin(w, PDFW_CATALOG);
+    // OpenType font file needs PDF 1.6
+    pdfw_printf(w, "<< /Type /Catalog /Pages %d 0 R%s >>\nendobj\n", PDFW_PAGES,
+                cff ? " /Version /1.6" : "");
+
+    xref = w->offset;
+    pdfw_printf(w, "xref\n0 %d\n0000000000 65535 f \n", w->nobj+1);
+    for (i=1; i<=w->nobj; i++){
+        pdfw_printf(w, "%010ld 00000 n \n", w->xref[i]);
+    }
+    pdfw_printf(w, "trailer\n<< /Size %d /Root %d 0 R /Info %d 0 R >>\nstartxref\n%ld\n%%%%EOF\n",
+                w->nobj+1, PDFW_CATALOG, PDFW_INFO, xref);
+
+    fslist_free(&w->fonts);
+    pdfw_forms_free(w);
+    pdfw_batch_free(w);
+    free(w->content.data);
+    free(w->path.data);
+    free(w->xref);
+    free(w->pages);
+    status = w->status;
+    free(w);
+    return status;
+}
+
+// end of pdfwriter.c
@@ -0,0 +1,168 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __PDFWRITER_H__
+#define __PDFWRITER_H__
+
+#include <time.h>
+#include <cairo.h>
+#include <pango/pangocairo.h>
+#include "psstream.h"
+#include "fontsub.h"
+
+#define PDFW_STACK 16 // depth of pdfw_save()
+#define PDFW_NUMLEN 32 // length of a number in pdfw_num()
+
+// --stats: operators and bytes of content streams
+typedef struct pdfw_stats {
+    long ops, bytes;
+} pdfw_stats_t;
+
+// fixed object numbers
+#define PDFW_CATALOG   1
+#define PDFW_PAGES     2
+#define PDFW_RESOURCES 3
+#define PDFW_INFO      4
+
+typedef struct pdf_gstate {
+    cairo_matrix_t ctm; // user space -> page, y-axis downward as cairo
+    double r, g, b;
+    double lw;
+} pdfgs_t;
+
+// glyph used in a form: marked on every page which paints the form
+typedef struct pdf_form_glyph {
+    fontsub_t *fs;
+    unsigned int gid;
+    gunichar uc;
+} pdfgid_t;
+
+// content recorded once, and painted on pages (XObject /Fm<n>)
+typedef struct pdf_form {
+    int ref;            // object number (PDF)
+    psbuf_t content;    // user space, y-axis upward
+    pdfgid_t *glyphs;
+    int nglyphs, galloc;
+    int defined;        // defined in the setup (PostScript)
+} pdfform_t;
+
+// strokes of the same color and width, painted as one path
+typedef struct pdf_batch {
+    double r, g, b, lw;
+    psbuf_t path;
+} pdfbatch_t;
+
+typedef struct pdf_writer {
+    cairo_write_func_t write;
+    void *closure;
+    cairo_status_t status;
+    long offset;        // bytes written
+    long *xref;         // offset of every object
+    int nobj, xalloc;
+    int *pages;         // object number of every page
+    int npages, palloc;
+    double width, height;
+    time_t date;
+    pdfw_stats_t *stats; // of the job (NULL: not counted)
+    fslist_t fonts;
+    // current page
+    psbuf_t content;    // content stream
+    psbuf_t path;       // path under construction
+    int drawn;
+    // graphics state
+    pdfgs_t gs;
+    pdfgs_t stack[PDFW_STACK];
+    int sp;
+    double cx, cy;      // current point in user space
+    double sx, sy;      // start of sub path
+    int has_point;
+    // state already set in content stream
+    double sr, sg, sb, fr, fg, fb, slw;
+    // strokes until pdfw_batch_flush()
+    pdfbatch_t *batch;
+    int nbatch, balloc;
+    // text object: consecutive runs share BT ... ET
+    int in_text;
+    fontsub_t *tfont;
+    double tsize;
+    // forms
+    pdfform_t *forms;
+    int nforms, falloc;
+    int in_form;        // recording forms[nforms-1]
+    psbuf_t page_content;
+    pdfgs_t page_gs;
+    // PostScript (pswriter.c)
+    int ps;
+    int prolog;         // header and prolog are written
+    int in_setup;       // DSC comments go to the setup
+    psbuf_t dsc_header, dsc_setup;
+    const char *page_dsc;
+} pdfw_t;
+
+extern pdfw_t *pdfw_init(cairo_write_func_t write, void *closure,
+                         double width, double height);
+extern pdfw_t *pdfw_new(cairo_write_func_t write, void *closure,
+                        double width, double height);
+extern cairo_status_t pdfw_finish(pdfw_t *w);
+extern void pdfw_set_date(pdfw_t *w, time_t date);
+extern void pdfw_show_page(pdfw_t *w);
+extern void pdfw_page_reset(pdfw_t *w);
+extern void pdfw_emit(pdfw_t *w, const char *data, size_t len);
+extern void pdfw_printf(pdfw_t *w, const char *fmt, ...);
+extern void pdfw_num(char *buf, double v);
+extern void pdfw_ops(psbuf_t *b, int n, const double *v, const char *op);
+
+extern void pdfw_set_rgb(pdfw_t *w, double r, double g, double b);
+extern void pdfw_line_width(pdfw_t *w, double lw);
+extern void pdfw_save(pdfw_t *w);
+extern void pdfw_restore(pdfw_t *w);
+extern void pdfw_translate(pdfw_t *w, double tx, double ty);
+extern void pdfw_rotate(pdfw_t *w, double rad);
+extern void pdfw_set_matrix(pdfw_t *w, const cairo_matrix_t *m);
+
+extern void pdfw_move_to(pdfw_t *w, double x, double y);
+extern void pdfw_rel_move_to(pdfw_t *w, double dx, double dy);
+extern void pdfw_line_to(pdfw_t *w, double x, double y);
+extern void pdfw_rel_line_to(pdfw_t *w, double dx, double dy);
+extern void pdfw_curve_to(pdfw_t *w, double x1, double y1, double x2, double y2,
+                          double x3, double y3);
+extern void pdfw_rectangle(pdfw_t *w, double x, double y, double dx, double dy);
+extern void pdfw_arc(pdfw_t *w, double xc, double yc, double r, double a1, double a2);
+extern void pdfw_close_path(pdfw_t *w);
+extern void pdfw_stroke(pdfw_t *w);
+extern void pdfw_fill(pdfw_t *w);
+extern void pdfw_get_current_point(pdfw_t *w, double *x, double *y);
+extern void pdfw_batch_flush(pdfw_t *w);
+extern void pdfw_batch_free(pdfw_t *w);
+extern void pdfw_count_ops(pdfw_t *w);
+
+extern void pdfw_glyphs(pdfw_t *w, PangoFont *font, PangoGlyphString *glyphs,
+                        const char *text, double x, double y);
+extern void pdfw_text_end(pdfw_t *w);
+
+extern void pdfw_form_begin(pdfw_t *w);
+extern int pdfw_form_end(pdfw_t *w);
+extern void pdfw_paint_form(pdfw_t *w, int id);
+extern void pdfw_forms_free(pdfw_t *w);
+
+extern int pdfw_copy_pages(pdfw_t *w, const char *buf, size_t len, int npages);
+
+#endif
+
+// end of pdfwriter.h
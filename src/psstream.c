@@ -0,0 +1,252 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utpdf.h"
+#include "psstream.h"
+
+/*
+  per-page PostScript streaming
+
+  cairo's PS surface writes nothing until cairo_surface_finish(),
+  because the fonts used in the document are emitted first.
+  So pcobj makes one cairo document per page, and they are joined
+  into one DSC conforming document here:
+
+  first document        following documents
+  ----------------      -------------------
+  %!PS-Adobe-3.0        (dropped)
+  %%Pages: (atend)
+  ...
+  %%EndComments
+  %%BeginProlog         (dropped)
+  ...
+  %%EndProlog
+  %%BeginSetup          (dropped)
+  %%BeginResource  --+  %%BeginResource  --+
+  ...                |  ...                |
+  %%EndResource    --+  %%EndResource    --+
+  ...                |                     |
+  %%EndSetup         |                     |
+  %%Page: 1 1        |  %%Page: 1 1 -> %%Page: n n
+  %%BeginPageSetup   |  %%BeginPageSetup   |
+  ...                |  ...                |
+  save  <------------+  save  <------------+  resources of the page
+  %%EndPageSetup        %%EndPageSetup
+  ...                   ...
+  showpage              showpage
+  restore               restore
+  %%Trailer             (dropped)
+  ...  -> kept until psstream_close()
+
+  The save/restore around each page releases the fonts of the page,
+  so the memory of the printer is bounded as same as ours.
+*/
+
+enum ps_section { PS_HEADER, PS_BODY, PS_PROLOG, PS_SETUP, PS_RESOURCE,
+                  PS_PAGE, PS_TRAILER };
+
+#define DSC(line, key) (strncmp((line), (key), strlen(key))==0)
+
+// for --stats
+struct timespec psstream_first_page;
+int psstream_written=0;
+
+#define PS_SAVE    "userdict /" PS_PAGE_SAVE " save put\n"
+#define PS_RESTORE PS_PAGE_SAVE " restore\n"
+
+//
+// forward declaration
+void psstream_emit(psstream_t *st, const char *data, size_t len);
+void psstream_page(psstream_t *st);
+void psstream_line(psstream_t *st, char *line, size_t len);
+//
+//
+
+void psbuf_add(psbuf_t *b, const char *data, size_t len){
+    if (b->len+len+1 > b->size){
+        b->size = (b->len+len+1)*2;
+        b->data = realloc(b->data, b->size);
+    }
+    memcpy(&b->data[b->len], data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+void psstream_emit(psstream_t *st, const char *data, size_t len){
+    if (st->status == CAIRO_STATUS_SUCCESS){
+        st->status = st->write(st->closure, (const unsigned char *)data, len);
+    }
+}
+
+psstream_t *psstream_new(cairo_write_func_t write, void *closure){
+    psstream_t *st=calloc(1, sizeof(psstream_t));
+
+    st->write = write;
+    st->closure = closure;
+    st->status = CAIRO_STATUS_SUCCESS;
+    st->state = PS_HEADER;
+    st->fresh = 1;
+    return st;
+}
+
+// "%%Page:" of any document
+void psstream_page(psstream_t *st){
+    char buf[S_LEN];
+    int len;
+
+    if (st->state == PS_PAGE){
+        // previous page in the same document
+        psstream_emit(st, PS_RESTORE, strlen(PS_RESTORE));
+    }
+    st->pages++;
+    len = snprintf(buf, S_LEN, "%%%%Page: %d %d\n", st->pages, st->pages);
+    psstream_emit(st, buf, len);
+    st->state = PS_PAGE;
+    st->after_page = 1;
+}
+
+void psstream_line(psstream_t *st, char *line, size_t len){
+    int first=(st->docs == 0);
+
+    switch (st->state){
+    case PS_HEADER:
+        if (first){
+            if (DSC(line, "%%Pages:")){
+                psstream_emit(st, "%%Pages: (atend)\n", 17);
+            } else {
+                psstream_emit(st, line, len);
+            }
+        }
+        if (DSC(line, "%%EndComments")) st->state = PS_BODY;
+        break;
+    case PS_BODY:
+        if (DSC(line, "%%Page:")){
+            psstream_page(st);
+            break;
+        }
+        if (DSC(line, "%%BeginProlog")) st->state = PS_PROLOG;
+        if (DSC(line, "%%BeginSetup"))  st->state = PS_SETUP;
+        if (DSC(line, "%%Trailer"))     { st->state = PS_TRAILER; break; }
+        if (first) psstream_emit(st, line, len);
+        break;
+    case PS_PROLOG:
+        if (first) psstream_emit(st, line, len);
+        if (DSC(line, "%%EndProlog")) st->state = PS_BODY;
+        break;
+    case PS_SETUP:
+        if (DSC(line, "%%BeginResource")){
+            psbuf_add(&st->res, line, len);
+            st->state = PS_RESOURCE;
+            break;
+        }
+        // setup except resources: page device and so on.
+        if (first) psstream_emit(st, line, len);
+        if (DSC(line, "%%EndSetup")) st->state = PS_BODY;
+        break;
+    case PS_RESOURCE:
+        psbuf_add(&st->res, line, len);
+        if (DSC(line, "%%EndResource")) st->state = PS_SETUP;
+        break;
+    case PS_PAGE:
+        if (DSC(line, "%%Page:")){
+            psstream_page(st);
+        } else if (DSC(line, "%%Trailer")){
+            psstream_emit(st, PS_RESTORE, strlen(PS_RESTORE));
+            st->state = PS_TRAILER;
+        } else if (st->after_page
+                   && (DSC(line, "%%EndPageSetup") || !DSC(line, "%%"))){
+            // resources of this page, after the comments of page setup
+            st->after_page = 0;
+            psstream_emit(st, PS_SAVE, strlen(PS_SAVE));
+            psstream_emit(st, st->res.data, st->res.len);
+            psstream_emit(st, line, len);
+        } else {
+            psstream_emit(st, line, len);
+        }
+        break;
+    case PS_TRAILER:
+        if (first && !DSC(line, "%%Pages:")){
+            psbuf_add(&st->trailer, line, len);
+        }
+        break;
+    }
+}
+
+// write function for cairo_ps_surface_create_for_stream()
+cairo_status_t psstream_write(void *closure, const unsigned char *data,
+                              unsigned int length){
+    psstream_t *st=(psstream_t *)closure;
+    unsigned int p=0, top;
+
+    while (p < length){
+        top = p;
+        while ((p < length) && (data[p] != 0x0A)) p++;
+        if (p < length) p++; // include LF
+        psbuf_add(&st->line, (const char *)&data[top], p-top);
+        if (st->line.data[st->line.len-1] == 0x0A){
+            if (!st->discard){
+                psstream_line(st, st->line.data, st->line.len);
+            }
+            st->line.len = 0;
+        }
+    }
+    return st->status;
+}
+
+// the current document was finished
+void psstream_next(psstream_t *st){
+    if (!st->discard){
+        st->docs++;
+        if (!psstream_written && (st->pages > 0)){
+            clock_gettime(CLOCK_MONOTONIC, &psstream_first_page);
+            psstream_written = 1;
+        }
+    }
+    st->state = PS_HEADER;
+    st->discard = 0;
+    st->after_page = 0;
+    st->line.len = 0;
+    st->res.len = 0;
+}
+
+cairo_status_t psstream_close(psstream_t *st){
+    char buf[S_LEN];
+    int len;
+    cairo_status_t status;
+
+    len = snprintf(buf, S_LEN, "%%%%Trailer\n%%%%Pages: %d\n", st->pages);
+    psstream_emit(st, buf, len);
+    if (st->trailer.len > 0){
+        psstream_emit(st, st->trailer.data, st->trailer.len);
+    } else {
+        psstream_emit(st, "%%EOF\n", 6);
+    }
+    free(st->line.data);
+    free(st->res.data);
+    free(st->trailer.data);
+    status = st->status;
+    free(st);
+    return status;
+}
+
+// end of psstream.c
@@ -0,0 +1,63 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __PSSTREAM_H__
+#define __PSSTREAM_H__
+
+#include <stddef.h>
+#include <time.h>
+#include <cairo.h>
+
+// PostScript name of the save object around each page
+#define PS_PAGE_SAVE "utpdf_page"
+
+typedef struct ps_buffer {
+    char *data;
+    size_t len, size;
+} psbuf_t;
+
+typedef struct ps_stream {
+    cairo_write_func_t write; // downstream
+    void *closure;
+    cairo_status_t status;
+    int state;       // section of the current document
+    int docs;        // documents read
+    int pages;       // pages written
+    int discard;     // drop the current document
+    int fresh;       // nothing is drawn on the current surface yet
+    int after_page;  // in the page comments, before the resources
+    psbuf_t line;    // current line
+    psbuf_t res;     // resources of the current document
+    psbuf_t trailer; // trailer of the first document
+} psstream_t;
+
+// for --stats: when the first page was written
+extern struct timespec psstream_first_page;
+extern int psstream_written;
+
+extern void psbuf_add(psbuf_t *b, const char *data, size_t len);
+extern psstream_t *psstream_new(cairo_write_func_t write, void *closure);
+extern cairo_status_t psstream_write
+	(void *closure, const unsigned char *data, unsigned int length);
+extern void psstream_next(psstream_t *st);
+extern cairo_status_t psstream_close(psstream_t *st);
+
+#endif
+
+// end of psstream.h
@@ -0,0 +1,534 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <hb.h>
+
+#include "utpdf.h"
+#include "pswriter.h"
+
+/*
+  native PostScript writer
+
+  The page contents are made by pdfwriter.c, and the procset below
+  defines the PDF operators used in them (m l c h S f w RG rg
+  BT Tf Tm TJ ET q Q cm Do) in PostScript. So every page is written
+  as it is:
+
+  %!PS-Adobe-3.0            header, procset and setup: at the first page
+                            (forms recorded until then are in the setup)
+  %%Page: 1 1
+  %%BeginPageSetup
+  save, fonts and glyphs new in the page
+  %%EndPageSetup
+  <content of page>         same as PDF content stream
+  restore showpage
+  %%Page: 2 2
+  ...
+  %%Trailer                 at the end
+
+  A font is defined in global VM at the first page which uses it, and
+  survives the restore of the page. Later pages only add the glyphs
+  new to the font, so that every glyph is sent once, and each page can
+  still be written as soon as it is finished.
+
+  - TrueType: CIDFontType 2 (Type 42) with Identity-H, LanguageLevel 3.
+    Glyphs are added to its GlyphDirectory, with their metrics.
+  - CFF: Type 0 font (FMapType 2) of Type 3 fonts, drawn from outlines.
+    Glyph procedures are added to a dictionary shared by the Type 3
+    fonts.
+*/
+
+//
+// forward declaration
+void psw_prolog(pdfw_t *w);
+void psw_forms(pdfw_t *w);
+void psw_font(pdfw_t *w, fontsub_t *fs);
+void psw_type42(pdfw_t *w, fontsub_t *fs);
+void psw_type3(pdfw_t *w, fontsub_t *fs);
+int psw_cmp_offset(const void *a, const void *b);
+unsigned char *psw_strip_glyf(const unsigned char *data, unsigned int len, unsigned int *out);
+void psw_glyph42(pdfw_t *w, fontsub_t *fs, const unsigned char *data, unsigned int len,
+                 unsigned int gid);
+void psw_sfnts(pdfw_t *w, const unsigned char *data, unsigned int len);
+void psw_hex(pdfw_t *w, const unsigned char *data, unsigned int len);
+void psw_move_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float x, float y, void *user);
+void psw_line_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float x, float y, void *user);
+void psw_quad_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float cx, float cy, float x, float y, void *user);
+void psw_cubic_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                  float c1x, float c1y, float c2x, float c2y, float x, float y, void *user);
+void psw_close(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st, void *user);
+void psw_glyph(pdfw_t *w, fontsub_t *fs, hb_draw_funcs_t *funcs, unsigned int gid);
+//
+//
+
+static const char *psw_procset=
+    "/utpdf 32 dict dup begin\n"
+    "/m /moveto load def /l /lineto load def /c /curveto load def\n"
+    "/h /closepath load def /w /setlinewidth load def\n"
+    "/sc [0 0 0] def /fc [0 0 0] def\n"
+    "/RG { 3 array astore /sc exch def } bind def\n"
+    "/rg { 3 array astore /fc exch def } bind def\n"
+    "/S { sc aload pop setrgbcolor stroke } bind def\n"
+    "/f { fc aload pop setrgbcolor fill } bind def\n"
+    "/BT { } def /ET { } def\n"
+    "/q /gsave load def /Q /grestore load def\n"
+    "/cm { 6 array astore concat } bind def /Do { load exec } bind def\n"
+    "/Tf { /ts exch def findfont ts scalefont /tf exch def } bind def\n"
+    "/Tm { 6 array astore /tm exch def } bind def\n"
+    "/TJ { gsave tm concat 0 0 moveto tf setfont fc aload pop setrgbcolor\n"
+    "  { dup type /stringtype eq { show } { ts mul -1000 div 0 rmoveto } ifelse } forall\n"
+    "  grestore } bind def\n"
+    "end def\n"
+    // for the Type 3 fonts in global VM: glyph id is H*256+code
+    "currentglobal true setglobal globaldict begin\n"
+    "/utpdf-enc [ 256 { /.notdef } repeat ] def\n"
+    "/utpdf-bc { exch dup /H get 256 mul 3 -1 roll add exch /G get exch\n"
+    "  2 copy known { get exec } { pop pop 0 0 setcharwidth } ifelse } bind def\n"
+    "end setglobal\n";
+
+pdfw_t *psw_new(cairo_write_func_t write, void *closure, double width, double height){
+    pdfw_t *w=pdfw_init(write, closure, width, height);
+    char *epoch=getenv(SOURCE_DATE_EPOCH);
+    long long t;
+
+    w->ps = 1;
+    // same as cairo's PostScript surface
+    if ((epoch != NULL) && (sscanf(epoch, "%lld", &t) == 1)){
+        w->date = (time_t)t;
+    }
+    return w;
+}
+
+// same as cairo_ps_surface_dsc_comment(), before the first page
+void psw_dsc_comment(pdfw_t *w, const char *comment){
+    psbuf_t *b=w->in_setup ? &w->dsc_setup : &w->dsc_header;
+
+    psbuf_add(b, comment, strlen(comment));
+    psbuf_add(b, "\n", 1);
+}
+
+void psw_dsc_begin_setup(pdfw_t *w){
+    w->in_setup = 1;
+}
+
+// DSC comment of every page, e.g. "%%PageOrientation: Portrait"
+void psw_page_dsc(pdfw_t *w, const char *comment){
+    w->page_dsc = comment;
+}
+
+void psw_prolog(pdfw_t *w){
+    char date[S_LEN];
+    struct tm tm;
+
+    strftime(date, S_LEN, "%a %b %e %H:%M:%S %Y", gmtime_r(&w->date, &tm));
+    pdfw_printf(w, "%%!PS-Adobe-3.0\n%%%%Creator: utps %s\n%%%%CreationDate: %s\n"
+                "%%%%Pages: (atend)\n%%%%BoundingBox: 0 0 %d %d\n"
+                "%%%%DocumentData: Clean7Bit\n%%%%LanguageLevel: 3\n",
+                VERSION, date, (int)ceil(w->width), (int)ceil(w->height));
+    pdfw_emit(w, w->dsc_header.data, w->dsc_header.len);
+    pdfw_printf(w, "%%%%EndComments\n%%%%BeginProlog\n%%%%BeginResource: procset utpdf\n");
+    pdfw_emit(w, psw_procset, strlen(psw_procset));
+    pdfw_printf(w, "%%%%EndResource\n%%%%EndProlog\n%%%%BeginSetup\n");
+    pdfw_emit(w, w->dsc_setup.data, w->dsc_setup.len);
+    psw_forms(w);
+    pdfw_printf(w, "%%%%BeginFeature: *PageSize\n"
+                "<< /PageSize [%.2f %.2f] >> setpagedevice\n"
+                "%%%%EndFeature\n%%%%EndSetup\n", w->width, w->height);
+    w->prolog = 1;
+}
+
+// forms recorded before the first page are procedures of the procset.
+void psw_forms(pdfw_t *w){
+    int i;
+
+    if (w->nforms == 0) return;
+    pdfw_printf(w, "utpdf begin\n");
+    for (i=0; i<w->nforms; i++){
+        if (!w->forms[i].defined) continue;
+        pdfw_printf(w, "/Fm%d {\n", i);
+        pdfw_emit(w, w->forms[i].content.data, w->forms[i].content.len);
+        pdfw_printf(w, "} bind def\n");
+    }
+    pdfw_printf(w, "end\n");
+}
+
+void psw_show_page(pdfw_t *w){
+    fontsub_t *fs;
+
+    pdfw_batch_flush(w);
+    pdfw_text_end(w);
+    pdfw_count_ops(w);
+    if (!w->prolog) psw_prolog(w);
+    w->npages++;
+    pdfw_printf(w, "%%%%Page: %d %d\n", w->npages, w->npages);
+    if (w->page_dsc != NULL){
+        pdfw_printf(w, "%s\n", w->page_dsc);
+    }
+    pdfw_printf(w, "%%%%BeginPageSetup\nuserdict /%s save put\nutpdf begin\n",
+                PS_PAGE_SAVE);
+    for (fs=w->fonts.top; fs != NULL; fs=fs->next){
+        if (fs->on_page) psw_font(w, fs);
+    }
+    pdfw_printf(w, "%%%%EndPageSetup\n");
+    pdfw_emit(w, w->content.data, w->content.len);
+    pdfw_printf(w, "end %s restore showpage\n%%%%PageTrailer\n", PS_PAGE_SAVE);
+
+    if (!psstream_written){
+        clock_gettime(CLOCK_MONOTONIC, &psstream_first_page);
+        psstream_written = 1;
+    }
+    fslist_page_clear(&w->fonts);
+    pdfw_page_reset(w);
+}
+
+// write the rest of document, and free the writer. returns the status
+// of output.
+cairo_status_t psw_finish(pdfw_t *w){
+    cairo_status_t status;
+
+    if (w->drawn || (w->npages == 0)){
+        psw_show_page(w);
+    }
+    pdfw_printf(w, "%%%%Trailer\n%%%%Pages: %d\n%%%%EOF\n", w->npages);
+
+    fslist_free(&w->fonts);
+    pdfw_forms_free(w);
+    pdfw_batch_free(w);
+    free(w->content.data);
+    free(w->path.data);
+    free(w->dsc_header.data);
+    free(w->dsc_setup.data);
+    free(w->xref);
+    free(w->pages);
+    status = w->status;
+    free(w);
+    return status;
+}
+
+//
+// fonts of the page
+
+// the font at its first page, and the glyphs new in the page
+void psw_font(pdfw_t *w, fontsub_t *fs){
+    pdfw_printf(w, "currentglobal true setglobal\n");
+    if (fs->cff){
+        psw_type3(w, fs);
+    } else {
+        psw_type42(w, fs);
+    }
+    pdfw_printf(w, "setglobal\n");
+    fs->defined = 1;
+}
+
+// hex string with line breaks
+void psw_hex(pdfw_t *w, const unsigned char *data, unsigned int len){
+    char buf[PSW_HEXLINE*2+2];
+    unsigned int i, j;
+
+    pdfw_emit(w, "<", 1);
+    for (i=0; i<len; i+=PSW_HEXLINE){
+        for (j=0; (j < PSW_HEXLINE) && (i+j < len); j++){
+            snprintf(buf+j*2, 3, "%02X", data[i+j]);
+        }
+        buf[j*2] = '\n';
+        pdfw_emit(w, buf, j*2+1);
+    }
+    pdfw_emit(w, ">\n", 2);
+}
+
+#define BE16(p) (((p)[0]<<8) | (p)[1])
+#define BE32(p) (((unsigned long)(p)[0]<<24) | ((p)[1]<<16) | ((p)[2]<<8) | (p)[3])
+
+int psw_cmp_offset(const void *a, const void *b){
+    unsigned long x=*(const unsigned long *)a, y=*(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+  sfnts: strings of the font file, which must end at the boundary of
+  tables. The 'glyf' table, which may be larger than a string, is not
+  in it (psw_strip_glyf()).
+*/
+void psw_sfnts(pdfw_t *w, const unsigned char *data, unsigned int len){
+    unsigned long *brk, start=0, last=0;
+    int ntables=(len >= 12) ? BE16(data+4) : 0, nbrk=0, i;
+
+    if ((unsigned int)(12+ntables*16) > len) ntables = 0;
+    brk = malloc(sizeof(unsigned long)*(ntables*2+1));
+    brk[nbrk++] = 12+ntables*16;
+    for (i=0; i<ntables; i++){
+        const unsigned char *rec=data+12+i*16;
+
+        brk[nbrk++] = BE32(rec+8);
+        brk[nbrk++] = (BE32(rec+8)+BE32(rec+12)+3) & ~3UL;
+    }
+    qsort(brk, nbrk, sizeof(unsigned long), psw_cmp_offset);
+
+    pdfw_printf(w, " /sfnts [\n");
+    for (i=0; i<nbrk; i++){
+        if (brk[i] > len) break;
+        if ((brk[i]-start > PSW_SFNTS_MAX) && (last > start)){
+            psw_hex(w, data+start, last-start);
+            start = last;
+        }
+        last = brk[i];
+    }
+    if (start < len){
+        psw_hex(w, data+start, len-start);
+    }
+    pdfw_printf(w, " ]\n");
+    free(brk);
+}
+
+// the font file without 'glyf' and 'loca' tables, which are replaced
+// by GlyphDirectory. free() it after use.
+unsigned char *psw_strip_glyf(const unsigned char *data, unsigned int len, unsigned int *out){
+    int ntables=(len >= 12) ? BE16(data+4) : 0, n=0, i, sel;
+    unsigned long off, size;
+    unsigned char *b, *rec;
+
+    if ((unsigned int)(12+ntables*16) > len) ntables = 0;
+    size = 12;
+    for (i=0; i<ntables; i++){
+        const unsigned char *r=data+12+i*16;
+
+        if ((memcmp(r, "glyf", 4) == 0) || (memcmp(r, "loca", 4) == 0)
+            || (BE32(r+8)+BE32(r+12) > len)) continue;
+        size += 16 + ((BE32(r+12)+3) & ~3UL);
+        n++;
+    }
+    b = calloc(size, 1);
+    off = 12+n*16;
+    rec = b+12;
+    for (i=0; i<ntables; i++){
+        const unsigned char *r=data+12+i*16;
+        unsigned long toff=BE32(r+8), tlen=BE32(r+12);
+
+        if ((memcmp(r, "glyf", 4) == 0) || (memcmp(r, "loca", 4) == 0)
+            || (toff+tlen > len)) continue;
+        memcpy(rec, r, 16); // tag, checksum, offset and length
+        rec[8] = off>>24; rec[9] = off>>16; rec[10] = off>>8; rec[11] = off;
+        memcpy(b+off, data+toff, tlen);
+        off += (tlen+3) & ~3UL;
+        rec += 16;
+    }
+    // sfnt version, numTables, searchRange, entrySelector, rangeShift
+    for (sel=0; (2<<sel) <= n; sel++);
+    memcpy(b, data, 4);
+    b[4] = n>>8;                     b[5] = n;
+    b[6] = (16<<sel)>>8;             b[7] = 16<<sel;
+    b[8] = sel>>8;                   b[9] = sel;
+    b[10] = (n*16-(16<<sel))>>8;     b[11] = n*16-(16<<sel);
+    *out = size;
+    return b;
+}
+
+// "dup <gid> <advance lsb glyph> put" for MetricsCount 2
+void psw_glyph42(pdfw_t *w, fontsub_t *fs, const unsigned char *data, unsigned int len,
+                 unsigned int gid){
+    unsigned char *g=malloc(len+4);
+    unsigned int adv=hb_font_get_glyph_h_advance(fs->font, gid);
+
+    g[0] = adv>>8;
+    g[1] = adv;
+    // lsb is xMin of the glyph
+    g[2] = (len >= 4) ? data[2] : 0;
+    g[3] = (len >= 4) ? data[3] : 0;
+    if (len > 0) memcpy(g+4, data, len);
+    pdfw_printf(w, "dup %u ", gid);
+    psw_hex(w, g, len+4);
+    pdfw_printf(w, "put\n");
+    free(g);
+}
+
+// TrueType: glyph id is CID.
+void psw_type42(pdfw_t *w, fontsub_t *fs){
+    hb_blob_t *blob=fontsub_subset(fs, FS_PAGE);
+    unsigned int len, slen, gid;
+    const unsigned char *data=(const unsigned char *)hb_blob_get_data(blob, &len);
+    const unsigned char *glyf=NULL, *loca=NULL, *head=NULL;
+    unsigned long glyf_len=0, loca_len=0;
+    int ntables=(len >= 12) ? BE16(data+4) : 0, long_loca, i;
+
+    if ((unsigned int)(12+ntables*16) > len) ntables = 0;
+    for (i=0; i<ntables; i++){
+        const unsigned char *rec=data+12+i*16;
+        unsigned long off=BE32(rec+8), tlen=BE32(rec+12);
+
+        if (off+tlen > len) continue;
+        if (memcmp(rec, "glyf", 4) == 0){ glyf = data+off; glyf_len = tlen; }
+        if (memcmp(rec, "loca", 4) == 0){ loca = data+off; loca_len = tlen; }
+        if (memcmp(rec, "head", 4) == 0) head = data+off;
+    }
+    long_loca = (head != NULL) ? BE16(head+50) : 0;
+
+    if (!fs->defined){
+        unsigned char *stripped=psw_strip_glyf(data, len, &slen);
+        char v[4][PDFW_NUMLEN];
+        int bbox[4];
+
+        fontsub_bbox(fs, bbox);
+        for (i=0; i<4; i++){
+            pdfw_num(v[i], bbox[i]/1000.0);
+        }
+        pdfw_printf(w, "/F%d-CID << /CIDFontType 2 /FontType 42 /CIDFontName /F%d-CID\n"
+                    " /CIDSystemInfo << /Registry (Adobe) /Ordering (Identity) /Supplement 0 >>\n"
+                    " /FontMatrix [1 0 0 1 0 0] /FontBBox [%s %s %s %s] /PaintType 0\n"
+                    " /Encoding [] /CIDCount %u /GDBytes 2 /CIDMap 0 /CharStrings << /.notdef 0 >>\n"
+                    " /MetricsCount 2 /GlyphDirectory 256 dict\n",
+                    fs->id, fs->id, v[0], v[1], v[2], v[3], fs->nglyphs);
+        psw_sfnts(w, stripped, slen);
+        pdfw_printf(w, ">> /CIDFont defineresource pop\n"
+                    "/F%d /Identity-H [/F%d-CID /CIDFont findresource] composefont pop\n",
+                    fs->id, fs->id);
+        free(stripped);
+    }
+
+    // glyphs of the page, and the components of them in the subset
+    pdfw_printf(w, "/F%d-CID /CIDFont findresource /GlyphDirectory get\n", fs->id);
+    for (gid=0; gid<fs->nglyphs; gid++){
+        unsigned long start=0, end=0;
+
+        if (fs->used[gid] & FS_SENT) continue;
+        if ((loca != NULL) && (glyf != NULL)
+            && ((gid+2)*(long_loca ? 4UL : 2UL) <= loca_len)){
+            start = long_loca ? BE32(loca+gid*4) : BE16(loca+gid*2)*2UL;
+            end = long_loca ? BE32(loca+gid*4+4) : BE16(loca+gid*2+2)*2UL;
+            if ((end < start) || (end > glyf_len)) start = end = 0;
+        }
+        if ((gid == 0) || (fs->used[gid] & FS_PAGE) || (end > start)){
+            psw_glyph42(w, fs, (glyf != NULL) ? glyf+start : NULL, end-start, gid);
+            fs->used[gid] |= FS_SENT;
+        }
+    }
+    pdfw_printf(w, "pop\n");
+    hb_blob_destroy(blob);
+}
+
+//
+// CFF: glyphs are drawn in Type 3 fonts of 256 glyphs,
+// selected by the high byte of glyph id.
+
+void psw_move_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float x, float y, void *user){
+    double v[2]={x, y};
+    (void)f; (void)st; (void)user;
+    pdfw_ops(buf, 2, v, "m");
+}
+
+void psw_line_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float x, float y, void *user){
+    double v[2]={x, y};
+    (void)f; (void)st; (void)user;
+    pdfw_ops(buf, 2, v, "l");
+}
+
+void psw_quad_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                 float cx, float cy, float x, float y, void *user){
+    double v[6]={st->current_x+(cx-st->current_x)*2/3, st->current_y+(cy-st->current_y)*2/3,
+                 x+(cx-x)*2/3, y+(cy-y)*2/3, x, y};
+    (void)f; (void)user;
+    pdfw_ops(buf, 6, v, "c");
+}
+
+void psw_cubic_to(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st,
+                  float c1x, float c1y, float c2x, float c2y, float x, float y, void *user){
+    double v[6]={c1x, c1y, c2x, c2y, x, y};
+    (void)f; (void)st; (void)user;
+    pdfw_ops(buf, 6, v, "c");
+}
+
+void psw_close(hb_draw_funcs_t *f, void *buf, hb_draw_state_t *st, void *user){
+    (void)f; (void)st; (void)user;
+    psbuf_add(buf, "h\n", 2);
+}
+
+// "dup <gid> { <advance> 0 <bbox> setcachedevice <path> fill } put"
+void psw_glyph(pdfw_t *w, fontsub_t *fs, hb_draw_funcs_t *funcs, unsigned int gid){
+    psbuf_t path={NULL, 0, 0};
+    hb_glyph_extents_t ext;
+    double v[6];
+
+    if (!hb_font_get_glyph_extents(fs->font, gid, &ext)){
+        memset(&ext, 0, sizeof(ext));
+    }
+    v[0] = hb_font_get_glyph_h_advance(fs->font, gid);
+    v[1] = 0;
+    v[2] = ext.x_bearing;
+    v[3] = ext.y_bearing + ext.height;
+    v[4] = ext.x_bearing + ext.width;
+    v[5] = ext.y_bearing;
+    pdfw_printf(w, "dup %u {\n", gid);
+    pdfw_ops(&path, 6, v, "setcachedevice");
+    hb_font_draw_glyph(fs->font, gid, funcs, &path);
+    psbuf_add(&path, "fill } put\n", 11);
+    pdfw_emit(w, path.data, path.len);
+    free(path.data);
+}
+
+void psw_type3(pdfw_t *w, fontsub_t *fs){
+    hb_draw_funcs_t *funcs;
+    int nsub=(fs->nglyphs+255)/256, hi;
+    unsigned int gid;
+    char scale[PDFW_NUMLEN];
+
+    if (!fs->defined){
+        // every Type 3 font of the glyph ids, with the shared glyphs
+        pdfw_num(scale, 1.0/fs->upem);
+        pdfw_printf(w, "globaldict /F%d.G 256 dict put\n"
+                    "/F%d << /FontType 0 /FMapType 2 /FontMatrix [1 0 0 1 0 0]\n"
+                    " /FDepVector [\n", fs->id, fs->id);
+        for (hi=0; hi<nsub; hi++){
+            pdfw_printf(w, "/F%d.%d << /FontType 3 /FontMatrix [%s 0 0 %s 0 0]\n"
+                        " /FontBBox [0 0 0 0] /Encoding utpdf-enc /BuildChar /utpdf-bc load\n"
+                        " /G globaldict /F%d.G get /H %d >> definefont\n",
+                        fs->id, hi, scale, scale, fs->id, hi);
+        }
+        pdfw_printf(w, " ]\n /Encoding [");
+        for (hi=0; hi<256; hi++){
+            // unused high bytes: any font
+            pdfw_printf(w, "%s%d", (hi%32 == 0) ? "\n" : " ", (hi < nsub) ? hi : 0);
+        }
+        pdfw_printf(w, " ] >> definefont pop\n");
+    }
+
+    funcs = hb_draw_funcs_create();
+    hb_draw_funcs_set_move_to_func(funcs, psw_move_to, NULL, NULL);
+    hb_draw_funcs_set_line_to_func(funcs, psw_line_to, NULL, NULL);
+    hb_draw_funcs_set_quadratic_to_func(funcs, psw_quad_to, NULL, NULL);
+    hb_draw_funcs_set_cubic_to_func(funcs, psw_cubic_to, NULL, NULL);
+    hb_draw_funcs_set_close_path_func(funcs, psw_close, NULL, NULL);
+    pdfw_printf(w, "globaldict /F%d.G get\n", fs->id);
+    for (gid=0; gid<fs->nglyphs; gid++){
+        if (!(fs->used[gid] & FS_PAGE) || (fs->used[gid] & FS_SENT)) continue;
+        psw_glyph(w, fs, funcs, gid);
+        fs->used[gid] |= FS_SENT;
+    }
+    pdfw_printf(w, "pop\n");
+    hb_draw_funcs_destroy(funcs);
+}
+
+// end of pswriter.c
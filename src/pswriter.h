@@ -0,0 +1,40 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __PSWRITER_H__
+#define __PSWRITER_H__
+
+#include "pdfwriter.h"
+
+#define PSW_SFNTS_MAX 65534 // bytes per string of Type 42 sfnts
+#define PSW_HEXLINE   32    // bytes per line of hex string
+
+// The PostScript writer shares pdfw_t and its drawing functions with
+// the PDF writer. Only the pages, fonts and the document differ.
+extern pdfw_t *psw_new(cairo_write_func_t write, void *closure,
+                       double width, double height);
+extern void psw_dsc_comment(pdfw_t *w, const char *comment);
+extern void psw_dsc_begin_setup(pdfw_t *w);
+extern void psw_page_dsc(pdfw_t *w, const char *comment);
+extern void psw_show_page(pdfw_t *w);
+extern cairo_status_t psw_finish(pdfw_t *w);
+
+#endif
+
+// end of pswriter.h
@@ -0,0 +1,197 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "raster.h"
+#include "utpdf.h"
+
+// for --stats
+static int raster_stat_pages, raster_stat_threads;
+static double raster_stat_seconds;
+
+//
+// forward declaration
+void *raster_worker(void *arg);
+cairo_surface_t *raster_render(raster_t *r, cairo_surface_t *page);
+int raster_write(raster_t *r, rpage_t *p);
+//
+//
+
+raster_t *raster_new(const char *prefix, double dpi, double width, double height){
+    raster_t *r=calloc(1, sizeof(raster_t));
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    r->prefix = strdup(prefix);
+    r->scale = dpi/72;
+    r->width = width;
+    r->height = height;
+    r->nworkers = (cpus > 0) ? cpus : 1;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->ready, NULL);
+    pthread_cond_init(&r->room, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    r->workers = calloc(r->nworkers, sizeof(pthread_t));
+    for (i=0; i<r->nworkers; i++){
+        if (pthread_create(&r->workers[i], NULL, raster_worker, r) != 0){
+            r->nworkers = i; // the rest is done by the others
+            break;
+        }
+    }
+    r->budget = r->nworkers*RASTER_INFLIGHT;
+    return r;
+}
+
+// the page is rendered here, as cairo can not replay a recording
+// surface on other threads safely. The layout waits here while the
+// budget of pages in flight is used up.
+void raster_page(raster_t *r, cairo_surface_t *page){
+    rpage_t *p=calloc(1, sizeof(rpage_t));
+
+    p->image = raster_render(r, page);
+    if (r->nworkers == 0){
+        // no thread: written here
+        p->number = ++r->pages;
+        r->failed |= !raster_write(r, p);
+        r->done++;
+        free(p);
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    while (r->inflight >= r->budget){
+        pthread_cond_wait(&r->room, &r->lock);
+    }
+    p->number = ++r->pages;
+    if (r->tail == NULL){
+        r->head = p;
+    } else {
+        r->tail->next = p;
+    }
+    r->tail = p;
+    r->inflight++;
+    pthread_cond_signal(&r->ready);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// white page at the resolution
+cairo_surface_t *raster_render(raster_t *r, cairo_surface_t *page){
+    cairo_surface_t *img;
+    cairo_t *cr;
+
+    img = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                     (int)(r->width*r->scale+0.5),
+                                     (int)(r->height*r->scale+0.5));
+    cr = cairo_create(img);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+    cairo_scale(cr, r->scale, r->scale);
+    cairo_set_source_surface(cr, page, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(img);
+    return img;
+}
+
+// compressed in the worker, and the image is freed. 0: failed
+int raster_write(raster_t *r, rpage_t *p){
+    char fname[S_LEN];
+    int ok=1;
+
+    snprintf(fname, S_LEN, "%s-%04d.png", r->prefix, p->number);
+    if (cairo_surface_write_to_png(p->image, fname) != CAIRO_STATUS_SUCCESS){
+        fprintf(stderr, "%s: Could not write: %s\n", utpdf_prog_name, fname);
+        ok = 0;
+    }
+    cairo_surface_destroy(p->image);
+    return ok;
+}
+
+void *raster_worker(void *arg){
+    raster_t *r=arg;
+    rpage_t *p;
+    int ok;
+
+    for (;;){
+        pthread_mutex_lock(&r->lock);
+        while ((r->head == NULL) && !r->closing){
+            pthread_cond_wait(&r->ready, &r->lock);
+        }
+        if (r->head == NULL){
+            pthread_mutex_unlock(&r->lock);
+            return NULL;
+        }
+        p = r->head;
+        r->head = p->next;
+        if (r->head == NULL) r->tail = NULL;
+        pthread_mutex_unlock(&r->lock);
+
+        ok = raster_write(r, p);
+        free(p);
+
+        pthread_mutex_lock(&r->lock);
+        r->failed |= !ok;
+        r->inflight--;
+        r->done++;
+        pthread_cond_signal(&r->room);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+// every page is written, and r is freed. -1: a page was not written
+int raster_finish(raster_t *r){
+    struct timespec end;
+    int i, failed;
+
+    pthread_mutex_lock(&r->lock);
+    r->closing = 1;
+    pthread_cond_broadcast(&r->ready);
+    pthread_mutex_unlock(&r->lock);
+    for (i=0; i<r->nworkers; i++){
+        pthread_join(r->workers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    raster_stat_pages += r->done;
+    raster_stat_threads = r->nworkers;
+    raster_stat_seconds += (end.tv_sec - r->start.tv_sec)
+        + (end.tv_nsec - r->start.tv_nsec)/1e9;
+    failed = r->failed;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->ready);
+    pthread_cond_destroy(&r->room);
+    free(r->workers);
+    free(r->prefix);
+    free(r);
+    return failed ? -1 : 0;
+}
+
+void raster_report(){
+    if (raster_stat_pages == 0){
+        return;
+    }
+    fprintf(stderr, "%s: png: %d pages in %.2f sec (%.1f pages/sec), %d threads\n",
+            utpdf_prog_name, raster_stat_pages, raster_stat_seconds,
+            (raster_stat_seconds > 0) ? raster_stat_pages/raster_stat_seconds : 0.0,
+            raster_stat_threads);
+}
+
+// end of raster.c
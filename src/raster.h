@@ -0,0 +1,59 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <pthread.h>
+#include <cairo.h>
+
+#define RASTER_DPI      96  // default resolution of --png
+#define RASTER_INFLIGHT 2   // pages queued or being written, per thread
+
+// a rendered page, waiting for a worker
+typedef struct raster_page {
+    cairo_surface_t *image; // at the resolution
+    int number;
+    struct raster_page *next;
+} rpage_t;
+
+// PNG output: pages are rendered by the layout thread, which owns the
+// recording surfaces, and compressed to PNG on worker threads
+typedef struct raster {
+    char *prefix;          // <prefix>-0001.png, ...
+    double scale, width, height;
+    pthread_t *workers;
+    int nworkers, inflight; // pages queued or being written, up to budget
+    int budget, pages, done;
+    rpage_t *head, *tail;
+    int closing, failed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;  // a page is queued, or closing
+    pthread_cond_t room;   // a page is written
+    struct timespec start;
+} raster_t;
+
+extern raster_t *raster_new(const char *prefix, double dpi, double width, double height);
+extern void raster_page(raster_t *r, cairo_surface_t *page);
+extern int raster_finish(raster_t *r);
+extern void raster_report();
+
+#endif
+
+// end of raster.h
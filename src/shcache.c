@@ -0,0 +1,178 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shcache.h"
+
+/*
+  LRU cache of shaped lines
+
+  Logs repeat the same lines, so the segments of line (until end of
+  line) are shaped and folded once, and shown from the cache again.
+  The key is the bytes, the font, the position from the origin of tab
+  stops and the available width.
+  Least recently used entries are dropped over the memory budget.
+*/
+
+//
+// forward declaration
+shent_t *shent_new(pcobj *obj, const char *seg, int len, double x0, double avail);
+void shent_free(shent_t *e);
+void shcache_unlink(shcache_t *c, shent_t *e);
+void shcache_push(shcache_t *c, shent_t *e);
+//
+//
+
+shcache_t *shcache_new(double budget_mb){
+    shcache_t *c=calloc(1, sizeof(shcache_t));
+
+    c->budget = (size_t)(budget_mb*1024*1024);
+    return c;
+}
+
+// shape and fold a segment
+shent_t *shent_new(pcobj *obj, const char *seg, int len, double x0, double avail){
+    shent_t *e=calloc(1, sizeof(shent_t));
+    pcglyphs_t *g=pcobj_shape_at(obj, seg, len, x0);
+    int i, fold=pcobj_fold(g, avail);
+
+    if (fold < len){
+        // the head may be wider than the sum of clusters, e.g. kerning.
+        pcglyphs_free(g);
+        g = pcobj_shape_at(obj, seg, fold, x0);
+        while ((fold > 0) && (g->width > avail)){
+            do { fold--; } while ((fold > 0) && ((seg[fold] & 0xC0) == 0x80));
+            pcglyphs_free(g);
+            g = pcobj_shape_at(obj, seg, fold, x0);
+        }
+    }
+    e->text = malloc(len);
+    memcpy(e->text, seg, len);
+    e->len = len;
+    e->desc = pango_font_description_copy(obj->desc);
+    e->x0 = x0;
+    e->avail = avail;
+    e->fold = fold;
+    e->glyphs = g;
+
+    e->size = sizeof(shent_t) + len + sizeof(pcglyphs_t) + g->len+1;
+    for (i=0; i<g->nruns; i++){
+        e->size += sizeof(PangoGlyphItem) + sizeof(PangoItem)
+            + g->runs[i].glyphs->num_glyphs*(sizeof(PangoGlyphInfo)+sizeof(gint));
+    }
+    return e;
+}
+
+void shent_free(shent_t *e){
+    pcglyphs_free(e->glyphs);
+    pango_font_description_free(e->desc);
+    free(e->text);
+    free(e);
+}
+
+void shcache_unlink(shcache_t *c, shent_t *e){
+    if (e->prev != NULL) e->prev->next = e->next; else c->top = e->next;
+    if (e->next != NULL) e->next->prev = e->prev; else c->last = e->prev;
+    e->prev = e->next = NULL;
+}
+
+// as most recently used
+void shcache_push(shcache_t *c, shent_t *e){
+    e->next = c->top;
+    if (c->top != NULL) c->top->prev = e; else c->last = e;
+    c->top = e;
+}
+
+// the entry is valid until the next call.
+shent_t *shcache_fold(shcache_t *c, pcobj *obj, const char *seg, int len,
+                      double x0, double avail){
+    guint desc=pango_font_description_hash(obj->desc);
+    hash_t h=hash_bytes(HASH_INIT, seg, len);
+    shent_t *e, **p;
+
+    h = hash_bytes(h, &desc, sizeof(desc));
+    h = hash_bytes(h, &x0, sizeof(x0));
+    h = hash_bytes(h, &avail, sizeof(avail));
+    h = hash_bytes(h, &obj->shaping, sizeof(obj->shaping));
+    for (e=c->table[h % SHCACHE_BUCKETS]; e != NULL; e=e->hnext){
+        // the hash of font is 32-bit: compare the font too
+        if ((e->hash == h) && (e->len == len)
+            && (e->x0 == x0) && (e->shaping == obj->shaping)
+            && (e->avail == avail) && (memcmp(e->text, seg, len) == 0)
+            && pango_font_description_equal(e->desc, obj->desc)){
+            c->hits++;
+            shcache_unlink(c, e);
+            shcache_push(c, e);
+            return e;
+        }
+    }
+    c->misses++;
+    if (c->scratch != NULL){
+        shent_free(c->scratch);
+        c->scratch = NULL;
+    }
+    e = shent_new(obj, seg, len, x0, avail);
+    e->hash = h;
+    e->shaping = obj->shaping;
+    if (e->size > c->budget){
+        c->scratch = e;
+        return e;
+    }
+    e->hnext = c->table[h % SHCACHE_BUCKETS];
+    c->table[h % SHCACHE_BUCKETS] = e;
+    shcache_push(c, e);
+    c->used += e->size;
+
+    // drop least recently used
+    while (c->used > c->budget){
+        shent_t *old=c->last;
+
+        for (p=&c->table[old->hash % SHCACHE_BUCKETS]; *p != old; p=&(*p)->hnext);
+        *p = old->hnext;
+        shcache_unlink(c, old);
+        c->used -= old->size;
+        shent_free(old);
+    }
+    return e;
+}
+
+void shcache_report(shcache_t *c){
+    long total=c->hits + c->misses;
+
+    fprintf(stderr, "%s: shape cache: %ld hits, %ld misses (%.1f%%), %.1f MB\n",
+            utpdf_prog_name, c->hits, c->misses,
+            (total > 0) ? 100.0*c->hits/total : 0.0, (double)c->used/1024/1024);
+}
+
+void shcache_free(shcache_t *c){
+    shent_t *e=c->top, *next;
+
+    while (e != NULL){
+        next = e->next;
+        shent_free(e);
+        e = next;
+    }
+    if (c->scratch != NULL) shent_free(c->scratch);
+    free(c);
+}
+
+// end of shcache.c
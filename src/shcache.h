@@ -0,0 +1,62 @@
+/*
+  utpdf/utps
+  margin-aware converter from utf-8 text to PDF/PostScript
+
+  Copyright (c) 2021 by Akihiro SHIMIZU
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __SHCACHE_H__
+#define __SHCACHE_H__
+
+#include "utpdf.h"
+#include "cache.h"
+#include "pangoprint.h"
+
+#define SHCACHE_SIZE    16   // default memory budget of shaped lines (MB)
+#define SHCACHE_BUCKETS 4096
+
+// a segment of line, folded at the available width
+typedef struct shape_entry {
+    hash_t hash;
+    char *text;           // key: bytes of segment,
+    int len;
+    PangoFontDescription *desc; // font (a copy),
+    double x0;            //      position from the tab origin,
+    double avail;         //      available width,
+    enum input_class shaping; //  and the shaping path
+    int fold;             // bytes which fit in avail
+    pcglyphs_t *glyphs;   // shaped text[0..fold)
+    size_t size;          // memory used by the entry
+    struct shape_entry *prev, *next; // LRU list: most recently used first
+    struct shape_entry *hnext;       // hash chain
+} shent_t;
+
+typedef struct shape_cache {
+    shent_t *table[SHCACHE_BUCKETS];
+    shent_t *top, *last;
+    shent_t *scratch;     // entry larger than budget, until the next call
+    size_t used, budget;  // byte
+    long hits, misses;
+} shcache_t;
+
+extern shcache_t *shcache_new(double budget_mb);
+extern shent_t *shcache_fold(shcache_t *c, pcobj *obj, const char *seg, int len,
+                             double x0, double avail);
+extern void shcache_report(shcache_t *c);
+extern void shcache_free(shcache_t *c);
+
+#endif
+
+// end of shcache.h
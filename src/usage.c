@@ -28,6 +28,10 @@
 #include "paper.h"
 #include "usage.h"
 #include "args.h"
+#include "cache.h"
+#include "shcache.h"
+#include "raster.h"
+#include "pdfopt.h"
 
 #define ARGC 32
 
@@ -116,7 +120,7 @@ void help(){
 }
 
 char *get_confname(){
-    if (makepdf){
+    if (utpdf_makepdf){
         return PDF_CONF_FILE;
     } else {
         return PS_CONF_FILE;
@@ -126,7 +130,7 @@ char *get_confname(){
 void help_message(int fd){
     FILE *f=fdopen(fd, "w");
     
-    fprintf(f, "Usage: %s [options] <utf8_textfile> ...\n", prog_name);
+    fprintf(f, "Usage: %s [options] <utf8_textfile> ...\n", utpdf_prog_name);
     fprintf(f, "options:\n");
     fprintf(f, "  basic settings:\n");
     fprintf(f, "    -b, --border[=on/off] draw border (default: off)\n");
@@ -151,7 +155,7 @@ void help_message(int fd){
     fprintf(f, "    --binded-edge=long/short/none\n");    
     fprintf(f, "                            bind long edge/short edge/none\n");
     fprintf(f, "                            (portrait default: long/landscape default: short)\n");
-    if (!makepdf) {
+    if (!utpdf_makepdf) {
     fprintf(f, "    --force-duplex[=on/off] force to duplex printing (default: off)\n");
     }
     fprintf(f, "\n");    
@@ -163,8 +167,56 @@ void help_message(int fd){
     fprintf(f, "    -V, --version       show version\n");
     fprintf(f, "    --inch, --unit=inch length unit is inch\n");
     fprintf(f, "    --mm,   --unit=mm   length unit is mm (defalt)\n");
+    fprintf(f, "    --stats[=on/off]    show statistics on stderr (default: off)\n");
+    fprintf(f, "                        e.g. time to first page, peak RSS\n");
+    fprintf(f, "    --backend=cairo/native\n");
+    fprintf(f, "                        %s writer: cairo or built-in (default: cairo)\n",
+            utpdf_makepdf ? "PDF" : "PostScript");
+    fprintf(f, "    --shape-cache=<MB>  memory for shaped lines to reuse on repeated lines\n");
+    fprintf(f, "                        (default: %dMB, 0: off)\n", SHCACHE_SIZE);
+    fprintf(f, "    --tee=<file>        also write %s of the same pages to <file>\n",
+            utpdf_makepdf ? "PostScript" : "PDF");
+    fprintf(f, "                        (cairo only, with one output)\n");
+    fprintf(f, "    --png=<prefix>      also write every page to <prefix>-0001.png, ...\n");
+    fprintf(f, "                        on threads (cairo only, with one output)\n");
+    fprintf(f, "    --dpi=<dpi>         resolution of --png (default: %d)\n", RASTER_DPI);
+    if (utpdf_makepdf) {
+    fprintf(f, "    --optimize[=on/off] rewrite the finished PDF with object and xref streams,\n");
+    fprintf(f, "                        recompressed streams and no duplicates (default: off)\n");
+    fprintf(f, "    --compress-level=<0-9>\n");
+    fprintf(f, "                        deflate level of --optimize/--linearize (default: %d)\n", PDFOPT_LEVEL);
+    fprintf(f, "    --linearize[=on/off]\n");
+    fprintf(f, "                        rewrite the finished PDF for fast web view: the first\n");
+    fprintf(f, "                        page is shown before the rest arrives (default: off)\n");
+    }
+    fprintf(f, "\n");
+
+    fprintf(f, "  output cache:\n");
+    fprintf(f, "    --cache-dir=<dir>   reuse the output of unchanged input from <dir>\n");
+    fprintf(f, "    --cache-size=<MB>   size limit of cache directory (default: %dMB)\n", CACHE_SIZE);
+    fprintf(f, "    --deterministic[=on/off]\n");
+    fprintf(f, "                        fix creation date to $%s or timestamp\n", SOURCE_DATE_EPOCH);
+    fprintf(f, "                        (default: on with --cache-dir, otherwise off)\n");
+    fprintf(f, "    --incremental[=on/off]\n");
+    fprintf(f, "                        keep page fingerprints in <output>%s, and\n", ".pages");
+    fprintf(f, "                        skip rendering if no page is changed (default: off)\n");
+    if (utpdf_makepdf) {
+    fprintf(f, "                        with --backend=native, pages before the first changed\n");
+    fprintf(f, "                        one are copied from the previous output\n");
+    }
     fprintf(f, "\n");
 
+    if (!utpdf_makepdf) {
+    fprintf(f, "  streaming:\n");
+    fprintf(f, "    --stream[=on/off]   write every page as soon as it is filled (default: off)\n");
+    fprintf(f, "    --follow[=on/off]   write every page as soon as it is filled, and wait\n");
+    fprintf(f, "                        for the growth of last file like \"tail -f\" (default: off)\n");
+    fprintf(f, "    --follow-timeout=<sec>\n");
+    fprintf(f, "                        stop following after <sec> idle (default: 0, never)\n");
+    fprintf(f, "                        the last page is written on timeout or SIGINT\n");
+    fprintf(f, "\n");
+    }
+
     fprintf(f, "  body:\n");
     fprintf(f, "    -F <fontname>, --body-font=<fontname>\n");
     fprintf(f, "                        body font (default: %s)\n", DEFAULT_FONT);
@@ -233,8 +285,8 @@ void usage(char *message){
     if (message != NULL){
         fprintf(stderr, "%s\n", message);
     }
-    fprintf(stderr, "Usage: %s [-options...] <utf8_textfile> ...\n", prog_name);
-    fprintf(stderr, "For more detail, %s -h\n", prog_name);
+    fprintf(stderr, "Usage: %s [-options...] <utf8_textfile> ...\n", utpdf_prog_name);
+    fprintf(stderr, "For more detail, %s -h\n", utpdf_prog_name);
     exit(1);
 }
 
@@ -261,11 +313,11 @@ void version(){
 
 #ifdef SINGLE_DEBUG
 
-int makepdf=1;
-char *prog_name;
+int utpdf_makepdf=1;
+char *utpdf_prog_name;
 
 int main(int argc, char **argv){
-    prog_name=argv[0];
+    utpdf_prog_name=argv[0];
     if (argc==1){
         help();
     }
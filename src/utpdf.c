@@ -23,9 +23,12 @@
 #include "usage.h"
 #include "args.h"
 #include "io.h"
-
-int makepdf=1;
-char *prog_name;
+#include "cache.h"
+#include "incr.h"
+#include "psstream.h"
+#include "shcache.h"
+#include "raster.h"
+#include "pdfopt.h"
 
 char *path2cmd(char *p){
     char *cur=p;
@@ -36,19 +39,92 @@ char *path2cmd(char *p){
     return p;
 }
 
+/*
+  cairo reads $SOURCE_DATE_EPOCH for the PostScript %%CreationDate.
+  The command line is single-threaded, so it is set for every output
+  here, unless the user gave it. libutpdf only reads it.
+*/
+void fix_creation_date(args_t *args){
+    static int given=-1;
+    char buf[S_LEN];
+
+    if (given < 0) given = (getenv(SOURCE_DATE_EPOCH) != NULL);
+    if (given) return;
+    snprintf(buf, S_LEN, "%lld", (long long)*args->mtime);
+    setenv(SOURCE_DATE_EPOCH, buf, 1);
+}
+
+//
+// --stats: time to first page and peak RSS
+
+struct timespec start_time, first_output;
+int output_finished=0;
+
+// the first page is available, when the whole output was written.
+void output_done(){
+    if (!output_finished){
+        clock_gettime(CLOCK_MONOTONIC, &first_output);
+        output_finished = 1;
+    }
+}
+
+double elapsed(struct timespec *t){
+    return (t->tv_sec - start_time.tv_sec) + (t->tv_nsec - start_time.tv_nsec)/1e9;
+}
+
+void output_report(pdfw_stats_t *content){
+    struct rusage ru;
+    long maxrss;
+
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    maxrss = ru.ru_maxrss/1024; // byte
+#else
+    maxrss = ru.ru_maxrss;      // Kbyte
+#endif
+    if (psstream_written){
+        // streaming: every page was written as soon as it was filled.
+        fprintf(stderr, "%s: output: first page after %.3f sec.\n",
+                utpdf_prog_name, elapsed(&psstream_first_page));
+    } else if (output_finished){
+        fprintf(stderr, "%s: output: first page after %.3f sec.\n",
+                utpdf_prog_name, elapsed(&first_output));
+    }
+    if (content->ops > 0){
+        // native writer: page content streams of every output
+        fprintf(stderr, "%s: output: %ld operators, %ld bytes of page content\n",
+                utpdf_prog_name, content->ops, content->bytes);
+    }
+    fprintf(stderr, "%s: output: peak RSS %ld KB\n", utpdf_prog_name, maxrss);
+}
+
+// classes of input reads (io.c)
+void input_report(ustats_t *s){
+    fprintf(stderr, "%s: input: %ld reads of ASCII, %ld of simple text, %ld of complex text\n",
+            utpdf_prog_name, s->chunks[ic_ascii], s->chunks[ic_grid], s->chunks[ic_complex]);
+    if (s->file != NULL){
+        fprintf(stderr, "%s: input: complex shaping from %s in %s\n",
+                utpdf_prog_name, s->reason, s->file);
+    }
+}
+
 //
 // 
 int main(int argc, char** argv){
     int fileindex;
+    args_t *args;
+    job_t *job;
     
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     setlocale(LC_ALL, "");
-    prog_name=path2cmd(argv[0]);
-    makepdf = (strncmp(prog_name, MKPDFNAME, NAMELEN)==0);
+    utpdf_prog_name=path2cmd(argv[0]);
+    utpdf_makepdf = (strncmp(utpdf_prog_name, MKPDFNAME, NAMELEN)==0);
 
     //
     // parse arguments
     //
-    getargs(argc, argv);
+    args = getargs(argc, argv);
+    job = job_new(args);
     
     //
     // Draw each file
@@ -56,7 +132,12 @@ int main(int argc, char** argv){
     {
 	// pcobj stuff (pcobj: pango_cairo_print_object)
         pcobj *obj=NULL;
-	int out_fd, output_notspecified=(args->outfile==NULL);
+	int out_fd, render_fd, output_notspecified=(args->outfile==NULL);
+        int tee_fd=-1, copy_sheets=0;
+        duplex_t duplex, tee_duplex;
+        cache_t *cache=NULL;
+        incr_t *incr=NULL;
+        long in_end=0; // input read into the output of incremental mode
 
         // for every inout file, do:
 	for (fileindex = optind; fileindex < argc; fileindex++) {    
@@ -74,29 +155,62 @@ int main(int argc, char** argv){
 		args->in_fname="STDIN";
 		args->current_t=1;
 	    } else {
-		in_fd = openfd(args->in_fname, O_RDONLY);
+		if ((in_fd = openfd(args->in_fname, O_RDONLY)) < 0) exit(1);
 	    }
 	    in_f = fdopen_u(in_fd, args->in_fname);
+            in_f->stats = &job->input;
+            if (args->follow && (fileindex == (argc-1))){
+                // wait for the growth of last file, like "tail -f"
+                follow_u(in_f, args->follow_timeout);
+            }
+
+            if (args->current_t){
+                time(args->mtime);
+            } else {
+                if (fstat(in_fd, &stat_b)<0){
+                    perror("Could not fstat: ");
+                    exit(1);
+                }
+                *args->mtime = stat_b.st_mtime;
+            }
 
 	    // create output file and surface 
 	    if (obj == NULL) {
 		// new file
-		if (makepdf) {
+                if (utpdf_makepdf && output_notspecified) {
+                    static char outf_store[S_LEN];
+
+                    snprintf(outf_store, S_LEN, "%s.pdf", args->in_fname);
+                    args->outfile = outf_store;
+                }
+                // incremental mode: one input to one output only
+                if (args->incremental && !(args->one_output && (argc-optind > 1))
+                    && (args->outfile != NULL)) {
+                    incr = incr_open(args, args->outfile, in_fd);
+                    if ((incr != NULL) && incr_up_to_date(incr)) {
+                        // the previous output is up to date
+                        incr_close(incr);
+                        incr=NULL;
+                        close_u(in_f);
+                        if (args->one_output) break; // every file is done.
+                        continue;
+                    }
+                    if (incr != NULL) {
+                        // unchanged sheets are copied from it below
+                        copy_sheets = incr_prev_open(incr, args, utpdf_makepdf);
+                    }
+                }
+		if (utpdf_makepdf) {
                     // pdf
-		    if (output_notspecified) {
-                        static char outf_store[S_LEN];
-                        
- 			snprintf(outf_store, S_LEN, "%s.pdf", args->in_fname);
-                        args->outfile = outf_store;
-		    } 
                     if (strncmp(args->outfile, "-", S_LEN)==0) {
 			out_fd = STDOUT_FILENO;
+		    } else if (incr != NULL) {
+			// replaces the output when it is finished
+			if ((out_fd = incr_output_open(incr)) < 0) exit(1);
 		    } else {
 			out_fd = openfd(args->outfile, O_CREAT|O_RDWR|O_TRUNC);
+			if (out_fd < 0) exit(1);
 		    }
-		    obj = pcobj_pdf_new
-                        ((cairo_write_func_t )write_func, (void *)&out_fd, 
-                         args->pwidth, args->pheight);
 		} else {
                     // PostScript
 		    if (output_notspecified) {
@@ -105,76 +219,89 @@ int main(int argc, char** argv){
                         out_fd = STDOUT_FILENO;
 		    } else if (strncmp(args->outfile, "-", S_LEN)==0) {
 			out_fd = STDOUT_FILENO;
+		    } else if (incr != NULL) {
+			if ((out_fd = incr_output_open(incr)) < 0) exit(1);
 		    } else {
 			out_fd = openfd(args->outfile, O_CREAT|O_WRONLY|O_TRUNC);
+			if (out_fd < 0) exit(1);
 		    }
-                    if (args->duplex) {
-                        if (args->force_duplex){
-                            obj = pcobj_ps_new
-                                ((cairo_write_func_t )write_ps_duplex, (void *)&out_fd,
-                                 args->phys_width, args->phys_height);
-                        } else {
-                            obj = pcobj_ps_new
-                                ((cairo_write_func_t )write_func, (void *)&out_fd,
-                                 args->phys_width, args->phys_height);
-                        }
-                        cairo_ps_surface_dsc_comment
-                            (obj->surface, "%%Requirements: duplex");
-                        cairo_ps_surface_dsc_begin_setup(obj->surface);
-                        cairo_ps_surface_dsc_comment
-                            (obj->surface,
-                             "%%IncludeFeature: *Duplex DuplexNoTumble");
-                        // set orientation
-                        cairo_ps_surface_dsc_begin_page_setup (obj->surface);
-                        if (args->portrait) {
-                            cairo_ps_surface_dsc_comment
-                                (obj->surface, "%%PageOrientation: Portrait");
-                        } else {
-                            cairo_ps_surface_dsc_comment
-                                (obj->surface, "%%PageOrientation: Landscape");
-                        }
-                    } else {
-                        // simplex printing
-                        obj = pcobj_ps_new
-                            ((cairo_write_func_t )write_func, (void *)&out_fd,
-                             args->pwidth, args->pheight);
-                        // set orientation
-                        cairo_ps_surface_dsc_begin_page_setup (obj->surface);
-                        if (args->portrait) {
-                            cairo_ps_surface_dsc_comment
-                                (obj->surface, "%%PageOrientation: Portrait");
-                        } else {
-                            cairo_ps_surface_dsc_comment
-                                (obj->surface, "%%PageOrientation: Landscape");
-                        }
-                    } // if (args->duplex) else
-		} // if (makepdf) else
+                }
+
+                // output cache
+                cache = cache_open(args, &argv[fileindex],
+                                   args->one_output ? (argc-fileindex) : 1);
+                if ((cache != NULL) && cache->hit) {
+                    // reuse the previous output
+                    int copied=cache_copy(cache, out_fd);
+
+                    cache_close(cache);
+                    cache=NULL;
+                    if (copied) {
+                        close_u(in_f);
+                        if (close(out_fd) < 0) exit(1);
+                        if (incr_finish(incr, 0) < 0) exit(1);
+                        incr=NULL;
+                        copy_sheets=0;
+                        output_done();
+                        if (args->one_output) break; // every file is done.
+                        continue;
+                    }
+                    // render it again over the partial copy
+                    if ((lseek(out_fd, 0, SEEK_SET) < 0) || (ftruncate(out_fd, 0) < 0)) {
+                        exit(1);
+                    }
+                }
+                render_fd = (cache != NULL) ? cache->tmp_fd : out_fd;
+                job->page = 1; // a new output starts with an odd page
+                if (args->deterministic) {
+                    fix_creation_date(args);
+                }
+                obj = utpdf_output_new(args, utpdf_makepdf, (cairo_write_func_t )write_func,
+                                       &render_fd, &duplex);
+                if (obj == NULL) exit(1);
+                if ((args->tee != NULL) || (args->png != NULL)) {
+                    // the other format and PNG of the same pages
+                    if (args->tee != NULL) {
+                        tee_fd = openfd(args->tee, O_CREAT|O_WRONLY|O_TRUNC);
+                        if (tee_fd < 0) exit(1);
+                    }
+                    obj = utpdf_fanout_new(args, utpdf_makepdf, obj,
+                                           (cairo_write_func_t )write_func,
+                                           &tee_fd, &tee_duplex);
+                    if (obj == NULL) exit(1);
+                }
+                // the counters of every output are summed in the job
+                pcobj_count_content(obj, &job->output);
+                if (copy_sheets > 0) {
+                    incr_resume(incr, pcobj_copy_pages(obj, incr->prev, incr->prev_len,
+                                                       copy_sheets));
+                    copy_sheets = 0;
+                }
                 // cr = cairo_create(surface);
                 // obj = pcobj_new(cr);
 	    } // if (surface == NULL)
             
-            cairo_set_source_rgb(obj->cr, C_BLACK);
-  
-            if (args->current_t){
-                time(args->mtime);
-            } else {
-                if (fstat(in_fd, &stat_b)<0){
-                    perror("Could not fstat: ");
-                    exit(1);
-                }
-                *args->mtime = stat_b.st_mtime;
-            }
+            pcobj_set_rgb(obj, C_BLACK);
 
             //
-            draw_file(obj, in_f, args, (fileindex == (argc-1)));
+            draw_file(job, obj, in_f, (fileindex == (argc-1)), incr);
             //
-
+            if (in_f->error) exit(1);
+            in_end = in_f->pos;
             close_u(in_f);
 
             if (! args->one_output){
                 // close output
-                pcobj_free(obj);
-                close(out_fd);
+                if (pcobj_free(obj) < 0) exit(1);
+                if (cache != NULL){
+                    if (!cache_store(cache, out_fd)) exit(1);
+                    cache_close(cache);
+                    cache=NULL;
+                }
+                if (close(out_fd) < 0) exit(1);
+                if (incr_finish(incr, in_end) < 0) exit(1);
+                incr=NULL;
+                output_done();
                 obj=NULL;
             } else {
                 // if (fileindex < (argc-1)){
@@ -183,12 +310,29 @@ int main(int argc, char** argv){
             }
         } // for (fileindex = optind; fileindex < argc; fileindex++) {
 
-        if (args->one_output){
+        if (args->one_output && (obj != NULL)){
             // close output
-            pcobj_free(obj);
-            close(out_fd);
+            if (pcobj_free(obj) < 0) exit(1);
+            if (cache != NULL){
+                if (!cache_store(cache, out_fd)) exit(1);
+                cache_close(cache);
+            }
+            if (close(out_fd) < 0) exit(1);
+            if (incr_finish(incr, in_end) < 0) exit(1);
+            if (tee_fd >= 0) close(tee_fd);
+            output_done();
         }
     }
+    if (args->stats){
+        cache_report(args);
+        incr_report(args);
+        output_report(&job->output);
+        raster_report();
+        pdfopt_report();
+        input_report(&job->input);
+        shcache_report(job->shape_cache);
+    }
+    job_free(job);
     exit(0);
 }
 
@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <time.h>
 #include <string.h>
@@ -109,8 +110,15 @@
 // #define DATE_FORMAT "%m/%d/%y %H:%M"
 #define DATE_FORMAT "%D %R"
 
+// environment variable for reproducible builds
+#define SOURCE_DATE_EPOCH "SOURCE_DATE_EPOCH"
+
 enum direction { d_down=-2, d_right=-1, d_none=0, d_left=1, d_up=2  };
 
+// input classified by io.c, in the order of cost of shaping
+enum input_class { ic_ascii=0, ic_grid=1, ic_complex=2 };
+#define INPUT_CLASSES 3
+
 typedef struct main_coordinates {
     double head_top, mbottom, mleft, mright, body_left, body_right, bwidth;
     enum direction markdir;
@@ -120,10 +128,28 @@ typedef struct sub_coordinates {
     double text_left, num_right, body_inset; 
     double body_top, oneline_h, bottombase;
     int lineperpage;
+    double limitw;             // width of text
+    double arrow_edge, cont_x; // fold arrows
+    double return_x;
 } scoord_t;
 
-extern int makepdf;
-extern char *prog_name;
+// variants of the loop of draw_lines()
+#define LINES_ARROW  1 // --fold-arrow
+#define LINES_NUMBER 2 // --numbering
+
+// geometry of every page variant, and metrics of the body font.
+// it is built once per job, and pages index it by page_variant().
+typedef struct render_plan {
+    int variants;         // 1, 2 or 4
+    mcoord_t mcoord[4];
+    scoord_t scoord[4];
+    double em, digit_w, gutter_w; // width of "M", "0" and "000000"
+    double ascent, descent;
+    int kernel;           // LINES_ARROW | LINES_NUMBER
+} plan_t;
+
+extern int utpdf_makepdf;
+extern char *utpdf_prog_name;
 extern char *path2cmd(char *p);
 extern cairo_status_t write_func
    (void *closure, const unsigned char *data, unsigned int length);